@@ -0,0 +1,191 @@
+#include "address_space.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/auxv.h>
+#include <unistd.h>
+
+static uint64_t parse_hex(const char *&p, const char *end) {
+  uint64_t value = 0;
+  for (; p < end; ++p) {
+    char c = *p;
+    if (c >= '0' && c <= '9') {
+      value = value * 16 + (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = value * 16 + (c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+static uint64_t parse_decimal(const char *&p, const char *end) {
+  uint64_t value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    value = value * 10 + (*p - '0');
+  }
+  return value;
+}
+
+static void skip(const char *&p, const char *end, char c) {
+  while (p < end && *p == c) {
+    ++p;
+  }
+}
+
+static void skip_field(const char *&p, const char *end) {
+  while (p < end && *p != ' ' && *p != '\n') {
+    ++p;
+  }
+  skip(p, end, ' ');
+}
+
+static bool read_file(const std::string &path, std::vector<char> &buffer) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  size_t size = 0;
+  // Reuse all of the last read's capacity, growing the buffer allocates and
+  // can change the very maps being read
+  buffer.resize(buffer.capacity() < 4096 ? 4096 : buffer.capacity());
+  while (true) {
+    if (size == buffer.size()) {
+      buffer.resize(buffer.size() * 2);
+    }
+    ssize_t got = read(fd, buffer.data() + size, buffer.size() - size);
+    if (got <= 0) {
+      break;
+    }
+    size += got;
+  }
+  close(fd);
+  buffer.resize(size);
+  return true;
+}
+
+AddressSpace::AddressSpace(pid_t pid)
+    : pid(pid), mappings(), buffer(), scratch(), generation(0) {}
+
+bool AddressSpace::refresh() {
+  if (!read_file("/proc/" + std::to_string(pid) + "/maps", buffer)) {
+    throw std::runtime_error("Failed to read maps of process " +
+                             std::to_string(pid));
+  }
+
+  // Single pass over "start-end perms offset dev inode   path"
+  scratch.clear();
+  size_t old = 0;
+  bool changed = false;
+  const char *p = buffer.data();
+  const char *end = p + buffer.size();
+  while (p < end) {
+    Mapping mapping;
+    mapping.start = parse_hex(p, end);
+    skip(p, end, '-');
+    mapping.end = parse_hex(p, end);
+    skip(p, end, ' ');
+    mapping.permissions = 0;
+    if (end - p >= 4) {
+      mapping.permissions |= p[0] == 'r' ? MappingRead : 0;
+      mapping.permissions |= p[1] == 'w' ? MappingWrite : 0;
+      mapping.permissions |= p[2] == 'x' ? MappingExecute : 0;
+      mapping.permissions |= p[3] == 's' ? MappingShared : 0;
+    }
+    skip_field(p, end);
+    mapping.offset = parse_hex(p, end);
+    skip(p, end, ' ');
+    skip_field(p, end); // Device
+    mapping.inode = parse_decimal(p, end);
+    skip(p, end, ' ');
+    const char *path = p;
+    while (p < end && *p != '\n') {
+      ++p;
+    }
+    size_t path_length = p - path;
+    ++p;
+
+    // Both lists are sorted, so matching entries are found by merging
+    while (old < mappings.size() && mappings[old].start < mapping.start) {
+      ++old;
+      changed = true; // Gone
+    }
+    if (old < mappings.size() && mappings[old].start == mapping.start &&
+        mappings[old].end == mapping.end &&
+        mappings[old].offset == mapping.offset &&
+        mappings[old].inode == mapping.inode &&
+        mappings[old].permissions == mapping.permissions &&
+        mappings[old].path.compare(0, std::string::npos, path,
+                                   path_length) == 0) {
+      scratch.push_back(std::move(mappings[old++]));
+      continue;
+    }
+    mapping.path.assign(path, path_length);
+    scratch.push_back(std::move(mapping));
+    changed = true;
+  }
+  changed |= old < mappings.size();
+
+  mappings.swap(scratch);
+  // Growing the spare list on the next refresh would allocate after the maps
+  // were read, so that one more refresh sees our own heap change
+  scratch.reserve(mappings.capacity());
+  if (changed) {
+    ++generation;
+  }
+  return changed;
+}
+
+uint64_t AddressSpace::get_generation() const { return generation; }
+
+const Mapping *AddressSpace::find(uintptr_t address) const {
+  auto it = std::upper_bound(
+      mappings.begin(), mappings.end(), address,
+      [](uintptr_t a, const Mapping &mapping) { return a < mapping.start; });
+  if (it == mappings.begin()) {
+    return nullptr;
+  }
+  --it;
+  return address < it->end ? &*it : nullptr;
+}
+
+const std::vector<Mapping> &AddressSpace::get_mappings() const {
+  return mappings;
+}
+
+std::optional<uintptr_t>
+AddressSpace::find_load_base(const std::string &path) const {
+  for (const Mapping &mapping : mappings) {
+    if (mapping.path == path) {
+      return mapping.start - mapping.offset;
+    }
+  }
+  return std::nullopt;
+}
+
+template <typename Class>
+std::optional<uint64_t> AddressSpace::read_auxv(uint64_t type) const {
+  std::vector<char> auxv;
+  if (!read_file("/proc/" + std::to_string(pid) + "/auxv", auxv)) {
+    return std::nullopt;
+  }
+  struct auxv_entry_t {
+    typename Class::Word type;
+    typename Class::Word value;
+  };
+  const auxv_entry_t *entries =
+      reinterpret_cast<const auxv_entry_t *>(auxv.data());
+  size_t count = auxv.size() / sizeof(auxv_entry_t);
+  for (size_t i = 0; i < count && entries[i].type != AT_NULL; ++i) {
+    if (entries[i].type == type) {
+      return entries[i].value;
+    }
+  }
+  return std::nullopt;
+}
+
+template std::optional<uint64_t>
+AddressSpace::read_auxv<ELFClass32>(uint64_t type) const;
+template std::optional<uint64_t>
+AddressSpace::read_auxv<ELFClass64>(uint64_t type) const;
@@ -0,0 +1,54 @@
+#pragma once
+#include "elf.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+enum MappingPermissions : uint8_t {
+  MappingRead = 1,
+  MappingWrite = 2,
+  MappingExecute = 4,
+  MappingShared = 8,
+};
+
+struct Mapping {
+  uintptr_t start;
+  uintptr_t end; // Exclusive
+  uint64_t offset;
+  uint64_t inode;
+  uint8_t permissions; // MappingPermissions
+  std::string path;    // Empty for anonymous mappings
+};
+
+// Mappings of a process, sorted by address, from /proc/<pid>/maps
+class AddressSpace {
+  pid_t pid;
+  std::vector<Mapping> mappings;
+  // Reused between refreshes, so re-reading doesn't allocate
+  std::vector<char> buffer;
+  std::vector<Mapping> scratch;
+  uint64_t generation;
+
+public:
+  explicit AddressSpace(pid_t pid = 0);
+
+  // Re-reads the maps in a single pass. Entries that didn't change are kept
+  // as they were, without copying their path again.
+  // Returns true if anything changed.
+  bool refresh();
+  // Bumped by every refresh that changed something
+  uint64_t get_generation() const;
+
+  // Mapping containing the address, nullptr if none
+  const Mapping *find(uintptr_t address) const;
+  const std::vector<Mapping> &get_mappings() const;
+  // Address the file's offset 0 is mapped at, for its lowest mapping
+  std::optional<uintptr_t> find_load_base(const std::string &path) const;
+
+  // Entry of the process' auxiliary vector, e.g. AT_ENTRY or AT_BASE
+  // Its words are as wide as the addresses of the executable's class
+  template <typename Class = ELFClass64>
+  std::optional<uint64_t> read_auxv(uint64_t type) const;
+};
@@ -0,0 +1,14 @@
+#include "../condition.h"
+#include <benchmark/benchmark.h>
+
+// Per-hit cost of a --cond filter, paid after every stop
+static void BM_ConditionEvaluate(benchmark::State &state) {
+  Condition condition("value - old >= 64 && (value & 0x1) || tid == 7");
+  ConditionInput input = {1000, 900, 0x401000, 1234, true};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(input.value);
+    benchmark::DoNotOptimize(condition.evaluate(input));
+    ++input.value;
+  }
+}
+BENCHMARK(BM_ConditionEvaluate);
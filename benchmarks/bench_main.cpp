@@ -0,0 +1,54 @@
+#include "bench_tracing.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Comma separated numbers, e.g. "0,1000,100000"
+static std::vector<int64_t> parse_list(const char *text) {
+  std::vector<int64_t> values;
+  for (char *end; *text; text = *end ? end + 1 : end) {
+    values.push_back(std::strtoll(text, &end, 10));
+    if (end == text) {
+      return {};
+    }
+  }
+  return values;
+}
+
+int main(int argc, char **argv) {
+  std::vector<int64_t> rates = {0, 10000, 100000};
+  std::vector<int64_t> threads = {1, 4};
+  int64_t writes = 2000;
+
+  // Our own flags are taken out before Google Benchmark sees the rest
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (std::strncmp(arg, "--tracee_rates=", 15) == 0) {
+      rates = parse_list(arg + 15);
+    } else if (std::strncmp(arg, "--tracee_threads=", 17) == 0) {
+      threads = parse_list(arg + 17);
+    } else if (std::strncmp(arg, "--tracee_writes=", 16) == 0) {
+      writes = std::strtoll(arg + 16, nullptr, 10);
+    } else {
+      argv[kept++] = argv[i];
+      continue;
+    }
+    if (rates.empty() || threads.empty() || writes <= 0) {
+      std::fprintf(stderr, "Invalid value: %s\n", arg);
+      return 1;
+    }
+  }
+  argc = kept;
+
+  register_slowdown_benchmarks(rates, threads, writes);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
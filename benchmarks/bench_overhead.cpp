@@ -0,0 +1,46 @@
+#include "../overhead.h"
+#include <benchmark/benchmark.h>
+
+// The probes one ptrace hit goes through, as Process and the event loop
+// call them. Should stay below 50 ns with instrumentation on (range 1).
+static void BM_OverheadProbesPerHit(benchmark::State &state) {
+  OverheadStats stats;
+  uint32_t watch = stats.add_watch("counter");
+  if (state.range(0)) {
+    stats.enable();
+  }
+  for (auto _ : state) {
+    uint64_t stop = stats.start(OverheadPhase::StopDetection);
+    stats.add_syscalls(2); // waitpid, then one with WNOHANG
+    stats.finish(OverheadPhase::StopDetection, stop);
+    for (int i = 0; i < 2; ++i) {
+      // DR6, then the instruction pointer
+      uint64_t registers = stats.start(OverheadPhase::RegisterRead);
+      stats.add_syscalls(1);
+      stats.finish(OverheadPhase::RegisterRead, registers);
+    }
+    uint64_t memory = stats.start(OverheadPhase::MemoryRead);
+    stats.add_syscalls(1);
+    stats.add_bytes_read(8);
+    stats.finish(OverheadPhase::MemoryRead, memory);
+    uint64_t emit = stats.start(OverheadPhase::Emit);
+    stats.add_hit(watch);
+    stats.finish(OverheadPhase::Emit, emit);
+    uint64_t resume = stats.start(OverheadPhase::Resume);
+    stats.add_syscalls(1);
+    stats.finish(OverheadPhase::Resume, resume);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OverheadProbesPerHit)->Arg(0)->Arg(1);
+
+// Cost of one sampled probe, what every sample_period-th call pays
+static void BM_OverheadSampledProbe(benchmark::State &state) {
+  OverheadStats stats;
+  stats.enable(1);
+  for (auto _ : state) {
+    stats.finish(OverheadPhase::Emit, stats.start(OverheadPhase::Emit));
+  }
+}
+BENCHMARK(BM_OverheadSampledProbe);
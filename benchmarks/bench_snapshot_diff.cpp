@@ -0,0 +1,31 @@
+#include "../snapshot_diff.h"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// Diff throughput of each kernel over snapshots with one changed word per
+// 64 KiB, reported in bytes/s
+static void BM_SnapshotDiff(benchmark::State &state) {
+  DiffKernel kernel = static_cast<DiffKernel>(state.range(0));
+  if (!diff_kernel_supported(kernel)) {
+    state.SkipWithError("Kernel not supported by this CPU");
+    return;
+  }
+  size_t size = state.range(1);
+  std::vector<uint8_t> old(size, 0x5a);
+  std::vector<uint8_t> current = old;
+  for (size_t offset = 0; offset < size; offset += 64 * 1024) {
+    current[offset] ^= 1;
+  }
+  std::vector<size_t> changed;
+  for (auto _ : state) {
+    changed.clear();
+    diff_snapshots(kernel, old.data(), current.data(), size, changed);
+    benchmark::DoNotOptimize(changed.data());
+  }
+  state.SetLabel(diff_kernel_name(kernel));
+  state.SetBytesProcessed(int64_t(state.iterations()) * size);
+}
+BENCHMARK(BM_SnapshotDiff)
+    ->ArgsProduct({{int(DiffKernel::Scalar), int(DiffKernel::SSE2),
+                    int(DiffKernel::AVX2)},
+                   {64 * 1024, 16 * 1024 * 1024}});
@@ -0,0 +1,83 @@
+#include "../elf.h"
+#include "../symbol_loader.h"
+#include "synthetic_elf.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+static std::vector<std::string> random_names(size_t symbols, size_t count) {
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<size_t> pick(0, symbols - 1);
+  std::vector<std::string> names;
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back(synthetic_symbol_name(pick(rng)));
+  }
+  return names;
+}
+
+// Lookup latency should stay flat as the symbol count grows
+static void BM_SymbolLookup(benchmark::State &state) {
+  size_t symbols = state.range(0);
+  ELF elf;
+  elf.load(write_synthetic_elf(".", symbols));
+  elf.validate();
+  elf.get_symbol(synthetic_symbol_name(0)); // Build the index up front
+
+  std::vector<std::string> names = random_names(symbols, 4096);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(elf.get_symbol(names[i++ & 4095]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SymbolLookup)->RangeMultiplier(10)->Range(1000, 10000000);
+
+static void BM_SymbolLookupMiss(benchmark::State &state) {
+  ELF elf;
+  elf.load(write_synthetic_elf(".", state.range(0)));
+  elf.validate();
+  elf.get_symbol(synthetic_symbol_name(0));
+
+  std::string name = "not_a_synthetic_symbol";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(elf.get_symbol(name));
+  }
+}
+BENCHMARK(BM_SymbolLookupMiss)->RangeMultiplier(10)->Range(1000, 10000000);
+
+// One-off cost paid on the first lookup
+static void BM_SymbolIndexBuild(benchmark::State &state) {
+  std::string path = write_synthetic_elf(".", state.range(0));
+  std::string name = synthetic_symbol_name(0);
+  for (auto _ : state) {
+    ELF elf;
+    elf.load(path);
+    benchmark::DoNotOptimize(elf.get_symbol(name));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SymbolIndexBuild)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10000000)
+    ->Unit(benchmark::kMillisecond);
+
+// Startup with many objects: 32 tables of 100k symbols on `range` workers
+static void BM_ParallelIndexBuild(benchmark::State &state) {
+  std::string path = write_synthetic_elf(".", 100000);
+  for (auto _ : state) {
+    SymbolLoader loader(state.range(0));
+    for (int i = 0; i < 32; ++i) {
+      loader.add(path);
+    }
+    SymbolLoader::Result result;
+    while (loader.next(result)) {
+      benchmark::DoNotOptimize(result.elf.get());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 32);
+}
+BENCHMARK(BM_ParallelIndexBuild)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,112 @@
+#include "bench_tracing.h"
+#include "../elf.h"
+#include "../process.h"
+#include "../ptrace_backend.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <time.h>
+
+// Built next to us by CMake
+static const char *const tracee_path = GWATCH_SYNTHETIC_TRACEE;
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static ELF load_tracee() {
+  ELF elf;
+  elf.load(tracee_path);
+  elf.validate();
+  return elf;
+}
+
+static std::vector<std::string> tracee_args(int64_t threads, int64_t writes,
+                                            int64_t rate) {
+  return {tracee_path, std::to_string(threads), std::to_string(writes),
+          std::to_string(rate)};
+}
+
+// What gwatch does before the tracee runs: load the executable, spawn it,
+// resolve the variable and arm it
+static void BM_StartupToFirstWatch(benchmark::State &state) {
+  for (auto _ : state) {
+    ELF elf = load_tracee();
+    Process process(elf, tracee_args(1, 0, 0));
+    process.spawn();
+    PtraceBackend backend(process);
+    backend.arm(process.resolve_watch("bench_target"), true);
+    state.PauseTiming();
+    process.kill();
+    state.ResumeTiming();
+  }
+}
+BENCHMARK(BM_StartupToFirstWatch)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// One iteration is a hit: resume the tracee, let it write, handle its stop
+static void BM_StopResumeRoundTrip(benchmark::State &state) {
+  ELF elf = load_tracee();
+  Process process(elf, tracee_args(1, 0, 0));
+  process.spawn();
+  PtraceBackend backend(process);
+  backend.arm(process.resolve_watch("bench_target"), true);
+
+  WatchEvent event;
+  for (auto _ : state) {
+    if (!backend.next_event(event)) {
+      state.SkipWithError("Tracee exited");
+      break;
+    }
+  }
+  process.kill();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StopResumeRoundTrip)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// Wall time of a whole tracee run, from spawn to exit
+static uint64_t run_tracee(const ELF &elf, int64_t threads, int64_t writes,
+                           int64_t rate, bool watched) {
+  uint64_t start = monotonic_ns();
+  Process process(elf, tracee_args(threads, writes, rate));
+  process.spawn();
+  PtraceBackend backend(process);
+  if (watched) {
+    backend.arm(process.resolve_watch("bench_target"), true);
+  }
+  WatchEvent event;
+  while (backend.next_event(event)) {
+  }
+  return monotonic_ns() - start;
+}
+
+static void BM_TraceeSlowdown(benchmark::State &state, int64_t writes) {
+  int64_t rate = state.range(0);
+  int64_t threads = state.range(1);
+  ELF elf = load_tracee();
+  uint64_t baseline = run_tracee(elf, threads, writes, rate, false);
+
+  uint64_t watched = 0;
+  for (auto _ : state) {
+    uint64_t elapsed = run_tracee(elf, threads, writes, rate, true);
+    state.SetIterationTime(elapsed / 1e9);
+    watched += elapsed;
+  }
+  state.SetItemsProcessed(state.iterations() * threads * writes);
+  state.counters["slowdown"] =
+      double(watched) / state.iterations() / baseline;
+}
+
+void register_slowdown_benchmarks(const std::vector<int64_t> &rates,
+                                  const std::vector<int64_t> &threads,
+                                  int64_t writes) {
+  benchmark::RegisterBenchmark("BM_TraceeSlowdown", BM_TraceeSlowdown, writes)
+      ->ArgsProduct({rates, threads})
+      ->ArgNames({"rate", "threads"})
+      ->Unit(benchmark::kMillisecond)
+      ->UseManualTime();
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Tracee slowdown under a watch, for each write rate (per second and thread,
+// 0 unthrottled) and thread count. Registered at run time, so the sets can
+// be picked on the command line.
+void register_slowdown_benchmarks(const std::vector<int64_t> &rates,
+                                  const std::vector<int64_t> &threads,
+                                  int64_t writes);
@@ -0,0 +1,81 @@
+#include "synthetic_elf.h"
+#include "../elf.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+std::string synthetic_symbol_name(size_t index) {
+  return "synthetic_symbol_" + std::to_string(index);
+}
+
+template <typename T>
+static void append(std::vector<uint8_t> &out, const T &v) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+  out.insert(out.end(), p, p + sizeof(T));
+}
+
+std::string write_synthetic_elf(const std::string &directory, size_t symbols) {
+  std::string path =
+      directory + "/synthetic_" + std::to_string(symbols) + ".elf";
+  if (std::ifstream(path).good()) {
+    return path; // Reuse a file from an earlier run
+  }
+
+  std::vector<uint8_t> strtab(1, 0);
+  std::vector<uint8_t> symtab;
+  append(symtab, elf64_sym_t{});
+  for (size_t i = 0; i < symbols; ++i) {
+    std::string name = synthetic_symbol_name(i);
+    elf64_sym_t sym{};
+    sym.name = static_cast<uint32_t>(strtab.size());
+    sym.info = 0x11; // STB_GLOBAL, STT_OBJECT
+    sym.shndx = 1;
+    sym.value = 0x1000 + i * 8;
+    sym.size = 8;
+    append(symtab, sym);
+    strtab.insert(strtab.end(), name.begin(), name.end());
+    strtab.push_back(0);
+  }
+  const char shstrtab[] = "\0.symtab\0.strtab\0.shstrtab";
+
+  uint64_t symtab_offset = sizeof(elf64_header_t);
+  uint64_t strtab_offset = symtab_offset + symtab.size();
+  uint64_t shstrtab_offset = strtab_offset + strtab.size();
+  uint64_t shdr_offset = (shstrtab_offset + sizeof(shstrtab) + 7) & ~7ull;
+
+  elf64_header_t header{};
+  std::memcpy(header.magic, "\x7f" "ELF", 4);
+  header.size = static_cast<uint8_t>(ELFSize::ELF64);
+  header.endianness = static_cast<uint8_t>(ELFEndianness::Little);
+  header.version = 1;
+  header.type = static_cast<uint16_t>(ELFType::Executable);
+  header.machine = static_cast<uint16_t>(ELFInstructionSet::x86_64);
+  header.version2 = 1;
+  header.shoff = shdr_offset;
+  header.ehsize = sizeof(elf64_header_t);
+  header.shentsize = sizeof(elf64_shdr_t);
+  header.shnum = 4;
+  header.shstrndx = 3;
+
+  std::vector<uint8_t> out;
+  append(out, header);
+  out.insert(out.end(), symtab.begin(), symtab.end());
+  out.insert(out.end(), strtab.begin(), strtab.end());
+  out.insert(out.end(), shstrtab, shstrtab + sizeof(shstrtab));
+  out.resize(shdr_offset, 0);
+
+  append(out, elf64_shdr_t{});
+  append(out, elf64_shdr_t{1, 2, 0, 0, symtab_offset, symtab.size(), 2, 1, 8,
+                           sizeof(elf64_sym_t)}); // SHT_SYMTAB
+  append(out, elf64_shdr_t{9, 3, 0, 0, strtab_offset, strtab.size(), 0, 0, 1,
+                           0}); // SHT_STRTAB
+  append(out, elf64_shdr_t{17, 3, 0, 0, shstrtab_offset, sizeof(shstrtab), 0,
+                           0, 1, 0});
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.write(reinterpret_cast<const char *>(out.data()), out.size())) {
+    throw std::runtime_error("Failed to write synthetic ELF: " + path);
+  }
+  return path;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Name of the i-th symbol in a synthetic ELF
+std::string synthetic_symbol_name(size_t index);
+
+// Writes a minimal ELF64 file with `symbols` object symbols in .symtab,
+// named by synthetic_symbol_name, and returns its path.
+std::string write_synthetic_elf(const std::string &directory, size_t symbols);
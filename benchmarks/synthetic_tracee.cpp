@@ -0,0 +1,49 @@
+// Tracee of the overhead benchmarks. Every thread writes the watched global
+// `bench_target` a number of times at a given rate, with some unwatched work
+// in between.
+// Usage: synthetic_tracee [threads] [writes per thread, 0 forever]
+//                         [writes per second per thread, 0 unthrottled]
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+volatile uint64_t bench_target = 0;
+volatile uint64_t bench_scratch[64];
+
+static void write_target(uint64_t writes, uint64_t rate) {
+  uint64_t period_ns = rate ? 1000000000 / rate : 0;
+  timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (uint64_t i = 0; writes == 0 || i < writes; ++i) {
+    for (int j = 0; j < 64; ++j) {
+      bench_scratch[j] = bench_scratch[j] + i;
+    }
+    bench_target = i;
+    if (period_ns) {
+      // Absolute deadlines, so the rate doesn't drift with the slowdown
+      next.tv_nsec += period_ns;
+      while (next.tv_nsec >= 1000000000) {
+        next.tv_nsec -= 1000000000;
+        ++next.tv_sec;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+  uint64_t writes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+  uint64_t rate = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 0;
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; ++i) {
+    workers.emplace_back(write_target, writes, rate);
+  }
+  write_target(writes, rate);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
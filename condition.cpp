@@ -0,0 +1,356 @@
+#include "condition.h"
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+// Recursive descent over the C precedence levels, emitting code as it goes
+class Parser {
+  const std::string &text;
+  size_t position;
+  std::vector<Condition::Instruction> &code;
+  size_t depth;
+  size_t max_depth;
+
+  using Op = Condition::Op;
+
+  [[noreturn]] void fail(const std::string &message) const {
+    throw std::invalid_argument("Condition '" + text + "': " + message +
+                                " at offset " + std::to_string(position));
+  }
+
+  void skip_space() {
+    while (position < text.size() && isspace(text[position])) {
+      ++position;
+    }
+  }
+
+  // Consumes `token` if it comes next. A token that is a prefix of a longer
+  // operator (e.g. '<' of '<=' or '&' of '&&') is not matched.
+  bool accept(const char *token) {
+    skip_space();
+    size_t length = std::char_traits<char>::length(token);
+    if (text.compare(position, length, token) != 0) {
+      return false;
+    }
+    if (length == 1 && position + 1 < text.size()) {
+      char next = text[position + 1];
+      char first = token[0];
+      if ((first == '<' || first == '>') && (next == '=' || next == first)) {
+        return false;
+      }
+      if ((first == '&' || first == '|') && next == first) {
+        return false;
+      }
+      if ((first == '!' || first == '=') && next == '=') {
+        return false;
+      }
+    }
+    position += length;
+    return true;
+  }
+
+  void emit(Op op, int64_t operand = 0) {
+    code.push_back({op, operand});
+    // Stack effect: operands push one, unary ops keep the depth, binary ops
+    // and conditional jumps (when they fall through) pop one
+    switch (op) {
+    case Op::Push:
+    case Op::Value:
+    case Op::Old:
+    case Op::Ip:
+    case Op::Tid:
+    case Op::Write:
+      if (++depth > max_depth) {
+        max_depth = depth;
+      }
+      break;
+    case Op::Negate:
+    case Op::Not:
+    case Op::Complement:
+    case Op::Bool:
+      break;
+    default:
+      --depth;
+      break;
+    }
+  }
+
+  void primary() {
+    skip_space();
+    if (accept("(")) {
+      expression();
+      if (!accept(")")) {
+        fail("expected ')'");
+      }
+      return;
+    }
+    if (position < text.size() && isdigit(text[position])) {
+      size_t used = 0;
+      int64_t number;
+      try {
+        number = std::stoull(text.substr(position), &used, 0);
+      } catch (const std::exception &) {
+        fail("invalid number");
+      }
+      position += used;
+      emit(Op::Push, number);
+      return;
+    }
+    size_t start = position;
+    while (position < text.size() &&
+           (isalnum(text[position]) || text[position] == '_')) {
+      ++position;
+    }
+    std::string name = text.substr(start, position - start);
+    if (name == "value") {
+      emit(Op::Value);
+    } else if (name == "old") {
+      emit(Op::Old);
+    } else if (name == "ip") {
+      emit(Op::Ip);
+    } else if (name == "tid") {
+      emit(Op::Tid);
+    } else if (name == "write") {
+      emit(Op::Write);
+    } else if (name == "read") {
+      emit(Op::Write);
+      emit(Op::Not);
+    } else {
+      position = start;
+      fail(name.empty() ? "expected an operand" : "unknown name '" + name +
+                                                      "'");
+    }
+  }
+
+  void unary() {
+    if (accept("-")) {
+      unary();
+      emit(Op::Negate);
+    } else if (accept("!")) {
+      unary();
+      emit(Op::Not);
+    } else if (accept("~")) {
+      unary();
+      emit(Op::Complement);
+    } else if (accept("+")) {
+      unary();
+    } else {
+      primary();
+    }
+  }
+
+  // One level of left-associative binary operators
+  template <typename Next>
+  void binary(Next next, std::initializer_list<std::pair<const char *, Op>>
+                             operators) {
+    next();
+    while (true) {
+      bool matched = false;
+      for (const auto &[token, op] : operators) {
+        if (accept(token)) {
+          next();
+          emit(op);
+          matched = true;
+          break;
+        }
+      }
+      if (!matched) {
+        return;
+      }
+    }
+  }
+
+  void multiplicative() {
+    binary([this] { unary(); }, {{"*", Op::Multiply},
+                                 {"/", Op::Divide},
+                                 {"%", Op::Remainder}});
+  }
+  void additive() {
+    binary([this] { multiplicative(); },
+           {{"+", Op::Add}, {"-", Op::Subtract}});
+  }
+  void shift() {
+    binary([this] { additive(); },
+           {{"<<", Op::ShiftLeft}, {">>", Op::ShiftRight}});
+  }
+  void relational() {
+    binary([this] { shift(); }, {{"<=", Op::LessEqual},
+                                 {">=", Op::GreaterEqual},
+                                 {"<", Op::Less},
+                                 {">", Op::Greater}});
+  }
+  void equality() {
+    binary([this] { relational(); },
+           {{"==", Op::Equal}, {"!=", Op::NotEqual}});
+  }
+  void bit_and() {
+    binary([this] { equality(); }, {{"&", Op::BitAnd}});
+  }
+  void bit_xor() {
+    binary([this] { bit_and(); }, {{"^", Op::BitXor}});
+  }
+  void bit_or() {
+    binary([this] { bit_xor(); }, {{"|", Op::BitOr}});
+  }
+
+  // a && b: if a is zero the result is 0 without evaluating b
+  template <typename Next>
+  void logical(Next next, const char *token, Op jump) {
+    next();
+    while (accept(token)) {
+      size_t jump_at = code.size();
+      emit(jump);
+      next();
+      emit(Op::Bool);
+      code[jump_at].operand = code.size();
+    }
+  }
+
+  void logical_and() {
+    logical([this] { bit_or(); }, "&&", Op::JumpIfZero);
+  }
+  void expression() {
+    logical([this] { logical_and(); }, "||", Op::JumpIfNonZero);
+  }
+
+public:
+  Parser(const std::string &text, std::vector<Condition::Instruction> &code)
+      : text(text), position(0), code(code), depth(0), max_depth(0) {}
+
+  void parse() {
+    expression();
+    skip_space();
+    if (position != text.size()) {
+      fail("unexpected '" + text.substr(position, 1) + "'");
+    }
+    if (max_depth > Condition::max_stack) {
+      fail("expression too deep");
+    }
+  }
+};
+
+} // namespace
+
+Condition::Condition() : code() {}
+
+Condition::Condition(const std::string &expression) : code() {
+  Parser(expression, code).parse();
+}
+
+bool Condition::always_true() const { return code.empty(); }
+
+bool Condition::evaluate(const ConditionInput &input) const {
+  if (code.empty()) {
+    return true;
+  }
+  // Unsigned arithmetic wraps instead of overflowing
+  uint64_t stack[max_stack];
+  size_t top = 0; // Number of entries
+  const size_t size = code.size();
+  for (size_t pc = 0; pc < size; ++pc) {
+    const Instruction &instruction = code[pc];
+    uint64_t b = top > 0 ? stack[top - 1] : 0;
+    switch (instruction.op) {
+    case Op::Push:
+      stack[top++] = instruction.operand;
+      break;
+    case Op::Value:
+      stack[top++] = input.value;
+      break;
+    case Op::Old:
+      stack[top++] = input.old;
+      break;
+    case Op::Ip:
+      stack[top++] = input.ip;
+      break;
+    case Op::Tid:
+      stack[top++] = input.tid;
+      break;
+    case Op::Write:
+      stack[top++] = input.write;
+      break;
+    case Op::Negate:
+      stack[top - 1] = -b;
+      break;
+    case Op::Not:
+      stack[top - 1] = !b;
+      break;
+    case Op::Complement:
+      stack[top - 1] = ~b;
+      break;
+    case Op::Bool:
+      stack[top - 1] = b != 0;
+      break;
+    case Op::JumpIfZero:
+    case Op::JumpIfNonZero:
+      if ((b != 0) == (instruction.op == Op::JumpIfNonZero)) {
+        stack[top - 1] = b != 0;
+        pc = instruction.operand - 1;
+      } else {
+        --top;
+      }
+      break;
+    default: {
+      uint64_t *a = &stack[top - 2];
+      int64_t x = static_cast<int64_t>(*a);
+      int64_t y = static_cast<int64_t>(b);
+      switch (instruction.op) {
+      case Op::Multiply:
+        *a *= b;
+        break;
+      case Op::Divide:
+        *a = y == 0 || (y == -1 && x == INT64_MIN) ? 0 : x / y;
+        break;
+      case Op::Remainder:
+        *a = y == 0 || y == -1 ? 0 : x % y;
+        break;
+      case Op::Add:
+        *a += b;
+        break;
+      case Op::Subtract:
+        *a -= b;
+        break;
+      case Op::ShiftLeft:
+        *a <<= (b & 63);
+        break;
+      case Op::ShiftRight:
+        *a = x >> (b & 63);
+        break;
+      case Op::Less:
+        *a = x < y;
+        break;
+      case Op::LessEqual:
+        *a = x <= y;
+        break;
+      case Op::Greater:
+        *a = x > y;
+        break;
+      case Op::GreaterEqual:
+        *a = x >= y;
+        break;
+      case Op::Equal:
+        *a = x == y;
+        break;
+      case Op::NotEqual:
+        *a = x != y;
+        break;
+      case Op::BitAnd:
+        *a &= b;
+        break;
+      case Op::BitXor:
+        *a ^= b;
+        break;
+      case Op::BitOr:
+        *a |= b;
+        break;
+      default:
+        break;
+      }
+      --top;
+      break;
+    }
+    }
+  }
+  return stack[0] != 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What a condition can look at for one hit
+struct ConditionInput {
+  int64_t value; // Value after the hit
+  int64_t old;   // Value before it, equal to value for reads
+  uint64_t ip;
+  int64_t tid;
+  bool write; // As the trace labels the hit, stores of the same value too
+};
+
+// Filter expression such as "value > 1000", "value - old >= 64" or
+// "value & 0x1", with C operators and precedence over 64-bit signed
+// integers. Parsed once into postfix bytecode, evaluating it only touches a
+// fixed-size stack, never the heap. Division by zero yields 0.
+class Condition {
+public:
+  enum class Op : uint8_t {
+    Push, Value, Old, Ip, Tid, Write,
+    Negate, Not, Complement,
+    Multiply, Divide, Remainder, Add, Subtract, ShiftLeft, ShiftRight,
+    Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+    BitAnd, BitXor, BitOr,
+    // Short circuit: jump to `operand` if the top is zero/nonzero, keeping
+    // it as 0/1, otherwise pop it
+    JumpIfZero, JumpIfNonZero, Bool,
+  };
+  struct Instruction {
+    Op op;
+    int64_t operand;
+  };
+  static constexpr size_t max_stack = 32;
+
+private:
+  std::vector<Instruction> code;
+
+public:
+  // Always true
+  Condition();
+  // Throws std::invalid_argument on syntax errors
+  explicit Condition(const std::string &expression);
+
+  bool always_true() const;
+  bool evaluate(const ConditionInput &input) const;
+};
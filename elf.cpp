@@ -1,122 +1,364 @@
 #include "elf.h"
-#include <fstream>
+#include "symbol_cache.h"
+#include "symbol_index.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 
-ELF::ELF() : data(), path_("") {}
+static std::string symbol_cache_directory;
+static const uint8_t elf_magic[4] = {0x7F, 'E', 'L', 'F'};
+
+struct ELF::Lookup {
+  bool parsed = false; // Not an ELF we can read, validate tells why
+  ELFSize size = ELFSize::ELF64;
+  elf64_header_t header = {};
+  std::vector<elf64_phdr_t> program_headers;
+  std::vector<elf64_shdr_t> section_headers;
+  // build_symbol_index of the file's class
+  void (ELF::*build_symbols)() const = nullptr;
+  std::once_flag sections_built;
+  std::unordered_map<std::string_view, const elf64_shdr_t *> sections;
+  std::once_flag symbols_built;
+  SymbolIndex symbols;
+};
+
+static elf64_header_t widen(const elf64_header_t &header) { return header; }
+static elf64_phdr_t widen(const elf64_phdr_t &header) { return header; }
+static elf64_shdr_t widen(const elf64_shdr_t &header) { return header; }
+
+static elf64_header_t widen(const elf32_header_t &header) {
+  elf64_header_t wide = {};
+  std::memcpy(wide.magic, header.magic, sizeof(wide.magic));
+  wide.size = header.size;
+  wide.endianness = header.endianness;
+  wide.version = header.version;
+  wide.os_abi = header.os_abi;
+  wide.type = header.type;
+  wide.machine = header.machine;
+  wide.version2 = header.version2;
+  wide.entry = header.entry;
+  wide.phoff = header.phoff;
+  wide.shoff = header.shoff;
+  wide.flags = header.flags;
+  wide.ehsize = header.ehsize;
+  wide.phentsize = header.phentsize;
+  wide.phnum = header.phnum;
+  wide.shentsize = header.shentsize;
+  wide.shnum = header.shnum;
+  wide.shstrndx = header.shstrndx;
+  return wide;
+}
+
+static elf64_phdr_t widen(const elf32_phdr_t &header) {
+  return elf64_phdr_t{header.type,  header.flags,  header.offset,
+                      header.vaddr, header.paddr,  header.filesz,
+                      header.memsz, header.align};
+}
+
+static elf64_shdr_t widen(const elf32_shdr_t &header) {
+  return elf64_shdr_t{header.name,   header.type, header.flags,
+                      header.addr,   header.offset, header.size,
+                      header.link,   header.info, header.addralign,
+                      header.entsize};
+}
+
+ELF::ELF() : file(), lookup(), path_("") {}
 
 void ELF::load(const std::string &path) {
   path_ = path;
 
-  std::ifstream file(path, std::ios::binary | std::ios::ate);
-  if (!file) {
-    throw std::runtime_error("Failed to open ELF file: " + path);
+  auto mapped = std::make_shared<const MappedFile>(path);
+  if (mapped->size() < sizeof(elf32_header_t)) {
+    throw std::runtime_error("File too small to be a valid ELF: " + path);
   }
+  file = std::move(mapped);
+  lookup = std::make_shared<Lookup>();
 
-  std::streamsize size = file.tellg();
-  if (size < sizeof(elf64_header_t)) {
-    throw std::runtime_error("File too small to be a valid ELF: " + path);
+  // The class decides the layout of everything else, so it is looked at
+  // once here and never again
+  const elf32_header_t *ident = view_as<elf32_header_t>(0);
+  if (std::memcmp(ident->magic, elf_magic, sizeof(elf_magic)) != 0 ||
+      ident->endianness != static_cast<uint8_t>(ELFEndianness::Little)) {
+    return;
   }
+  if (ident->size == static_cast<uint8_t>(ELFSize::ELF64)) {
+    parse<ELFClass64>();
+  } else if (ident->size == static_cast<uint8_t>(ELFSize::ELF32)) {
+    parse<ELFClass32>();
+  }
+}
 
-  file.seekg(0, std::ios::beg);
-  data.resize(size);
-  if (!file.read(reinterpret_cast<char *>(data.data()), size)) {
-    throw std::runtime_error("Failed to read ELF file: " + path);
+template <typename Class> void ELF::parse() {
+  const typename Class::Header *header =
+      view_as<typename Class::Header>(0);
+  Lookup &parsed = *lookup;
+  parsed.size = Class::size;
+  parsed.header = widen(*header);
+  parsed.program_headers.reserve(header->phnum);
+  for (size_t i = 0; i < header->phnum; ++i) {
+    parsed.program_headers.push_back(
+        widen(*view_as<typename Class::ProgramHeader>(
+            header->phoff + i * header->phentsize)));
+  }
+  parsed.section_headers.reserve(header->shnum);
+  for (size_t i = 0; i < header->shnum; ++i) {
+    parsed.section_headers.push_back(
+        widen(*view_as<typename Class::SectionHeader>(
+            header->shoff + i * header->shentsize)));
   }
+  parsed.build_symbols = &ELF::build_symbol_index<Class>;
+  parsed.parsed = true;
 }
 
 void ELF::validate() const {
-  const elf64_header_t *header =
-      reinterpret_cast<const elf64_header_t *>(data.data());
+  // Identification and machine are at the same offsets in both classes
+  const elf32_header_t *ident = view_as<elf32_header_t>(0);
 
   // Check magic number
-  if (header->magic[0] != 0x7F || header->magic[1] != 'E' ||
-      header->magic[2] != 'L' || header->magic[3] != 'F') {
+  if (std::memcmp(ident->magic, elf_magic, sizeof(elf_magic)) != 0) {
     throw std::runtime_error("Invalid ELF magic number");
   }
 
-  if (header->size != static_cast<uint8_t>(ELFSize::ELF64)) {
-    throw std::runtime_error("Unsupported ELF size (only 64-bit supported)");
+  if (ident->size != static_cast<uint8_t>(ELFSize::ELF64) &&
+      ident->size != static_cast<uint8_t>(ELFSize::ELF32)) {
+    throw std::runtime_error("Unsupported ELF size");
   }
-  if (header->endianness != static_cast<uint8_t>(ELFEndianness::Little)) {
+  if (ident->endianness != static_cast<uint8_t>(ELFEndianness::Little)) {
     throw std::runtime_error(
         "Unsupported ELF endianness (only little-endian supported)");
   }
+  if (ident->size == static_cast<uint8_t>(ELFSize::ELF32) &&
+      ident->machine != static_cast<uint16_t>(ELFInstructionSet::x86)) {
+    throw std::runtime_error("Unsupported 32-bit ELF (only x86 supported)");
+  }
+}
+
+ELFSize ELF::getSize() const {
+  get_header(); // Throws if nothing usable is loaded
+  return lookup->size;
+}
+
+const uint8_t *ELF::data() const {
+  if (!file) {
+    throw std::runtime_error("ELF file not loaded");
+  }
+  return file->data();
+}
+
+const uint8_t *ELF::view(uint64_t offset, uint64_t size) const {
+  const uint8_t *base = data();
+  if (offset > file->size() || size > file->size() - offset) {
+    throw std::out_of_range("ELF data out of file bounds: " + path_);
+  }
+  return base + offset;
+}
+
+template <typename T> const T *ELF::view_as(uint64_t offset) const {
+  return reinterpret_cast<const T *>(view(offset, sizeof(T)));
 }
 
-elf64_header_t *ELF::get_header() {
-  return reinterpret_cast<elf64_header_t *>(data.data());
+const elf64_header_t *ELF::get_header() const {
+  data(); // Throws if nothing is loaded
+  if (!lookup->parsed) {
+    throw std::runtime_error("Unsupported ELF file: " + path_);
+  }
+  return &lookup->header;
 }
 
-elf64_phdr_t *ELF::get_program_header(size_t index) {
-  elf64_header_t *header = get_header();
-  if (index >= header->phnum) {
+const elf64_phdr_t *ELF::get_program_header(size_t index) const {
+  if (index >= get_header()->phnum) {
     throw std::out_of_range("Program header index out of range");
   }
-  return reinterpret_cast<elf64_phdr_t *>(data.data() + header->phoff +
-                                          index * header->phentsize);
+  return &lookup->program_headers[index];
 }
 
-elf64_shdr_t *ELF::get_section_header(size_t index) {
-  elf64_header_t *header = get_header();
-  if (index >= header->shnum) {
+const elf64_shdr_t *ELF::get_section_header(size_t index) const {
+  if (index >= get_header()->shnum) {
     throw std::out_of_range("Section header index out of range");
   }
-  return reinterpret_cast<elf64_shdr_t *>(data.data() + header->shoff +
-                                          index * header->shentsize);
+  return &lookup->section_headers[index];
 }
 
-elf64_shdr_t *ELF::get_section_header(const std::string &name) {
-  elf64_header_t *header = get_header();
-  elf64_shdr_t *shstrtab_header = get_section_header(header->shstrndx);
-  const char *shstrtab =
-      reinterpret_cast<const char *>(data.data() + shstrtab_header->offset);
-
-  for (size_t i = 0; i < header->shnum; ++i) {
-    elf64_shdr_t *section_header = get_section_header(i);
-    const char *section_name = shstrtab + section_header->name;
-    if (name == section_name) {
-      return section_header;
+const elf64_shdr_t *
+ELF::find_section_header(const std::string &name) const {
+  const elf64_header_t *header = get_header();
+  std::call_once(lookup->sections_built, [&] {
+    if (header->shnum == 0) {
+      return;
+    }
+    const elf64_shdr_t *shstrtab_header =
+        get_section_header(header->shstrndx);
+    const char *shstrtab = reinterpret_cast<const char *>(
+        view(shstrtab_header->offset, shstrtab_header->size));
+    for (size_t i = 0; i < header->shnum; ++i) {
+      const elf64_shdr_t *section_header = get_section_header(i);
+      if (section_header->name >= shstrtab_header->size) {
+        continue;
+      }
+      std::string_view section_name(shstrtab + section_header->name,
+                                    strnlen(shstrtab + section_header->name,
+                                            shstrtab_header->size -
+                                                section_header->name));
+      // Keep the first section of a given name, as the linear scan did
+      lookup->sections.emplace(section_name, section_header);
     }
+  });
+
+  auto it = lookup->sections.find(name);
+  return it == lookup->sections.end() ? nullptr : it->second;
+}
+
+const elf64_shdr_t *ELF::get_section_header(const std::string &name) const {
+  const elf64_shdr_t *section_header = find_section_header(name);
+  if (!section_header) {
+    throw std::runtime_error("Section not found: " + name);
+  }
+  return section_header;
+}
+
+template <typename Class>
+SymbolTable ELF::get_symbol_table(const elf64_shdr_t *symtab_header) const {
+  using Symbol = typename Class::Symbol;
+  if (symtab_header->entsize < sizeof(Symbol)) {
+    throw std::runtime_error("Invalid symbol table entry size");
   }
-  throw std::runtime_error("Section not found: " + name);
+  const elf64_shdr_t *strtab_header = get_section_header(symtab_header->link);
+  return SymbolTable{
+      view(symtab_header->offset, symtab_header->size),
+      symtab_header->entsize,
+      symtab_header->size / symtab_header->entsize,
+      reinterpret_cast<const char *>(
+          view(strtab_header->offset, strtab_header->size)),
+      strtab_header->size,
+      Class::size, // The index widens 32-bit entries as they are looked up
+  };
 }
 
-elf64_sym_t *ELF::get_symbol_from_table(elf64_shdr_t *symtab_header,
-                                        elf64_shdr_t *strtab_header,
-                                        const std::string &name) {
-  const char *strtab =
-      reinterpret_cast<const char *>(data.data() + strtab_header->offset);
-  size_t num_symbols = symtab_header->size / symtab_header->entsize;
+template <typename Class> void ELF::build_symbol_index() const {
+  const elf64_shdr_t *symtab = find_section_header(".symtab");
+  const elf64_shdr_t *dynsym = find_section_header(".dynsym");
 
-  for (size_t i = 0; i < num_symbols; ++i) {
-    elf64_sym_t *symbol = reinterpret_cast<elf64_sym_t *>(
-        data.data() + symtab_header->offset + i * symtab_header->entsize);
-    const char *symbol_name = strtab + symbol->name;
-    if (name == symbol_name) {
-      return symbol;
+  // Stripped binary: the dynamic linker's own hash table is all we need
+  if (!symtab && dynsym) {
+    SymbolTable dynamic = get_symbol_table<Class>(dynsym);
+    if (const elf64_shdr_t *hash = find_section_header(".gnu.hash")) {
+      lookup->symbols.use_gnu_hash<Class>(
+          dynamic, view(hash->offset, hash->size), hash->size);
+      return;
     }
+    if (const elf64_shdr_t *hash = find_section_header(".hash")) {
+      lookup->symbols.use_sysv_hash(dynamic, view(hash->offset, hash->size),
+                                    hash->size);
+      return;
+    }
+  }
+
+  std::vector<SymbolTable> tables;
+  if (symtab) {
+    tables.push_back(get_symbol_table<Class>(symtab));
+  }
+  if (dynsym) {
+    tables.push_back(get_symbol_table<Class>(dynsym));
   }
-  return nullptr;
+  if (!load_cached_index(tables)) {
+    lookup->symbols.build(tables);
+  }
+}
+
+const SymbolIndex &ELF::get_symbol_index() const {
+  get_header(); // Throws if nothing usable is loaded
+  std::call_once(lookup->symbols_built,
+                 [&] { (this->*lookup->build_symbols)(); });
+  return lookup->symbols;
 }
 
-elf64_sym_t *ELF::get_symbol(const std::string &name) {
-  // Try first in .symtab
-  elf64_shdr_t *symtab_header = get_section_header(".symtab");
-  elf64_shdr_t *strtab_header = get_section_header(".strtab");
-  elf64_sym_t *symbol =
-      get_symbol_from_table(symtab_header, strtab_header, name);
-  if (symbol) {
-    return symbol;
+bool ELF::load_cached_index(const std::vector<SymbolTable> &tables) const {
+  if (symbol_cache_directory.empty() || tables.empty()) {
+    return false;
+  }
+  std::string cache_path;
+  try {
+    cache_path = symbol_cache_directory + "/" +
+                 SymbolCache::cache_file_name(get_build_id(), path_);
+  } catch (const std::exception &) {
+    return false;
+  }
+
+  std::shared_ptr<const SymbolCache> cache = SymbolCache::open(cache_path);
+  if (!cache) {
+    // Missing or unusable, a cache is never worth failing the lookup over
+    try {
+      SymbolCache::write(cache_path, tables);
+    } catch (const std::exception &) {
+      return false;
+    }
+    cache = SymbolCache::open(cache_path);
+    if (!cache) {
+      return false;
+    }
   }
-  // Then try in .dynsym
-  symtab_header = get_section_header(".dynsym");
-  strtab_header = get_section_header(".dynstr");
-  symbol = get_symbol_from_table(symtab_header, strtab_header, name);
-  return symbol;
+  lookup->symbols.use_cache(std::move(cache));
+  return true;
+}
+
+const elf64_sym_t *ELF::get_symbol(const std::string &name) const {
+  return get_symbol_index().find(name);
 }
 
+void ELF::index_symbols() const { get_symbol_index(); }
+
 const std::string &ELF::get_path() const { return path_; }
 
-bool ELF::is_pie() {
-  elf64_header_t *header = get_header();
+bool ELF::is_pie() const {
+  const elf64_header_t *header = get_header();
   return header->type == 3; // ET_DYN
 }
+
+uint64_t ELF::get_entry() const { return get_header()->entry; }
+
+std::string ELF::get_build_id() const {
+  const elf64_header_t *header = get_header();
+  for (size_t i = 0; i < header->shnum; ++i) {
+    const elf64_shdr_t *section_header = get_section_header(i);
+    if (section_header->type != 7) { // SHT_NOTE
+      continue;
+    }
+    const uint8_t *notes = view(section_header->offset, section_header->size);
+    uint64_t offset = 0;
+    while (section_header->size - offset >= 12) {
+      uint32_t name_size, desc_size, type;
+      std::memcpy(&name_size, notes + offset, 4);
+      std::memcpy(&desc_size, notes + offset + 4, 4);
+      std::memcpy(&type, notes + offset + 8, 4);
+      uint64_t name_offset = offset + 12;
+      uint64_t desc_offset = name_offset + ((name_size + 3ull) & ~3ull);
+      uint64_t next = desc_offset + ((desc_size + 3ull) & ~3ull);
+      if (next > section_header->size) {
+        break;
+      }
+      if (type == 3 && name_size == 4 && // NT_GNU_BUILD_ID
+          std::memcmp(notes + name_offset, "GNU", 4) == 0) {
+        std::string build_id;
+        for (uint32_t j = 0; j < desc_size; ++j) {
+          char digits[3];
+          snprintf(digits, sizeof(digits), "%02x", notes[desc_offset + j]);
+          build_id += digits;
+        }
+        return build_id;
+      }
+      offset = next;
+    }
+  }
+  return "";
+}
+
+void ELF::set_symbol_cache_directory(const std::string &directory) {
+  symbol_cache_directory = directory;
+}
+
+const std::string &ELF::get_symbol_cache_directory() {
+  return symbol_cache_directory;
+}
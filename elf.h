@@ -1,5 +1,7 @@
 #pragma once
+#include "mapped_file.h"
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -23,6 +25,62 @@ enum class ELFInstructionSet : uint16_t {
   AArch64 = 183,
 };
 
+struct elf32_header_t {
+  uint8_t magic[4];
+  uint8_t size;
+  uint8_t endianness;
+  uint8_t version;
+  uint8_t os_abi;
+  uint8_t padding[8];
+  uint16_t type;
+  uint16_t machine;
+  uint32_t version2;
+  uint32_t entry;
+  uint32_t phoff;
+  uint32_t shoff;
+  uint32_t flags;
+  uint16_t ehsize;
+  uint16_t phentsize;
+  uint16_t phnum;
+  uint16_t shentsize;
+  uint16_t shnum;
+  uint16_t shstrndx;
+};
+
+struct elf32_phdr_t {
+  uint32_t type;
+  uint32_t offset;
+  uint32_t vaddr;
+  uint32_t paddr;
+  uint32_t filesz;
+  uint32_t memsz;
+  uint32_t flags;
+  uint32_t align;
+};
+
+struct elf32_shdr_t {
+  uint32_t name;
+  uint32_t type;
+  uint32_t flags;
+  uint32_t addr;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t link;
+  uint32_t info;
+  uint32_t addralign;
+  uint32_t entsize;
+};
+
+// Fields in a different order than elf64_sym_t
+struct elf32_sym_t {
+  uint32_t name;
+  uint32_t value;
+  uint32_t size;
+  uint8_t info;
+  uint8_t other;
+  uint16_t shndx;
+};
+
 struct elf64_header_t {
   uint8_t magic[4];
   uint8_t size;       // 1 - 32bit, 2 - 64bit
@@ -80,23 +138,74 @@ struct elf64_sym_t {
   uint64_t size;
 };
 
+// Layouts of one ELF class. The parser is instantiated for each of them and
+// hands the rest of the code 64-bit records, which hold either.
+struct ELFClass32 {
+  using Header = elf32_header_t;
+  using ProgramHeader = elf32_phdr_t;
+  using SectionHeader = elf32_shdr_t;
+  using Symbol = elf32_sym_t;
+  using Word = uint32_t; // Address sized, e.g. auxv and .gnu.hash bloom words
+  static constexpr ELFSize size = ELFSize::ELF32;
+};
+
+struct ELFClass64 {
+  using Header = elf64_header_t;
+  using ProgramHeader = elf64_phdr_t;
+  using SectionHeader = elf64_shdr_t;
+  using Symbol = elf64_sym_t;
+  using Word = uint64_t;
+  static constexpr ELFSize size = ELFSize::ELF64;
+};
+
+class SymbolIndex;
+struct SymbolTable;
+
 class ELF {
-  std::vector<uint8_t> data;
+  struct Lookup;
+  // Shared between copies, so handing an ELF to a Process is cheap
+  std::shared_ptr<const MappedFile> file;
+  // Name indexes, built on first use and shared between copies too
+  std::shared_ptr<Lookup> lookup;
   std::string path_;
-  elf64_header_t *get_header();
-  elf64_phdr_t *get_program_header(size_t index);
-  elf64_shdr_t *get_section_header(size_t index);
-  elf64_shdr_t *get_section_header(const std::string &name);
-  elf64_sym_t *get_symbol_from_table(elf64_shdr_t *symtab_header,
-                                     elf64_shdr_t *strtab_header,
-                                     const std::string &name);
+  const uint8_t *data() const;
+  // Returns pointer to `size` bytes at `offset`, throws if outside the file
+  const uint8_t *view(uint64_t offset, uint64_t size) const;
+  template <typename T> const T *view_as(uint64_t offset) const;
+  // Reads the headers with the layouts of one class, load picks the class
+  template <typename Class> void parse();
+  // Headers below are the widened copies parse made
+  const elf64_header_t *get_header() const;
+  const elf64_phdr_t *get_program_header(size_t index) const;
+  const elf64_shdr_t *get_section_header(size_t index) const;
+  const elf64_shdr_t *get_section_header(const std::string &name) const;
+  template <typename Class>
+  SymbolTable get_symbol_table(const elf64_shdr_t *symtab_header) const;
+  template <typename Class> void build_symbol_index() const;
+  const SymbolIndex &get_symbol_index() const;
+  // Index from the on-disk cache, writing the cache first if needed
+  bool load_cached_index(const std::vector<SymbolTable> &tables) const;
 
 public:
   ELF();
   void load(const std::string &path);
   void validate() const;
+  // Class of the file, 32-bit files are x86 only
   ELFSize getSize() const;
-  elf64_sym_t *get_symbol(const std::string &name);
+  // Searches .symtab first, then .dynsym
+  const elf64_sym_t *get_symbol(const std::string &name) const;
+  // Builds the name index now rather than on the first lookup, e.g. on a
+  // worker thread. Copies share it.
+  void index_symbols() const;
+  // Like get_section_header, but returns nullptr for a missing section
+  const elf64_shdr_t *find_section_header(const std::string &name) const;
   const std::string &get_path() const;
-  bool is_pie();
+  bool is_pie() const;
+  uint64_t get_entry() const;
+  // Hex NT_GNU_BUILD_ID, empty if the binary has none
+  std::string get_build_id() const;
+
+  // Directory for persistent symbol indexes, empty disables them (default)
+  static void set_symbol_cache_directory(const std::string &directory);
+  static const std::string &get_symbol_cache_directory();
 };
@@ -1,17 +1,349 @@
+#include "condition.h"
 #include "elf.h"
+#include "instruction_decoder.h"
+#include "overhead.h"
+#include "page_backend.h"
+#include "perf_backend.h"
 #include "process.h"
+#include "ptrace_backend.h"
+#include "session.h"
+#include "snapshot_poller.h"
+#include "summary.h"
+#include "symbol_cache.h"
+#include "trace_writer.h"
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <memory>
 
 #include <iostream>
 #include <string>
 #include <vector>
 
+static volatile sig_atomic_t interrupted = 0;
+
+static volatile sig_atomic_t report_requested = 0;
+
+static volatile sig_atomic_t overhead_requested = 0;
+
+static void handle_interrupt(int) { interrupted = 1; }
+
+static void handle_report_request(int) { report_requested = 1; }
+
+static void handle_overhead_request(int) { overhead_requested = 1; }
+
+// Installed once the tracees are ours, until then a signal just ends us
+static void install_handlers() {
+  // Without SA_RESTART, so that a blocking wait returns and we can detach
+  struct sigaction action = {};
+  action.sa_handler = handle_interrupt;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  action.sa_handler = handle_report_request;
+  sigaction(SIGUSR1, &action, nullptr);
+  action.sa_handler = handle_overhead_request;
+  sigaction(SIGUSR2, &action, nullptr);
+}
+
 struct Options {
-  std::string var;
+  std::vector<std::string> vars;
+  // Filter of each var, empty for none
+  std::vector<std::string> conditions;
+  std::string backend = "ptrace";
   std::string exec_path;
   std::vector<std::string> exec_args;
+  // Several for a pool of processes, watched by one session
+  std::vector<pid_t> attach_pids;
+  bool symbol_cache = true;
+  std::string output = "-";
+  TraceFormat format = TraceFormat::Text;
+  WatchBudget budget;
+  bool summary = false;
+  // Poll instead of watching when non-zero
+  uint64_t poll_interval_ns = 0;
+  uint8_t poll_width = 8;
+  bool consistent = false;
+  // Where --overhead writes its JSON, "-" for stderr, empty if not asked for
+  std::string overhead_output;
 };
 
+// Rewritten on every SIGUSR2 and once more at exit
+static void write_overhead(const Options &options) {
+  if (options.overhead_output.empty()) {
+    return;
+  }
+  if (options.overhead_output == "-") {
+    overhead.write_json(std::cerr);
+    return;
+  }
+  std::ofstream file(options.overhead_output, std::ios::trunc);
+  overhead.write_json(file);
+  if (!file) {
+    std::cerr << "Warning: failed to write " << options.overhead_output
+              << std::endl;
+  }
+}
+
+// Watches regions of any size by comparing snapshots, see SnapshotPoller
+static void poll_regions(Process &process, const Options &options) {
+  SnapshotPoller poller(process, options.poll_interval_ns, options.poll_width,
+                        options.consistent);
+  for (const std::string &name : options.vars) {
+    ResolvedSymbol region = process.resolve_region(name);
+    poller.add(region.address, region.size);
+  }
+  std::ofstream file;
+  if (options.output != "-") {
+    file.open(options.output);
+    if (!file) {
+      throw std::runtime_error("Failed to open trace output: " +
+                               options.output);
+    }
+  }
+  std::ostream &out = options.output == "-" ? std::cout : file;
+  std::vector<RegionChange> changes;
+  std::string buffer;
+  while (!interrupted) {
+    changes.clear();
+    bool polled = poller.poll(changes);
+    // Same lines as text traces, formatted after the tracee was resumed
+    buffer.clear();
+    for (const RegionChange &change : changes) {
+      buffer += options.vars[change.region];
+      if (change.offset) {
+        buffer += '+';
+        buffer += std::to_string(change.offset);
+      }
+      buffer += " write ";
+      buffer += std::to_string(change.old_value);
+      buffer += " -> ";
+      buffer += std::to_string(change.value);
+      buffer += '\n';
+    }
+    out << buffer << std::flush;
+    if (!polled && poller.has_finished()) {
+      break;
+    }
+  }
+}
+
+// Sampled counts can be scaled up from the time each watch was armed.
+// Throttle indices are the backend's, `var_of` maps them to `names`.
+static void report_throttling(const Throttle &throttle,
+                              const std::vector<std::string> &names,
+                              const std::vector<uint32_t> &var_of) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  for (uint32_t i = 0; i < throttle.get_watch_count(); ++i) {
+    const std::vector<ThrottledPeriod> &periods = throttle.get_periods(i);
+    if (periods.empty()) {
+      continue;
+    }
+    const std::string &name = names[var_of[i]];
+    std::cerr << "Warning: " << name << " was throttled "
+              << periods.size() << " times for "
+              << throttle.get_throttled_ns(i, now) / 1000000 << " ms, "
+              << throttle.get_hits(i) << " hits seen, about "
+              << throttle.estimate_hits(i, now) << " in total\n";
+    for (const ThrottledPeriod &period : periods) {
+      std::cerr << "  " << name << " disarmed from " << period.start_ns
+                << " to " << (period.end_ns ? period.end_ns : now) << "\n";
+    }
+  }
+}
+
+// Turns hits into records: tells reads from writes, applies the --cond
+// filters and hands what passes to the writer or the summary
+class Recorder {
+  std::vector<std::string> names;
+  std::vector<Condition> conditions;
+  // Last seen contents of every watch, larger ones are reported a piece
+  // at a time and each piece needs its own previous value
+  std::vector<std::array<uint8_t, max_watch_size>> contents;
+  std::vector<uintptr_t> addresses; // Tell the classifier what was watched
+  TraceMetadata metadata;
+  std::unique_ptr<TraceWriter> writer;
+  std::unique_ptr<Summary> summary;
+
+public:
+  // Watches are numbered in the order they are added
+  void add_watch(Process &process, const std::string &name, const Watch &watch,
+                 const std::string &condition) {
+    names.push_back(name);
+    overhead.add_watch(name);
+    conditions.push_back(condition.empty() ? Condition()
+                                           : Condition(condition));
+    contents.emplace_back();
+    addresses.push_back(watch.address);
+    process.read_memory(watch.address, contents.back().data(), watch.size);
+    metadata.watches.push_back(
+        {name, watch.address, watch.size, watch.last_value});
+  }
+
+  // After the last watch was added
+  void start(const Options &options, const std::string &build_id,
+             uint64_t base_address) {
+    metadata.build_id = build_id;
+    metadata.base_address = base_address;
+    // In summary mode hits only update counters, nothing is written per hit
+    if (options.summary) {
+      summary = std::make_unique<Summary>(names);
+    } else {
+      writer = std::make_unique<TraceWriter>(options.output, options.format,
+                                             std::move(metadata));
+    }
+  }
+
+  void record(Process &process, AccessClassifier &classifier, uint32_t watch,
+              const WatchEvent &event) {
+    OverheadTimer timer(OverheadPhase::Emit);
+    overhead.add_hit(watch);
+    uint8_t *previous = contents[watch].data() + event.offset;
+    trace_record_t record;
+    record.time_ns = event.time_ns;
+    record.ip = event.ip;
+    record.value = event.value;
+    record.old_value = 0;
+    std::memcpy(&record.old_value, previous, event.size);
+    record.tid = event.tid;
+    record.watch = watch;
+    record.offset = event.offset;
+    // The instruction that trapped tells reads from writes without
+    // spending a second debug register. Comparing values is the fallback
+    // when it can't be decoded, and misses writes of the same value.
+    MemoryAccess access =
+        classifier.classify(process, event.ip, addresses[watch] + event.offset,
+                            event.size);
+    if (access == MemoryAccess::Unknown ||
+        (access == MemoryAccess::Read && record.value != record.old_value)) {
+      // A changed value was written, whatever the decoder made of it
+      access = record.value == record.old_value ? MemoryAccess::Read
+                                                : MemoryAccess::Write;
+    }
+    record.access = static_cast<uint8_t>(access == MemoryAccess::Read
+                                             ? TraceAccess::Read
+                                             : TraceAccess::Write);
+    std::memcpy(previous, &event.value, event.size);
+    if (!conditions[watch].evaluate(
+            {record.value, record.old_value, record.ip, record.tid,
+             access != MemoryAccess::Read})) {
+      return;
+    }
+    if (summary) {
+      summary->add(record);
+    } else {
+      writer->push(record);
+    }
+  }
+
+  // Prints the summary if there is one, on SIGUSR1
+  void report() const {
+    if (summary) {
+      summary->report(std::cout);
+    }
+  }
+
+  void finish() {
+    if (writer) {
+      writer->close();
+    }
+    report();
+  }
+};
+
+// Symbol tables are loaded in parallel and every watch is armed as soon as
+// its own is ready, so backend indexes don't follow the order of `names`.
+// var_of maps them back.
+static std::vector<Watch> resolve_and_arm(Process &process,
+                                          WatchBackend &backend,
+                                          const std::vector<std::string> &names,
+                                          std::vector<uint32_t> &var_of) {
+  std::vector<Watch> watches(names.size());
+  var_of.assign(names.size(), 0);
+  process.resolve_watches(names, [&](size_t i, Watch &watch) {
+    var_of[backend.arm(watch, false)] = i;
+    watches[i] = watch;
+  });
+  return watches;
+}
+
+// Watches the same variables in every attached process. Their names are
+// prefixed with the pid of the process, e.g. 1234/counter.
+static void watch_session(const Options &options) {
+  Session session;
+  std::string build_id;
+  for (pid_t pid : options.attach_pids) {
+    ELF elf;
+    elf.load(Process::get_executable_path(pid));
+    elf.validate();
+    if (build_id.empty()) {
+      build_id = elf.get_build_id();
+    }
+    auto process = std::make_unique<Process>(elf, std::vector<std::string>());
+    process->attach(pid);
+    session.add(std::move(process));
+  }
+  install_handlers();
+
+  Recorder recorder;
+  // Index of the first watch of each tracee, watches of a tracee are
+  // numbered in the order of --var
+  std::vector<uint32_t> first_watch;
+  std::vector<std::vector<uint32_t>> var_of(session.get_tracee_count());
+  for (size_t i = 0; i < session.get_tracee_count(); ++i) {
+    Process &process = session.get_process(i);
+    first_watch.push_back(i * options.vars.size());
+    std::vector<Watch> watches = resolve_and_arm(
+        process, session.get_backend(i), options.vars, var_of[i]);
+    for (size_t j = 0; j < watches.size(); ++j) {
+      recorder.add_watch(process,
+                         std::to_string(process.get_pid()) + "/" +
+                             options.vars[j],
+                         watches[j], options.conditions[j]);
+    }
+  }
+  // Tracees are expected to be identical, the first one describes them all
+  Process &first = session.get_process(0);
+  recorder.start(options, build_id, first.get_load_base());
+  if (!options.overhead_output.empty()) {
+    overhead.enable(); // Counts what the event loop costs, not the setup
+  }
+
+  // Code at the same address can differ between processes
+  std::vector<AccessClassifier> classifiers(session.get_tracee_count());
+  size_t tracee;
+  WatchEvent event;
+  while (!interrupted) {
+    bool hit = session.next_event(tracee, event);
+    if (report_requested) {
+      report_requested = 0;
+      recorder.report();
+    }
+    if (overhead_requested) {
+      overhead_requested = 0;
+      write_overhead(options);
+    }
+    if (!hit) {
+      if (session.has_finished()) {
+        break;
+      }
+      continue; // Interrupted by a signal
+    }
+    recorder.record(session.get_process(tracee), classifiers[tracee],
+                    first_watch[tracee] + var_of[tracee][event.watch], event);
+  }
+  recorder.finish();
+  write_overhead(options);
+  if (interrupted) {
+    // Leave the targets running as we found them
+    session.detach();
+  }
+}
+
 // Generated by ChatGPT, I won't lie
 Options parse_args(int argc, char *argv[]) {
   Options opts;
@@ -29,22 +361,140 @@ Options parse_args(int argc, char *argv[]) {
       if (i + 1 >= argc) {
         throw std::runtime_error("Missing argument for --var");
       }
-      opts.var = argv[++i];
+      opts.vars.push_back(argv[++i]);
+      opts.conditions.emplace_back();
+    } else if (arg == "--cond") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --cond");
+      }
+      // Applies to the --var it follows
+      if (opts.vars.empty()) {
+        throw std::runtime_error("--cond must follow the --var it filters");
+      }
+      opts.conditions.back() = argv[++i];
+    } else if (arg == "--backend") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --backend");
+      }
+      opts.backend = argv[++i];
+      if (opts.backend != "ptrace" && opts.backend != "perf" &&
+          opts.backend != "pages") {
+        throw std::runtime_error("Unknown backend: " + opts.backend);
+      }
     } else if (arg == "--exec") {
       if (i + 1 >= argc) {
         throw std::runtime_error("Missing argument for --exec");
       }
       opts.exec_path = argv[++i];
+    } else if (arg == "--attach") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --attach");
+      }
+      opts.attach_pids.push_back(std::stoi(argv[++i]));
+    } else if (arg == "--output") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --output");
+      }
+      opts.output = argv[++i];
+    } else if (arg == "--format") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --format");
+      }
+      std::string format = argv[++i];
+      if (format == "text") {
+        opts.format = TraceFormat::Text;
+      } else if (format == "binary") {
+        opts.format = TraceFormat::Binary;
+      } else if (format == "columnar") {
+        opts.format = TraceFormat::Columnar;
+      } else {
+        throw std::runtime_error("Unknown format: " + format);
+      }
+    } else if (arg == "--max-rate") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --max-rate");
+      }
+      opts.budget.max_hits_per_second = std::stod(argv[++i]);
+    } else if (arg == "--max-stopped") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --max-stopped");
+      }
+      opts.budget.max_stopped_fraction = std::stod(argv[++i]);
+    } else if (arg == "--poll") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --poll");
+      }
+      // Checked as a double, negative, NaN or huge values don't convert
+      double interval_ns = std::stod(argv[++i]) * 1000000;
+      if (!(interval_ns >= 1)) {
+        throw std::runtime_error("--poll interval must be positive");
+      }
+      if (interval_ns >= 0x1p64) {
+        throw std::runtime_error("--poll interval is too long");
+      }
+      opts.poll_interval_ns = interval_ns;
+    } else if (arg == "--poll-width") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --poll-width");
+      }
+      opts.poll_width = std::stoi(argv[++i]);
+    } else if (arg == "--consistent") {
+      opts.consistent = true;
+    } else if (arg == "--summary") {
+      opts.summary = true;
+    } else if (arg == "--no-symbol-cache") {
+      opts.symbol_cache = false;
+    } else if (arg == "--overhead") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for --overhead");
+      }
+      opts.overhead_output = argv[++i];
     } else {
       throw std::runtime_error("Unknown argument: " + arg);
     }
   }
 
-  if (opts.var.empty()) {
+  if (opts.vars.empty()) {
     throw std::runtime_error("--var argument is required");
   }
-  if (opts.exec_path.empty()) {
-    throw std::runtime_error("--exec argument is required");
+  if (opts.poll_interval_ns) {
+    // Polling replaces the backend and only writes text
+    if (opts.backend != "ptrace" || opts.summary ||
+        opts.format != TraceFormat::Text ||
+        Throttle(opts.budget).is_enabled() || !opts.overhead_output.empty()) {
+      throw std::runtime_error("--poll can't be combined with --backend, "
+                               "--format, --summary, --max-rate, "
+                               "--max-stopped or --overhead");
+    }
+    for (const std::string &condition : opts.conditions) {
+      if (!condition.empty()) {
+        throw std::runtime_error("--poll can't be combined with --cond");
+      }
+    }
+  } else if (opts.consistent) {
+    throw std::runtime_error("--consistent needs --poll");
+  } else if (opts.backend != "pages" &&
+             opts.vars.size() > Process::max_watchpoints) {
+    // Protected pages aren't limited by the debug registers
+    throw std::runtime_error("At most " +
+                             std::to_string(Process::max_watchpoints) +
+                             " --var arguments are supported");
+  }
+  if (opts.exec_path.empty() == opts.attach_pids.empty()) {
+    throw std::runtime_error("Exactly one of --exec and --attach is required");
+  }
+  if (opts.attach_pids.size() > 1 &&
+      (opts.backend != "ptrace" || opts.poll_interval_ns ||
+       Throttle(opts.budget).is_enabled())) {
+    // Throttling timers are per gwatch process, not per tracee
+    throw std::runtime_error("Several --attach need the ptrace backend, "
+                             "without --poll, --max-rate or --max-stopped");
+  }
+  if (opts.backend != "ptrace" && Throttle(opts.budget).is_enabled()) {
+    // The perf backend never stops the tracee, there is nothing to save,
+    // pages can't be armed again once the tracee runs
+    throw std::runtime_error("--max-rate and --max-stopped need the ptrace "
+                             "backend");
   }
 
   return opts;
@@ -55,30 +505,107 @@ int main(int argc, char *argv[]) {
     Options options;
     options = parse_args(argc, argv);
 
+    if (options.symbol_cache) {
+      ELF::set_symbol_cache_directory(SymbolCache::default_directory());
+    }
+    if (options.attach_pids.size() > 1) {
+      watch_session(options);
+      return 0;
+    }
+
+    pid_t attach_pid = options.attach_pids.empty() ? 0 : options.attach_pids[0];
+    if (attach_pid) {
+      options.exec_path = Process::get_executable_path(attach_pid);
+    }
     ELF elf;
     elf.load(options.exec_path);
     elf.validate();
     Process process(elf, std::move(options.exec_args));
-    process.spawn();
+    if (attach_pid) {
+      process.attach(attach_pid);
+    } else {
+      process.spawn();
+    }
+    install_handlers();
+
+    if (options.poll_interval_ns) {
+      poll_regions(process, options);
+      if (interrupted && process.is_running() && process.is_attached()) {
+        process.detach();
+      }
+      return 0;
+    }
 
-    std::string symbol = options.var;
+    std::unique_ptr<WatchBackend> backend;
+    if (options.backend == "perf") {
+      backend = std::make_unique<PerfBackend>(process);
+    } else if (options.backend == "pages") {
+      backend = std::make_unique<PageBackend>(process);
+    } else {
+      auto ptrace_backend = std::make_unique<PtraceBackend>(process);
+      ptrace_backend->set_budget(options.budget);
+      backend = std::move(ptrace_backend);
+    }
 
-    process.set_watchpoint(symbol, false);
-    long last_value = process.read_memory(symbol);
+    // Everything the event loop needs is resolved here, once. Formatting
+    // and output happen on the writer's thread, the loop only fills in a
+    // record.
+    Recorder recorder;
+    std::vector<uint32_t> var_of;
+    std::vector<Watch> watches =
+        resolve_and_arm(process, *backend, options.vars, var_of);
+    for (size_t i = 0; i < watches.size(); ++i) {
+      recorder.add_watch(process, options.vars[i], watches[i],
+                         options.conditions[i]);
+    }
+    recorder.start(options, elf.get_build_id(), process.get_load_base());
+    if (!options.overhead_output.empty()) {
+      overhead.enable(); // Counts what the event loop costs, not the setup
+    }
+    AccessClassifier classifier;
+    WatchEvent event;
+    while (!interrupted) {
+      bool hit = backend->next_event(event);
+      if (report_requested) {
+        report_requested = 0;
+        recorder.report();
+      }
+      if (overhead_requested) {
+        overhead_requested = 0;
+        write_overhead(options);
+      }
+      if (!hit) {
+        if (backend->has_finished()) {
+          break;
+        }
+        continue; // Interrupted by a signal
+      }
+      recorder.record(process, classifier, var_of[event.watch], event);
+    }
+    recorder.finish();
+    write_overhead(options);
 
-    process.continue_execution();
-    while (process.wait()) {
-      long value = process.read_memory(symbol);
-      if (value ==
-          last_value) { // Inaccurate in some cases, but doesn't waste
-                        // additional debug registers which are scarce resource
-        std::cout << symbol << " " << "read" << " " << value << std::endl;
-      } else {
-        std::cout << symbol << " " << "write" << " " << last_value << " -> "
-                  << value << std::endl;
-        last_value = value;
+    if (interrupted && process.is_running() && process.is_attached()) {
+      // Leave the target running as we found it
+      process.detach();
+    }
+
+    if (auto *ptrace = dynamic_cast<PtraceBackend *>(backend.get())) {
+      report_throttling(ptrace->get_throttle(), options.vars, var_of);
+    }
+    if (auto *pages = dynamic_cast<PageBackend *>(backend.get())) {
+      if (pages->get_filtered() > 0) {
+        std::cerr << "Note: " << pages->get_filtered() << " of "
+                  << pages->get_faults()
+                  << " faults were accesses to unwatched neighbours"
+                  << std::endl;
+      }
+    }
+    if (auto *perf = dynamic_cast<PerfBackend *>(backend.get())) {
+      if (perf->get_lost() > 0) {
+        std::cerr << "Warning: " << perf->get_lost()
+                  << " events lost, ring buffer was full" << std::endl;
       }
-      process.continue_execution();
     }
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << std::endl;
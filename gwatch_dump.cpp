@@ -0,0 +1,189 @@
+#include "trace_format.h"
+#include "trace_writer.h"
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Decodes a columnar trace (gwatch --format columnar) back to text, keeping
+// only the records that pass the filters. Blocks outside the time range or
+// without any selected variable are skipped without being decoded.
+
+struct ValuePredicate {
+  enum class Op {
+    Any,
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual
+  };
+  Op op = Op::Any;
+  int64_t operand = 0;
+
+  bool matches(int64_t value) const {
+    switch (op) {
+    case Op::Any:
+      return true;
+    case Op::Equal:
+      return value == operand;
+    case Op::NotEqual:
+      return value != operand;
+    case Op::Less:
+      return value < operand;
+    case Op::LessEqual:
+      return value <= operand;
+    case Op::Greater:
+      return value > operand;
+    case Op::GreaterEqual:
+      return value >= operand;
+    }
+    return false;
+  }
+};
+
+struct Options {
+  std::string path;
+  std::vector<std::string> vars;
+  uint64_t from = 0;
+  uint64_t to = std::numeric_limits<uint64_t>::max();
+  ValuePredicate value;
+  bool writes_only = false;
+  bool header = false;
+};
+
+// "<op><number>", e.g. ">=100" or "!=0"
+static ValuePredicate parse_predicate(const std::string &text) {
+  static const std::pair<const char *, ValuePredicate::Op> ops[] = {
+      {"==", ValuePredicate::Op::Equal},
+      {"!=", ValuePredicate::Op::NotEqual},
+      {"<=", ValuePredicate::Op::LessEqual},
+      {">=", ValuePredicate::Op::GreaterEqual},
+      {"<", ValuePredicate::Op::Less},
+      {">", ValuePredicate::Op::Greater},
+      {"=", ValuePredicate::Op::Equal},
+  };
+  for (const auto &[symbol, op] : ops) {
+    std::string prefix = symbol;
+    if (text.compare(0, prefix.size(), prefix) == 0) {
+      ValuePredicate predicate;
+      predicate.op = op;
+      predicate.operand = std::stoll(text.substr(prefix.size()), nullptr, 0);
+      return predicate;
+    }
+  }
+  throw std::runtime_error("Invalid value predicate: " + text);
+}
+
+static Options parse_args(int argc, char *argv[]) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing argument for " + arg);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--var") {
+      opts.vars.push_back(next());
+    } else if (arg == "--from") {
+      opts.from = std::stoull(next());
+    } else if (arg == "--to") {
+      opts.to = std::stoull(next());
+    } else if (arg == "--value") {
+      opts.value = parse_predicate(next());
+    } else if (arg == "--writes") {
+      opts.writes_only = true;
+    } else if (arg == "--header") {
+      opts.header = true;
+    } else if (opts.path.empty() && arg[0] != '-') {
+      opts.path = arg;
+    } else {
+      throw std::runtime_error("Unknown argument: " + arg);
+    }
+  }
+  if (opts.path.empty()) {
+    throw std::runtime_error("Usage: gwatch-dump <trace> [--var name]... "
+                             "[--from ns] [--to ns] [--value <op><n>] "
+                             "[--writes] [--header]");
+  }
+  return opts;
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    Options options = parse_args(argc, argv);
+    TraceReader reader(options.path);
+    const TraceMetadata &metadata = reader.get_metadata();
+
+    if (options.header) {
+      std::cout << "build-id " << (metadata.build_id.empty() ? "-" :
+                                   metadata.build_id)
+                << "\nbase 0x" << std::hex << metadata.base_address
+                << std::dec << "\n";
+      for (const TraceWatchInfo &watch : metadata.watches) {
+        std::cout << "var " << watch.name << " 0x" << std::hex
+                  << watch.address << std::dec << " size "
+                  << static_cast<int>(watch.size) << " initial "
+                  << watch.initial_value << "\n";
+      }
+    }
+
+    // Selected watches, as a bitmask for blocks and a flag per watch
+    std::vector<bool> selected(metadata.watches.size(), options.vars.empty());
+    uint64_t mask = options.vars.empty() ? ~0ull : 0;
+    for (const std::string &name : options.vars) {
+      bool found = false;
+      for (size_t i = 0; i < metadata.watches.size(); ++i) {
+        if (metadata.watches[i].name == name) {
+          selected[i] = true;
+          mask |= trace_watch_bit(i);
+          found = true;
+        }
+      }
+      if (!found) {
+        throw std::runtime_error("Variable not in trace: " + name);
+      }
+    }
+
+    std::vector<trace_record_t> records;
+    char line[64];
+    while (const trace_block_header_t *block = reader.next_block()) {
+      if (block->last_time_ns < options.from ||
+          block->first_time_ns > options.to || !(block->watch_mask & mask)) {
+        continue;
+      }
+      reader.decode(block, records);
+      for (const trace_record_t &record : records) {
+        bool write =
+            record.access == static_cast<uint8_t>(TraceAccess::Write);
+        if (!selected[record.watch] || record.time_ns < options.from ||
+            record.time_ns > options.to || (options.writes_only && !write) ||
+            !options.value.matches(record.value)) {
+          continue;
+        }
+        snprintf(line, sizeof(line), "%llu %d 0x%llx ",
+                 static_cast<unsigned long long>(record.time_ns), record.tid,
+                 static_cast<unsigned long long>(record.ip));
+        std::cout << line << metadata.watches[record.watch].name;
+        if (record.offset) {
+          std::cout << '+' << int(record.offset);
+        }
+        if (write) {
+          std::cout << " write " << record.old_value << " -> "
+                    << record.value << "\n";
+        } else {
+          std::cout << " read " << record.value << "\n";
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,578 @@
+#include "instruction_decoder.h"
+#include "process.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+enum : uint8_t {
+  // Operand layout of an opcode
+  NoModRM = 0,
+  ModRM = 1,
+  // Immediate after the operands
+  Imm8 = 2,
+  Imm16 = 4,
+  ImmZ = 8,      // 2 bytes with 0x66, otherwise 4
+  ImmGroup = 16, // Imm8/ImmZ only for /0 and /1 (test), 0xf6/0xf7
+  Invalid = 32,
+};
+
+struct Prefixes {
+  bool operand_size;
+  bool address_size;
+  bool rep;   // 0xf3
+  bool repne; // 0xf2
+  bool rex_w;
+};
+
+} // namespace
+
+static MemoryAccess group_access(uint8_t opcode, uint8_t reg) {
+  switch (opcode) {
+  case 0x80:
+  case 0x81:
+  case 0x83:
+    return reg == 7 ? MemoryAccess::Read : MemoryAccess::ReadWrite; // cmp
+  case 0x8f:
+    return reg == 0 ? MemoryAccess::Write : MemoryAccess::Unknown; // pop
+  case 0xc0:
+  case 0xc1:
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+    return MemoryAccess::ReadWrite; // Shifts and rotates
+  case 0xc6:
+  case 0xc7:
+    return reg == 0 ? MemoryAccess::Write : MemoryAccess::Unknown;
+  case 0xf6:
+  case 0xf7:
+    if (reg <= 1) {
+      return MemoryAccess::Read; // test
+    }
+    if (reg <= 3) {
+      return MemoryAccess::ReadWrite; // not, neg
+    }
+    return MemoryAccess::Read; // mul, imul, div, idiv
+  case 0xfe:
+  case 0xff:
+    if (reg <= 1) {
+      return MemoryAccess::ReadWrite; // inc, dec
+    }
+    return reg == 7 ? MemoryAccess::Unknown : MemoryAccess::Read;
+  }
+  return MemoryAccess::Unknown;
+}
+
+static MemoryAccess one_byte_access(uint8_t opcode, uint8_t reg) {
+  if (opcode < 0x40 && (opcode & 7) < 4) {
+    // add, or, adc, sbb, and, sub, xor, cmp
+    bool cmp = (opcode & 0x38) == 0x38;
+    bool to_memory = (opcode & 2) == 0;
+    return to_memory && !cmp ? MemoryAccess::ReadWrite : MemoryAccess::Read;
+  }
+  switch (opcode) {
+  case 0x63: // movsxd
+  case 0x69: // imul
+  case 0x6b:
+  case 0x84: // test
+  case 0x85:
+  case 0x8a: // mov r, r/m
+  case 0x8b:
+    return MemoryAccess::Read;
+  case 0x86: // xchg
+  case 0x87:
+    return MemoryAccess::ReadWrite;
+  case 0x88: // mov r/m, r
+  case 0x89:
+    return MemoryAccess::Write;
+  case 0x8d: // lea
+    return MemoryAccess::None;
+  }
+  return group_access(opcode, reg);
+}
+
+static MemoryAccess two_byte_access(uint8_t opcode, const Prefixes &prefixes,
+                                    uint8_t reg) {
+  if (opcode >= 0x40 && opcode <= 0x4f) {
+    return MemoryAccess::Read; // cmovcc
+  }
+  if (opcode >= 0x90 && opcode <= 0x9f) {
+    return MemoryAccess::Write; // setcc
+  }
+  switch (opcode) {
+  case 0x10: // movups, movss, movsd, movupd
+  case 0x28: // movaps
+  case 0x2a: // cvtsi2ss/sd
+  case 0x2e: // ucomiss
+  case 0x2f: // comiss
+  case 0x51: // sqrt
+  case 0x54: // and
+  case 0x57: // xor
+  case 0x58: // add
+  case 0x59: // mul
+  case 0x5a: // cvtss2sd
+  case 0x5c: // sub
+  case 0x5e: // div
+  case 0x6e: // movd/movq xmm, r/m
+  case 0x6f: // movq, movdqa, movdqu
+  case 0xaf: // imul
+  case 0xb6: // movzx
+  case 0xb7:
+  case 0xbe: // movsx
+  case 0xbf:
+    return MemoryAccess::Read;
+  case 0x11: // movups, movss, movsd, movupd
+  case 0x13: // movlps
+  case 0x17: // movhps
+  case 0x29: // movaps
+  case 0x2b: // movntps
+  case 0x7e: // movd r/m, xmm (movq xmm, xmm/m64 with 0xf3)
+    return opcode == 0x7e && prefixes.rep ? MemoryAccess::Read
+                                          : MemoryAccess::Write;
+  case 0x7f: // movq, movdqa, movdqu
+  case 0xc3: // movnti
+  case 0xd6: // movq
+  case 0xe7: // movntdq
+    return MemoryAccess::Write;
+  case 0xb0: // cmpxchg
+  case 0xb1:
+  case 0xc0: // xadd
+  case 0xc1:
+    return MemoryAccess::ReadWrite;
+  case 0xa3: // bt
+    return MemoryAccess::Read;
+  case 0xab: // bts, btr, btc
+  case 0xb3:
+  case 0xbb:
+    return MemoryAccess::ReadWrite;
+  case 0xba: // bt/bts/btr/btc with imm8
+    return reg == 4 ? MemoryAccess::Read : MemoryAccess::ReadWrite;
+  }
+  return MemoryAccess::Unknown;
+}
+
+static uint8_t one_byte_layout(uint8_t opcode) {
+  if (opcode < 0x40) {
+    switch (opcode & 7) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      return ModRM;
+    case 4:
+      return Imm8;
+    case 5:
+      return ImmZ;
+    default:
+      return Invalid; // Prefixes, or not valid in 64-bit mode
+    }
+  }
+  if (opcode >= 0x50 && opcode <= 0x5f) {
+    return NoModRM; // push, pop
+  }
+  if (opcode >= 0x70 && opcode <= 0x7f) {
+    return Imm8; // jcc
+  }
+  if (opcode >= 0x84 && opcode <= 0x8f) {
+    return ModRM;
+  }
+  if (opcode >= 0x90 && opcode <= 0x99) {
+    return NoModRM;
+  }
+  if (opcode >= 0xb0 && opcode <= 0xb7) {
+    return Imm8;
+  }
+  if (opcode >= 0xd8 && opcode <= 0xdf) {
+    return ModRM; // x87
+  }
+  switch (opcode) {
+  case 0x63:
+    return ModRM;
+  case 0x68:
+    return ImmZ;
+  case 0x69:
+    return ModRM | ImmZ;
+  case 0x6a:
+    return Imm8;
+  case 0x6b:
+  case 0x80:
+  case 0x82:
+  case 0x83:
+  case 0xc0:
+  case 0xc1:
+  case 0xc6:
+    return ModRM | Imm8;
+  case 0x81:
+  case 0xc7:
+    return ModRM | ImmZ;
+  case 0xa8:
+  case 0xcd:
+  case 0xe0:
+  case 0xe1:
+  case 0xe2:
+  case 0xe3:
+  case 0xeb:
+    return Imm8;
+  case 0xa9:
+  case 0xe8:
+  case 0xe9:
+    return ImmZ;
+  case 0xc2:
+    return Imm16;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+  case 0xfe:
+  case 0xff:
+    return ModRM;
+  case 0xf6:
+    return ModRM | Imm8 | ImmGroup;
+  case 0xf7:
+    return ModRM | ImmZ | ImmGroup;
+  case 0x9b:
+  case 0x9c:
+  case 0x9d:
+  case 0x9e:
+  case 0x9f:
+  case 0xa4: // String instructions, a4-a7 and aa-af
+  case 0xa5:
+  case 0xa6:
+  case 0xa7:
+  case 0xaa:
+  case 0xab:
+  case 0xac:
+  case 0xad:
+  case 0xae:
+  case 0xaf:
+  case 0xc3:
+  case 0xc9:
+  case 0xcc:
+  case 0xf4:
+  case 0xf5:
+  case 0xf8:
+  case 0xf9:
+  case 0xfa:
+  case 0xfb:
+  case 0xfc:
+  case 0xfd:
+    return NoModRM;
+  }
+  return Invalid;
+}
+
+static uint8_t two_byte_layout(uint8_t opcode) {
+  if (opcode >= 0x80 && opcode <= 0x8f) {
+    return ImmZ; // jcc rel32
+  }
+  if (opcode >= 0xc8 && opcode <= 0xcf) {
+    return NoModRM; // bswap
+  }
+  switch (opcode) {
+  case 0x05: // syscall
+  case 0x0b: // ud2
+  case 0x31: // rdtsc
+  case 0xa2: // cpuid
+    return NoModRM;
+  case 0x70:
+  case 0x71:
+  case 0x72:
+  case 0x73:
+  case 0xa4:
+  case 0xac:
+  case 0xba:
+  case 0xc2:
+  case 0xc4:
+  case 0xc5:
+  case 0xc6:
+    return ModRM | Imm8;
+  case 0x04:
+  case 0x06:
+  case 0x07:
+  case 0x0f:
+  case 0x36:
+  case 0x39:
+  case 0x3b:
+  case 0x3c:
+  case 0x3d:
+  case 0x3e:
+  case 0x3f:
+    return Invalid;
+  }
+  return ModRM;
+}
+
+// ModRM, SIB and displacement bytes, 0 if they run past `end`
+static size_t memory_operand_length(const uint8_t *modrm, const uint8_t *end,
+                                    bool &memory,
+                                    DecodedInstruction &instruction) {
+  if (modrm >= end) {
+    return 0;
+  }
+  uint8_t mod = *modrm >> 6;
+  uint8_t rm = *modrm & 7;
+  size_t length = 1;
+  memory = mod != 3;
+  if (!memory) {
+    return length;
+  }
+  if (rm == 4) {
+    if (modrm + 1 >= end) {
+      return 0;
+    }
+    uint8_t base = modrm[1] & 7;
+    ++length;
+    if (mod == 0 && base == 5) {
+      length += 4;
+    }
+  } else if (mod == 0 && rm == 5) {
+    length += 4; // RIP-relative
+    if (length <= size_t(end - modrm)) {
+      instruction.rip_relative = true;
+      std::memcpy(&instruction.displacement, modrm + 1, 4);
+    }
+  }
+  if (mod == 1) {
+    length += 1;
+  } else if (mod == 2) {
+    length += 4;
+  }
+  return length <= size_t(end - modrm) ? length : 0;
+}
+
+bool decode_instruction(const uint8_t *code, size_t size,
+                        DecodedInstruction &instruction) {
+  const uint8_t *end = code + size;
+  const uint8_t *position = code;
+  Prefixes prefixes = {};
+  instruction.rip_relative = false;
+  instruction.displacement = 0;
+
+  // Legacy prefixes, then at most one REX right before the opcode
+  for (; position < end; ++position) {
+    uint8_t byte = *position;
+    if (byte == 0x66) {
+      prefixes.operand_size = true;
+    } else if (byte == 0x67) {
+      prefixes.address_size = true;
+    } else if (byte == 0xf3) {
+      prefixes.rep = true;
+    } else if (byte == 0xf2) {
+      prefixes.repne = true;
+    } else if (byte != 0xf0 && byte != 0x2e && byte != 0x36 &&
+               byte != 0x3e && byte != 0x26 && byte != 0x64 &&
+               byte != 0x65) {
+      break;
+    }
+  }
+  if (position < end && (*position & 0xf0) == 0x40) {
+    prefixes.rex_w = *position & 8;
+    ++position;
+  }
+  if (position >= end) {
+    return false;
+  }
+
+  uint8_t opcode = *position++;
+  bool two_byte = false;
+  uint8_t layout;
+  if (opcode == 0xc4 || opcode == 0xc5) {
+    // VEX, always in 64-bit mode. Map 1 mirrors the 0x0f opcodes, so its
+    // moves classify the same, the other maps aren't tabulated.
+    size_t vex_size = opcode == 0xc5 ? 1 : 2;
+    if (size_t(end - position) < vex_size + 1) {
+      return false;
+    }
+    uint8_t map = opcode == 0xc5 ? 1 : position[0] & 0x1f;
+    if (map < 1 || map > 3) {
+      return false;
+    }
+    prefixes.rep = (position[vex_size - 1] & 3) == 2;
+    position += vex_size;
+    opcode = *position++;
+    bool memory;
+    size_t operand =
+        memory_operand_length(position, end, memory, instruction);
+    if (!operand) {
+      return false;
+    }
+    uint8_t reg = (*position >> 3) & 7;
+    bool has_immediate =
+        map == 3 || (map == 1 && (two_byte_layout(opcode) & Imm8));
+    size_t immediate = has_immediate ? 1 : 0;
+    if (operand + immediate > size_t(end - position)) {
+      return false;
+    }
+    instruction.length = position + operand + immediate - code;
+    if (!memory) {
+      instruction.access = MemoryAccess::None;
+    } else if (map == 1) {
+      instruction.access = two_byte_access(opcode, prefixes, reg);
+    } else {
+      instruction.access = MemoryAccess::Unknown;
+    }
+    return instruction.length <= AccessClassifier::max_instruction_length;
+  }
+  if (opcode == 0x0f) {
+    if (position >= end) {
+      return false;
+    }
+    two_byte = true;
+    opcode = *position++;
+    if (opcode == 0x38 || opcode == 0x3a) {
+      // Three-byte maps, read/write isn't worth tabulating
+      if (position >= end) {
+        return false;
+      }
+      ++position;
+      bool memory;
+      size_t operand =
+        memory_operand_length(position, end, memory, instruction);
+      size_t immediate = opcode == 0x3a ? 1 : 0;
+      if (!operand || operand + immediate > size_t(end - position)) {
+        return false;
+      }
+      instruction.length = position + operand + immediate - code;
+      instruction.access = memory ? MemoryAccess::Unknown : MemoryAccess::None;
+      return instruction.length <= AccessClassifier::max_instruction_length;
+    }
+    layout = two_byte_layout(opcode);
+  } else if (opcode >= 0xb8 && opcode <= 0xbf) {
+    // mov r, imm, the only instruction with a 64-bit immediate
+    layout = prefixes.rex_w ? NoModRM : ImmZ;
+    if (prefixes.rex_w) {
+      if (end - position < 8) {
+        return false;
+      }
+      position += 8;
+    }
+  } else if (opcode >= 0xa0 && opcode <= 0xa3) {
+    // mov with a 64-bit absolute address, no ModRM
+    size_t offset_size = prefixes.address_size ? 4 : 8;
+    if (size_t(end - position) < offset_size) {
+      return false;
+    }
+    instruction.length = position + offset_size - code;
+    instruction.access =
+        opcode <= 0xa1 ? MemoryAccess::Read : MemoryAccess::Write;
+    return instruction.length <= AccessClassifier::max_instruction_length;
+  } else {
+    layout = one_byte_layout(opcode);
+  }
+  if (layout & Invalid) {
+    return false;
+  }
+
+  bool memory = false;
+  uint8_t reg = 0;
+  if (layout & ModRM) {
+    size_t operand =
+        memory_operand_length(position, end, memory, instruction);
+    if (!operand) {
+      return false;
+    }
+    reg = (*position >> 3) & 7;
+    position += operand;
+  }
+
+  size_t immediate = 0;
+  if (layout & Imm8) {
+    immediate = 1;
+  } else if (layout & Imm16) {
+    immediate = 2;
+  } else if (layout & ImmZ) {
+    immediate = prefixes.operand_size ? 2 : 4;
+  }
+  if ((layout & ImmGroup) && reg > 1) {
+    immediate = 0;
+  }
+  if (size_t(end - position) < immediate) {
+    return false;
+  }
+  position += immediate;
+
+  instruction.length = position - code;
+  if (instruction.length > AccessClassifier::max_instruction_length) {
+    return false;
+  }
+  if (!memory) {
+    instruction.access = MemoryAccess::None;
+    // String instructions address memory through rsi/rdi
+    if (!two_byte) {
+      if (opcode == 0xaa || opcode == 0xab) {
+        instruction.access = MemoryAccess::Write; // stos
+      } else if (opcode == 0xac || opcode == 0xad || opcode == 0xae ||
+                 opcode == 0xaf || opcode == 0xa6 || opcode == 0xa7) {
+        instruction.access = MemoryAccess::Read; // lods, scas, cmps
+      } else if (opcode == 0xa4 || opcode == 0xa5) {
+        instruction.access = MemoryAccess::Unknown; // movs, either side
+      }
+    }
+    return true;
+  }
+  instruction.access = two_byte ? two_byte_access(opcode, prefixes, reg)
+                                : one_byte_access(opcode, reg);
+  if (!two_byte && opcode >= 0xd8 && opcode <= 0xdf) {
+    instruction.access = MemoryAccess::Unknown; // x87
+  }
+  return true;
+}
+
+MemoryAccess classify_preceding(const uint8_t *code, size_t size,
+                                uintptr_t ip, uintptr_t address,
+                                size_t length) {
+  // Widest operand an access to the range can start before it with
+  constexpr uintptr_t max_operand_size = 32;
+  bool found = false;
+  bool agree = true;
+  MemoryAccess access = MemoryAccess::Unknown;
+  for (size_t start = 0; start < size; ++start) {
+    DecodedInstruction instruction;
+    if (!decode_instruction(code + start, size - start, instruction) ||
+        instruction.length != size - start ||
+        instruction.access == MemoryAccess::None) {
+      continue; // Didn't trap, or doesn't end at the IP
+    }
+    if (length && instruction.rip_relative) {
+      uintptr_t operand = ip + instruction.displacement;
+      if (operand < address + length &&
+          operand + max_operand_size > address) {
+        // Shorter candidates addressing it too are its own tail, e.g.
+        // adc inside movsd
+        return instruction.access;
+      }
+    }
+    if (found && instruction.access != access) {
+      agree = false;
+    }
+    found = true;
+    access = instruction.access;
+  }
+  return found && agree ? access : MemoryAccess::Unknown;
+}
+
+MemoryAccess AccessClassifier::classify(Process &process, uintptr_t ip,
+                                        uintptr_t address, size_t length) {
+  auto it = cache.find(ip);
+  if (it != cache.end()) {
+    return it->second;
+  }
+  uint8_t code[max_instruction_length];
+  MemoryAccess access = MemoryAccess::Unknown;
+  if (process.is_compat()) {
+    // 32-bit code decodes differently, e.g. 0x40-0x4f are inc/dec there
+    cache.emplace(ip, access);
+    return access;
+  }
+  try {
+    process.read_memory(ip - sizeof(code), code, sizeof(code));
+    access = classify_preceding(code, sizeof(code), ip, address, length);
+  } catch (const std::runtime_error &) {
+    // Start of a mapping, the bytes before it may not be readable
+  }
+  cache.emplace(ip, access);
+  return access;
+}
+
+size_t AccessClassifier::get_cache_size() const { return cache.size(); }
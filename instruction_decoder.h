@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+class Process;
+
+enum class MemoryAccess : uint8_t { Unknown, None, Read, Write, ReadWrite };
+
+// Length and memory operand of one x86-64 instruction. Only as much of the
+// instruction set is understood as compilers emit for plain loads and
+// stores of globals; anything else decodes as Unknown.
+struct DecodedInstruction {
+  uint8_t length;
+  MemoryAccess access; // What the instruction does to its memory operand
+  bool rip_relative;   // Memory operand is rip + displacement
+  int32_t displacement;
+};
+
+// Decodes the instruction at the start of `code`, false if the bytes are
+// not a complete instruction we know the length of
+bool decode_instruction(const uint8_t *code, size_t size,
+                        DecodedInstruction &instruction);
+
+// Data watchpoints trap after the access, with the IP past the instruction.
+// x86 can't be decoded backwards, so every start that decodes to an
+// instruction touching memory and ending exactly at the end of `code` is a
+// candidate. Any of them can be the tail of an earlier instruction, so they
+// all have to agree, otherwise the access is Unknown. Given the IP and the
+// watched range, a RIP-relative candidate that addresses the range settles
+// it on its own.
+MemoryAccess classify_preceding(const uint8_t *code, size_t size,
+                                uintptr_t ip = 0, uintptr_t address = 0,
+                                size_t length = 0);
+
+// Read/write classification of watch hits by trapping IP. Code doesn't
+// change under us, so each IP is decoded once. Only x86-64 code is
+// decoded, hits in 32-bit tracees are Unknown.
+class AccessClassifier {
+  std::unordered_map<uintptr_t, MemoryAccess> cache;
+
+public:
+  static constexpr size_t max_instruction_length = 15;
+
+  // `address` and `length` are the watched range that was hit
+  MemoryAccess classify(Process &process, uintptr_t ip, uintptr_t address,
+                        size_t length);
+  size_t get_cache_size() const;
+};
@@ -0,0 +1,163 @@
+#include "loaded_objects.h"
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+static bool matches_object_name(const std::string &path,
+                                const std::string &name) {
+  if (path == name) {
+    return true;
+  }
+  size_t slash = path.rfind('/');
+  std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+  return file == name || (file.size() > name.size() &&
+                          file.compare(0, name.size(), name) == 0 &&
+                          file[name.size()] == '.');
+}
+
+ObjectTable::ObjectTable(size_t max_resident)
+    : objects(), lru(), max_resident(max_resident), generation(~0ull) {
+  if (max_resident == 0) {
+    throw std::invalid_argument("At least one symbol table must fit");
+  }
+}
+
+void ObjectTable::update(const AddressSpace &space) {
+  if (space.get_generation() == generation) {
+    return;
+  }
+  generation = space.get_generation();
+
+  // Tables already loaded, by path. The views point into `objects` and
+  // `space`, both untouched until the swap below.
+  std::unordered_map<std::string_view, size_t> loaded;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (objects[i].elf) {
+      loaded.emplace(objects[i].path, i);
+    }
+  }
+  std::unordered_set<std::string_view> seen;
+
+  std::vector<Object> updated;
+  // New index of every object whose table is kept
+  std::vector<size_t> moved_to(objects.size(), SIZE_MAX);
+  for (const Mapping &mapping : space.get_mappings()) {
+    // Only files, and each file once, at its lowest mapping
+    if (mapping.path.empty() || mapping.path[0] != '/' || mapping.inode == 0) {
+      continue;
+    }
+    if (!seen.insert(mapping.path).second) {
+      continue;
+    }
+    Object object{mapping.path, mapping.start - mapping.offset, nullptr, {}};
+    // Keep tables that are already loaded
+    if (auto it = loaded.find(mapping.path); it != loaded.end()) {
+      object.elf = std::move(objects[it->second].elf);
+      object.base = object.elf->is_pie() ? object.base : 0;
+      moved_to[it->second] = updated.size();
+    }
+    updated.push_back(std::move(object));
+  }
+
+  objects = std::move(updated);
+  // Kept tables stay in the order they were used, not the load order
+  std::list<size_t> kept;
+  for (size_t old : lru) {
+    if (moved_to[old] != SIZE_MAX) {
+      size_t index = moved_to[old];
+      objects[index].lru_position = kept.insert(kept.end(), index);
+    }
+  }
+  lru = std::move(kept);
+}
+
+size_t ObjectTable::get_object_count() const { return objects.size(); }
+
+size_t ObjectTable::get_resident_count() const { return lru.size(); }
+
+std::optional<size_t> ObjectTable::find_object(const std::string &name) const {
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (matches_object_name(objects[i].path, name)) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+const std::string &ObjectTable::get_path(size_t index) const {
+  return objects.at(index).path;
+}
+
+uintptr_t ObjectTable::get_base(size_t index) const {
+  return objects.at(index).base;
+}
+
+ELF &ObjectTable::load(size_t index) {
+  Object &object = objects.at(index);
+  if (object.elf) {
+    lru.splice(lru.begin(), lru, object.lru_position);
+    return *object.elf;
+  }
+
+  auto elf = std::make_unique<ELF>();
+  elf->load(object.path);
+  elf->validate();
+  adopt(index, std::move(elf));
+  return *object.elf;
+}
+
+bool ObjectTable::is_resident(size_t index) const {
+  return objects.at(index).elf != nullptr;
+}
+
+void ObjectTable::adopt(size_t index, std::unique_ptr<ELF> elf) {
+  Object &object = objects.at(index);
+  if (object.elf) {
+    lru.erase(object.lru_position);
+  }
+  if (!elf->is_pie()) {
+    object.base = 0; // Symbol values are absolute already
+  }
+  object.elf = std::move(elf);
+  object.lru_position = lru.insert(lru.begin(), index);
+
+  if (lru.size() > max_resident) {
+    objects[lru.back()].elf.reset();
+    lru.pop_back();
+  }
+}
+
+std::optional<ResolvedSymbol> ObjectTable::lookup(size_t index,
+                                                  const std::string &name) {
+  ELF &elf = load(index);
+  const elf64_sym_t *symbol = elf.get_symbol(name);
+  // Undefined entries only say the object imports the name
+  if (!symbol || symbol->shndx == 0) {
+    return std::nullopt;
+  }
+  return ResolvedSymbol{objects[index].base + symbol->value, symbol->size};
+}
+
+std::optional<ResolvedSymbol>
+ObjectTable::lookup_section(size_t index, const std::string &name) {
+  ELF &elf = load(index);
+  const elf64_shdr_t *section = elf.find_section_header(name);
+  if (!section || !(section->flags & 0x2) /* SHF_ALLOC */) {
+    return std::nullopt;
+  }
+  return ResolvedSymbol{objects[index].base + section->addr, section->size};
+}
+
+std::optional<ResolvedSymbol> ObjectTable::lookup(const std::string &name) {
+  for (size_t i = 0; i < objects.size(); ++i) {
+    try {
+      if (std::optional<ResolvedSymbol> symbol = lookup(i, name)) {
+        return symbol;
+      }
+    } catch (const std::runtime_error &) {
+      // Not an ELF we can read (e.g. a mapped data file), skip it
+    }
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "address_space.h"
+#include "elf.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Symbol resolved to where it lives in the running process
+struct ResolvedSymbol {
+  uintptr_t address;
+  uint64_t size;
+};
+
+// Executable and shared objects mapped into a process. Symbol tables are
+// loaded on the first lookup in an object, and only the most recently used
+// ones are kept resident.
+class ObjectTable {
+  struct Object {
+    std::string path;
+    uintptr_t base; // Load bias, added to symbol values
+    std::unique_ptr<ELF> elf;
+    std::list<size_t>::iterator lru_position;
+  };
+
+  std::vector<Object> objects;
+  // Indices of objects with a loaded table, most recently used first
+  std::list<size_t> lru;
+  size_t max_resident;
+  uint64_t generation;
+
+  ELF &load(size_t index);
+
+public:
+  explicit ObjectTable(size_t max_resident = 32);
+
+  // Picks up objects mapped or unmapped since the last update
+  void update(const AddressSpace &space);
+  size_t get_object_count() const;
+  size_t get_resident_count() const;
+
+  // Object by full path, file name, or file name without version suffix
+  // (libfoo.so for libfoo.so.1.2)
+  std::optional<size_t> find_object(const std::string &name) const;
+  const std::string &get_path(size_t index) const;
+  uintptr_t get_base(size_t index) const;
+  // Whether the object's symbol table is loaded
+  bool is_resident(size_t index) const;
+  // Makes a table loaded elsewhere, e.g. by a SymbolLoader, the object's
+  // one, as if it had been loaded by a lookup
+  void adopt(size_t index, std::unique_ptr<ELF> elf);
+
+  std::optional<ResolvedSymbol> lookup(size_t index, const std::string &name);
+  // Where a section of the object is loaded, nullopt if it isn't
+  std::optional<ResolvedSymbol> lookup_section(size_t index,
+                                               const std::string &name);
+  // Searches every object in load order
+  std::optional<ResolvedSymbol> lookup(const std::string &name);
+};
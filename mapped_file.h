@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only, private mapping of a whole file. Pages are faulted in on first
+// touch, so the cost of opening a file does not depend on its size.
+class MappedFile {
+  const uint8_t *data_;
+  size_t size_;
+
+public:
+  explicit MappedFile(const std::string &path);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  const uint8_t *data() const;
+  size_t size() const;
+};
@@ -0,0 +1,181 @@
+#include "overhead.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <time.h>
+
+OverheadStats overhead;
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : buckets(), count(0), total(0), min(UINT64_MAX), max(0) {}
+
+uint64_t LatencyHistogram::bucket_low(size_t bucket) {
+  size_t group = bucket >> sub_bucket_bits;
+  uint64_t sub = bucket & ((1u << sub_bucket_bits) - 1);
+  if (group == 0) {
+    return sub;
+  }
+  return ((uint64_t(1) << sub_bucket_bits) + sub) << (group - 1);
+}
+
+uint64_t LatencyHistogram::bucket_high(size_t bucket) {
+  size_t group = bucket >> sub_bucket_bits;
+  uint64_t width = group == 0 ? 1 : uint64_t(1) << (group - 1);
+  return bucket_low(bucket) + (width - 1);
+}
+
+uint64_t LatencyHistogram::get_count() const { return count; }
+
+uint64_t LatencyHistogram::get_min() const { return count ? min : 0; }
+
+uint64_t LatencyHistogram::get_max() const { return max; }
+
+double LatencyHistogram::get_mean() const {
+  return count ? double(total) / count : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double quantile) const {
+  if (count == 0) {
+    return 0;
+  }
+  // Rank of the value, 1-based, at least the first one
+  uint64_t rank = static_cast<uint64_t>(quantile * count + 0.5);
+  rank = rank < 1 ? 1 : rank > count ? count : rank;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      // The bucket's end may be past anything we saw
+      return bucket_high(i) < max ? bucket_high(i) : max;
+    }
+  }
+  return max;
+}
+
+OverheadStats::OverheadStats()
+    : enabled(false), sample_period(default_sample_period), countdown(),
+      phases(), watch_names(), watch_hits(), syscalls(0), bytes_read(0),
+      enabled_ticks(0), enabled_ns(0) {}
+
+void OverheadStats::enable(unsigned period) {
+  if (period == 0) {
+    throw std::invalid_argument("Sample period must not be 0");
+  }
+  sample_period = period;
+  for (unsigned &left : countdown) {
+    left = period;
+  }
+  for (LatencyHistogram &phase : phases) {
+    phase = LatencyHistogram();
+  }
+  syscalls = 0;
+  bytes_read = 0;
+  std::fill(watch_hits.begin(), watch_hits.end(), 0);
+  enabled_ticks = now();
+  enabled_ns = monotonic_ns();
+  enabled = true;
+}
+
+bool OverheadStats::is_enabled() const { return enabled; }
+
+uint32_t OverheadStats::add_watch(const std::string &name) {
+  watch_names.push_back(name);
+  watch_hits.push_back(0);
+  return watch_names.size() - 1;
+}
+
+const LatencyHistogram &OverheadStats::get_phase(OverheadPhase phase) const {
+  return phases[static_cast<size_t>(phase)];
+}
+
+uint64_t OverheadStats::get_hits() const {
+  uint64_t hits = 0;
+  for (uint64_t watch : watch_hits) {
+    hits += watch;
+  }
+  return hits;
+}
+
+uint64_t OverheadStats::get_watch_hits(uint32_t watch) const {
+  return watch_hits.at(watch);
+}
+
+uint64_t OverheadStats::get_syscalls() const { return syscalls; }
+
+uint64_t OverheadStats::get_bytes_read() const { return bytes_read; }
+
+double OverheadStats::get_ns_per_tick() const {
+  uint64_t ticks = now() - enabled_ticks;
+  uint64_t ns = monotonic_ns() - enabled_ns;
+  // Nothing was timed yet if the clocks haven't moved
+  return enabled && ticks && ns ? double(ns) / ticks : 1.0;
+}
+
+static std::string json_string(const std::string &text) {
+  std::string quoted = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < 0x20) {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+static std::string json_number(double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.1f", value);
+  return text;
+}
+
+void OverheadStats::write_json(std::ostream &out) const {
+  static const char *const phase_names[overhead_phase_count] = {
+      "stop_detection", "register_read", "memory_read", "emit", "resume"};
+  double scale = get_ns_per_tick();
+  uint64_t hits = get_hits();
+
+  out << "{\n  \"sample_period\": " << sample_period
+      << ",\n  \"hits\": " << hits << ",\n  \"syscalls\": " << syscalls
+      << ",\n  \"syscalls_per_hit\": "
+      << json_number(hits ? double(syscalls) / hits : 0)
+      << ",\n  \"bytes_read\": " << bytes_read << ",\n  \"watches\": [";
+  for (size_t i = 0; i < watch_names.size(); ++i) {
+    out << (i ? ",\n" : "\n") << "    {\"name\": "
+        << json_string(watch_names[i]) << ", \"hits\": " << watch_hits[i]
+        << "}";
+  }
+  out << (watch_names.empty() ? "]" : "\n  ]") << ",\n  \"phases\": {";
+  for (size_t i = 0; i < overhead_phase_count; ++i) {
+    const LatencyHistogram &phase = phases[i];
+    out << (i ? ",\n" : "\n") << "    " << json_string(phase_names[i])
+        << ": {\"samples\": " << phase.get_count()
+        << ", \"min_ns\": " << json_number(phase.get_min() * scale)
+        << ", \"mean_ns\": " << json_number(phase.get_mean() * scale)
+        << ", \"p50_ns\": " << json_number(phase.percentile(0.5) * scale)
+        << ", \"p90_ns\": " << json_number(phase.percentile(0.9) * scale)
+        << ", \"p99_ns\": " << json_number(phase.percentile(0.99) * scale)
+        << ", \"p999_ns\": " << json_number(phase.percentile(0.999) * scale)
+        << ", \"max_ns\": " << json_number(phase.get_max() * scale)
+        << ", \"buckets\": [";
+    bool first = true;
+    phase.for_each([&](uint64_t low, uint64_t high, uint64_t count) {
+      out << (first ? "" : ", ") << "[" << json_number(low * scale) << ", "
+          << json_number(high * scale) << ", " << count << "]";
+      first = false;
+    });
+    out << "]}";
+  }
+  out << "\n  }\n}\n";
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Log-linear histogram in the style of HdrHistogram: values are grouped by
+// their highest set bit and every group is split into 2^sub_bucket_bits
+// linear buckets, so a bucket is never wider than 1/32 of its values
+class LatencyHistogram {
+public:
+  static constexpr unsigned sub_bucket_bits = 5;
+  static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1)
+                                         << sub_bucket_bits;
+
+private:
+  uint64_t buckets[bucket_count];
+  uint64_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+
+public:
+  LatencyHistogram();
+  static size_t bucket_of(uint64_t value);
+  // Range of values a bucket holds, both inclusive
+  static uint64_t bucket_low(size_t bucket);
+  static uint64_t bucket_high(size_t bucket);
+
+  void add(uint64_t value);
+  uint64_t get_count() const;
+  uint64_t get_min() const; // 0 when empty
+  uint64_t get_max() const;
+  double get_mean() const;
+  // Upper end of the bucket holding the quantile (0-1), 0 when empty
+  uint64_t percentile(double quantile) const;
+  // Calls visit(low, high, count) for every non-empty bucket, in order
+  template <typename Visit> void for_each(Visit visit) const;
+};
+
+enum class OverheadPhase : uint8_t {
+  StopDetection, // From waitpid returning a stop to handing it out
+  RegisterRead,  // DR6 and the instruction pointer
+  MemoryRead,    // Values of the watches
+  Emit,          // Classifying, filtering and queueing the record
+  Resume,        // Restarting the stopped threads
+};
+constexpr size_t overhead_phase_count = 5;
+
+// Time gwatch adds to a traced process, per phase of a hit, and what it
+// costs in syscalls and bytes. Timing every call would cost more than the
+// phases it measures, so only every sample_period-th call of a phase reads
+// the clock. Counters see everything. Not thread-safe, the tracer thread is
+// the only one to report.
+class OverheadStats {
+  bool enabled;
+  unsigned sample_period;
+  // Calls of each phase left until its next sample
+  unsigned countdown[overhead_phase_count];
+  LatencyHistogram phases[overhead_phase_count]; // In clock ticks
+  std::vector<std::string> watch_names;
+  std::vector<uint64_t> watch_hits;
+  uint64_t syscalls;
+  uint64_t bytes_read;
+  // Both clocks when enabled, ticks are converted to ns with their rates
+  uint64_t enabled_ticks;
+  uint64_t enabled_ns;
+
+public:
+  static constexpr unsigned default_sample_period = 16;
+
+  OverheadStats();
+  // Starts timing, counters and histograms start over from 0
+  void enable(unsigned sample_period = default_sample_period);
+  bool is_enabled() const;
+
+  // TSC where there is one, CLOCK_MONOTONIC ns elsewhere
+  static uint64_t now();
+  // Timestamp if this call of the phase is sampled, 0 otherwise
+  uint64_t start(OverheadPhase phase);
+  void finish(OverheadPhase phase, uint64_t started);
+
+  void add_syscalls(uint64_t count);
+  void add_bytes_read(uint64_t bytes);
+  // Watches are numbered in the order they are added
+  uint32_t add_watch(const std::string &name);
+  void add_hit(uint32_t watch);
+
+  const LatencyHistogram &get_phase(OverheadPhase phase) const;
+  uint64_t get_hits() const;
+  uint64_t get_watch_hits(uint32_t watch) const;
+  uint64_t get_syscalls() const;
+  uint64_t get_bytes_read() const;
+  double get_ns_per_tick() const;
+  // Histograms in ns, counters and the hits of every watch
+  void write_json(std::ostream &out) const;
+};
+
+// What Process and the event loop report to
+extern OverheadStats overhead;
+
+// Times one phase, from construction to the end of the scope
+class OverheadTimer {
+  OverheadPhase phase;
+  uint64_t started;
+
+public:
+  explicit OverheadTimer(OverheadPhase phase)
+      : phase(phase), started(overhead.start(phase)) {}
+  OverheadTimer(const OverheadTimer &) = delete;
+  OverheadTimer &operator=(const OverheadTimer &) = delete;
+  ~OverheadTimer() { overhead.finish(phase, started); }
+};
+
+inline size_t LatencyHistogram::bucket_of(uint64_t value) {
+  if (value < (uint64_t(1) << sub_bucket_bits)) {
+    return value;
+  }
+  unsigned top = 63 - __builtin_clzll(value);
+  unsigned group = top - sub_bucket_bits + 1;
+  size_t sub = (value >> (top - sub_bucket_bits)) - (1u << sub_bucket_bits);
+  return (size_t(group) << sub_bucket_bits) + sub;
+}
+
+inline void LatencyHistogram::add(uint64_t value) {
+  ++buckets[bucket_of(value)];
+  ++count;
+  total += value;
+  if (value < min) {
+    min = value;
+  }
+  if (value > max) {
+    max = value;
+  }
+}
+
+template <typename Visit> void LatencyHistogram::for_each(Visit visit) const {
+  for (size_t i = 0; i < bucket_count; ++i) {
+    if (buckets[i]) {
+      visit(bucket_low(i), bucket_high(i), buckets[i]);
+    }
+  }
+}
+
+inline uint64_t OverheadStats::now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+inline uint64_t OverheadStats::start(OverheadPhase phase) {
+  if (!enabled || --countdown[static_cast<size_t>(phase)]) {
+    return 0;
+  }
+  countdown[static_cast<size_t>(phase)] = sample_period;
+  return now();
+}
+
+inline void OverheadStats::finish(OverheadPhase phase, uint64_t started) {
+  if (started) {
+    phases[static_cast<size_t>(phase)].add(now() - started);
+  }
+}
+
+inline void OverheadStats::add_syscalls(uint64_t count) { syscalls += count; }
+
+inline void OverheadStats::add_bytes_read(uint64_t bytes) {
+  bytes_read += bytes;
+}
+
+inline void OverheadStats::add_hit(uint32_t watch) {
+  if (watch < watch_hits.size()) {
+    ++watch_hits[watch];
+  }
+}
@@ -0,0 +1,162 @@
+#include "page_backend.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <time.h>
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+PageBackend::PageBackend(Process &process)
+    : process(process), watches(), write_only(), pages(), page_watches(),
+      contents(), current(), ranges(), ready(), next_ready(0), guarded(false),
+      stopped(true), faults(0), filtered(0) {}
+
+uint32_t PageBackend::arm(const Watch &watch, bool write_only_watch) {
+  if (guarded) {
+    throw std::runtime_error("Watches must be armed before the first event");
+  }
+  watches.push_back(watch);
+  write_only.push_back(write_only_watch);
+  return watches.size() - 1;
+}
+
+void PageBackend::guard() {
+  guarded = true;
+  // Every page a watch touches, a variable can straddle two
+  std::vector<std::pair<uintptr_t, uint32_t>> entries;
+  uintptr_t page_mask = ~(Process::page_size() - 1);
+  for (uint32_t i = 0; i < watches.size(); ++i) {
+    uintptr_t first = watches[i].address & page_mask;
+    uintptr_t last = (watches[i].address + watches[i].size - 1) & page_mask;
+    for (uintptr_t page = first; page <= last; page += Process::page_size()) {
+      entries.emplace_back(page, i);
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [this](const auto &a, const auto &b) {
+              if (a.first != b.first) {
+                return a.first < b.first;
+              }
+              return watches[a.second].address < watches[b.second].address;
+            });
+
+  for (const auto &[page, watch] : entries) {
+    if (pages.empty() || pages.back().address != page) {
+      pages.push_back({page, uint32_t(page_watches.size()), 0});
+    }
+    page_watches.push_back(watch);
+    ++pages.back().count;
+  }
+  contents.resize(watches.size() * max_watch_size);
+  for (uint32_t i = 0; i < watches.size(); ++i) {
+    process.read_memory(watches[i].address,
+                        contents.data() + i * max_watch_size,
+                        watches[i].size);
+  }
+  for (const WatchedPage &page : pages) {
+    // Reads only need to fault if some watch on the page wants them
+    bool writes_only = true;
+    for (uint32_t i = page.first; i < page.first + page.count; ++i) {
+      writes_only = writes_only && write_only[page_watches[i]];
+    }
+    process.guard_page(page.address, writes_only ? PROT_READ : PROT_NONE);
+  }
+}
+
+const PageBackend::WatchedPage *
+PageBackend::find_page(uintptr_t address) const {
+  uintptr_t page = address & ~(Process::page_size() - 1);
+  auto it = std::lower_bound(
+      pages.begin(), pages.end(), page,
+      [](const WatchedPage &a, uintptr_t b) { return a.address < b; });
+  return it != pages.end() && it->address == page ? &*it : nullptr;
+}
+
+void PageBackend::read_page_watches(const WatchedPage &page) {
+  current.resize(page.count * max_watch_size);
+  ranges.clear();
+  for (uint32_t i = 0; i < page.count; ++i) {
+    const Watch &watch = watches[page_watches[page.first + i]];
+    ranges.push_back({watch.address, current.data() + i * max_watch_size,
+                      watch.size});
+  }
+  process.read_memory(ranges.data(), ranges.size());
+}
+
+void PageBackend::handle_fault(uintptr_t address) {
+  ++faults;
+  uint64_t time_ns = monotonic_ns();
+  const WatchedPage *page = find_page(address);
+  int protection = process.find_guarded_page(address)->protection;
+  process.step_over_fault();
+  if (!page || !process.is_running()) {
+    return;
+  }
+  read_page_watches(*page);
+
+  pid_t tid = process.get_current_thread();
+  uintptr_t ip = process.get_instruction_pointer();
+  for (uint32_t i = 0; i < page->count; ++i) {
+    uint32_t index = page_watches[page->first + i];
+    const Watch &watch = watches[index];
+    uint8_t *old_bytes = contents.data() + index * max_watch_size;
+    const uint8_t *new_bytes = current.data() + i * max_watch_size;
+    bool changed = std::memcmp(old_bytes, new_bytes, watch.size) != 0;
+    bool inside =
+        address >= watch.address && address < watch.address + watch.size;
+    // A page no one may read faults on reads too, a write-only watch there
+    // only counts the accesses that changed it
+    if (!changed &&
+        (!inside || (write_only[index] && protection == PROT_NONE))) {
+      continue;
+    }
+    std::memcpy(old_bytes, new_bytes, watch.size);
+    WatchEvent event;
+    event.watch = index;
+    event.tid = tid;
+    event.ip = ip;
+    event.time_ns = time_ns;
+    event.offset = 0;
+    event.size = watch.size < sizeof(long) ? watch.size : sizeof(long);
+    event.value = 0;
+    std::memcpy(&event.value, new_bytes, event.size);
+    ready.push_back(event);
+  }
+  if (ready.empty()) {
+    ++filtered; // A neighbour of the watches on the same page
+  }
+}
+
+bool PageBackend::next_event(WatchEvent &event) {
+  if (!guarded) {
+    guard();
+  }
+  while (next_ready == ready.size()) {
+    ready.clear();
+    next_ready = 0;
+    if (stopped) {
+      process.continue_execution();
+      stopped = false;
+    }
+    if (!process.wait()) {
+      return false;
+    }
+    stopped = true;
+    if (uintptr_t address = process.get_fault_address()) {
+      handle_fault(address);
+    }
+  }
+  event = ready[next_ready++];
+  return true;
+}
+
+bool PageBackend::has_finished() const { return !process.is_running(); }
+
+uint64_t PageBackend::get_faults() const { return faults; }
+
+uint64_t PageBackend::get_filtered() const { return filtered; }
@@ -0,0 +1,59 @@
+#pragma once
+#include "process.h"
+#include "remote_memory.h"
+#include "watch.h"
+#include <vector>
+
+// Software watchpoints. Pages holding watched variables are protected, so
+// every access to them stops the tracee with a SIGSEGV. The faulting
+// instruction is single-stepped with its page unprotected, then the page is
+// protected again. Any number of variables can be watched, but every access
+// to anything on their pages costs a few syscalls, and syscalls that get a
+// buffer on such a page fail with EFAULT instead of faulting.
+class PageBackend : public WatchBackend {
+  // A watched page and its watches, sorted by address
+  struct WatchedPage {
+    uintptr_t address;
+    uint32_t first; // Into page_watches
+    uint32_t count;
+  };
+
+  Process &process;
+  std::vector<Watch> watches;
+  std::vector<bool> write_only;
+  std::vector<WatchedPage> pages; // Sorted by address
+  std::vector<uint32_t> page_watches;
+  // Last seen contents of every watch, max_watch_size bytes each. Nothing
+  // can change them without a fault while the pages are protected.
+  std::vector<uint8_t> contents;
+  std::vector<uint8_t> current;
+  std::vector<MemoryRange> ranges;
+  std::vector<WatchEvent> ready;
+  size_t next_ready;
+  bool guarded;
+  bool stopped;
+  uint64_t faults;
+  uint64_t filtered;
+
+  // Builds the page index and protects the pages
+  void guard();
+  const WatchedPage *find_page(uintptr_t address) const;
+  // Needs every thread stopped, protected pages are read through ptrace
+  void read_page_watches(const WatchedPage &page);
+  // Steps over the fault of the current thread, queueing a hit for every
+  // watch it touched
+  void handle_fault(uintptr_t address);
+
+public:
+  explicit PageBackend(Process &process);
+  PageBackend(const PageBackend &) = delete;
+  PageBackend &operator=(const PageBackend &) = delete;
+
+  // Pages are protected when the first event is requested
+  uint32_t arm(const Watch &watch, bool write_only) override;
+  bool next_event(WatchEvent &event) override;
+  bool has_finished() const override;
+  // Accesses to protected pages, and the ones that touched no watch
+  uint64_t get_faults() const;
+  uint64_t get_filtered() const;
+};
@@ -0,0 +1,229 @@
+#include "perf_backend.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Layout of a PERF_RECORD_SAMPLE for the sample_type we ask for
+struct perf_sample_t {
+  uint64_t ip;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t time;
+  uint64_t id;
+};
+
+struct perf_lost_t {
+  uint64_t id;
+  uint64_t lost;
+};
+
+static size_t page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+// Copies out of the ring buffer, handling records that wrap around its end
+static void ring_copy(void *out, const uint8_t *data, size_t data_size,
+                      uint64_t position, size_t size) {
+  size_t offset = position & (data_size - 1);
+  size_t first = std::min(size, data_size - offset);
+  std::memcpy(out, data + offset, first);
+  std::memcpy(static_cast<uint8_t *>(out) + first, data, size - first);
+}
+
+PerfBackend::PerfBackend(Process &process)
+    : process(process), watches(), rings(), redirected(), watch_ids(),
+      pollfds(), ready(), next_ready(0), lost(0), started(false),
+      exited(false) {}
+
+PerfBackend::~PerfBackend() {
+  for (int fd : redirected) {
+    close(fd);
+  }
+  for (const Ring &ring : rings) {
+    if (ring.fd >= 0) {
+      munmap(ring.page, (ring_pages + 1) * page_size());
+      close(ring.fd);
+    }
+  }
+}
+
+uint32_t PerfBackend::arm(const Watch &watch, bool write_only) {
+  if (Process::split_watch(watch.address, watch.size).size() != 1) {
+    // A perf breakpoint covers one aligned range, like a debug register
+    throw std::invalid_argument("The perf backend only watches aligned "
+                                "variables of 1, 2, 4 or 8 bytes");
+  }
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_BREAKPOINT;
+  attr.bp_type = write_only ? HW_BREAKPOINT_W : HW_BREAKPOINT_RW;
+  attr.bp_addr = watch.address;
+  attr.bp_len = watch.size;
+  attr.sample_period = 1;
+  attr.sample_type =
+      PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ID;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1; // Threads started later report into our buffer too
+  attr.use_clockid = 1;
+  attr.clockid = CLOCK_MONOTONIC;
+  // Wake up when a quarter of the buffer is filled, not on every hit
+  attr.watermark = 1;
+  attr.wakeup_watermark = ring_pages * page_size() / 4;
+
+  watches.push_back(watch);
+  uint32_t index = watches.size() - 1;
+
+  // Inherited events can only be mapped when bound to a CPU, so one is
+  // opened per CPU and thread. Threads started later inherit them. The
+  // first event on a CPU owns its ring, all later ones are redirected
+  // there, so memory grows with the CPUs and not with threads and watches.
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (rings.empty()) {
+    rings.assign(cpus, Ring{-1, nullptr});
+  }
+  for (pid_t tid : process.get_threads()) {
+    for (int cpu = 0; cpu < cpus; ++cpu) {
+      int fd = syscall(SYS_perf_event_open, &attr, tid, cpu, -1,
+                       PERF_FLAG_FD_CLOEXEC);
+      if (fd < 0) {
+        throw std::runtime_error("Failed to open perf breakpoint event: " +
+                                 std::string(strerror(errno)));
+      }
+      uint64_t id;
+      if (ioctl(fd, PERF_EVENT_IOC_ID, &id) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to read perf event id: " +
+                                 std::string(strerror(errno)));
+      }
+      Ring &ring = rings[cpu];
+      if (ring.fd >= 0) {
+        if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, ring.fd) != 0) {
+          close(fd);
+          throw std::runtime_error("Failed to share perf ring buffer: " +
+                                   std::string(strerror(errno)));
+        }
+        redirected.push_back(fd);
+      } else {
+        void *page = mmap(nullptr, (ring_pages + 1) * page_size(),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (page == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("Failed to map perf ring buffer: " +
+                                   std::string(strerror(errno)));
+        }
+        ring = {fd, static_cast<perf_event_mmap_page *>(page)};
+        pollfds.push_back({fd, POLLIN, 0});
+      }
+      watch_ids[id] = index;
+    }
+  }
+  return index;
+}
+
+void PerfBackend::drain(const Ring &ring) {
+  perf_event_mmap_page *page = ring.page;
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(page) + page_size();
+  size_t data_size = ring_pages * page_size();
+
+  uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = page->data_tail;
+  while (tail < head) {
+    perf_event_header header;
+    ring_copy(&header, data, data_size, tail, sizeof(header));
+    if (header.type == PERF_RECORD_SAMPLE) {
+      perf_sample_t sample;
+      ring_copy(&sample, data, data_size, tail + sizeof(header),
+                sizeof(sample));
+      auto watch = watch_ids.find(sample.id);
+      if (watch == watch_ids.end()) {
+        tail += header.size;
+        continue; // Not one of ours, can't happen with a private ring
+      }
+      WatchEvent event;
+      event.watch = watch->second;
+      event.tid = static_cast<int32_t>(sample.tid);
+      event.ip = sample.ip;
+      event.time_ns = sample.time;
+      event.value = 0; // Read once the batch is drained
+      // Only single aligned ranges are armed, always reported whole
+      event.offset = 0;
+      event.size = watches[event.watch].size;
+      ready.push_back(event);
+    } else if (header.type == PERF_RECORD_LOST) {
+      perf_lost_t record;
+      ring_copy(&record, data, data_size, tail + sizeof(header),
+                sizeof(record));
+      lost += record.lost;
+    }
+    tail += header.size;
+  }
+  __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void PerfBackend::drain_all() {
+  ready.clear();
+  next_ready = 0;
+  for (const Ring &ring : rings) {
+    if (ring.fd >= 0) {
+      drain(ring);
+    }
+  }
+  // Buffers are per CPU, interleave them back into one timeline
+  std::stable_sort(ready.begin(), ready.end(),
+                   [](const WatchEvent &a, const WatchEvent &b) {
+                     return a.time_ns < b.time_ns;
+                   });
+
+  // One read per watch and batch, not one per event
+  for (uint32_t i = 0; i < watches.size(); ++i) {
+    bool hit = std::any_of(ready.begin(), ready.end(),
+                           [i](const WatchEvent &e) { return e.watch == i; });
+    if (hit && !exited) {
+      try {
+        watches[i].last_value = process.read_watch(watches[i]);
+      } catch (const std::runtime_error &) {
+        // Exited between the check and the read, keep the last value
+      }
+    }
+  }
+  for (WatchEvent &event : ready) {
+    event.value = watches[event.watch].last_value;
+  }
+}
+
+bool PerfBackend::next_event(WatchEvent &event) {
+  if (!started) {
+    // From here on the tracee is never stopped by us
+    process.detach();
+    started = true;
+  }
+  while (next_ready == ready.size()) {
+    if (exited) {
+      return false;
+    }
+    if (poll(pollfds.data(), pollfds.size(), 100) < 0 && errno == EINTR) {
+      return false;
+    }
+    // Checked before draining, so that hits logged right before the exit
+    // still make it out
+    exited = process.has_exited();
+    drain_all();
+  }
+  event = ready[next_ready++];
+  return true;
+}
+
+uint64_t PerfBackend::get_lost() const { return lost; }
+
+bool PerfBackend::has_finished() const { return exited; }
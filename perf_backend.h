@@ -0,0 +1,53 @@
+#pragma once
+#include "process.h"
+#include "watch.h"
+#include <poll.h>
+#include <unordered_map>
+#include <vector>
+
+struct perf_event_mmap_page;
+
+// Hits are hardware breakpoints counted by perf_event_open. The kernel logs
+// them (IP, TID, time, event id) into one ring buffer per CPU, shared by
+// every watch and thread, that we drain without ever stopping the tracee.
+// Values are read when a batch is drained, so they may be newer than the
+// access that produced the event.
+class PerfBackend : public WatchBackend {
+  struct Ring {
+    int fd;
+    perf_event_mmap_page *page;
+  };
+
+  Process &process;
+  std::vector<Watch> watches;
+  // Indexed by CPU, fd -1 until an event on that CPU is opened
+  std::vector<Ring> rings;
+  // Events that report into another event's ring
+  std::vector<int> redirected;
+  // Event id -> watch, samples of inherited events carry their parent's id
+  std::unordered_map<uint64_t, uint32_t> watch_ids;
+  std::vector<pollfd> pollfds;
+  std::vector<WatchEvent> ready;
+  size_t next_ready;
+  uint64_t lost;
+  bool started;
+  bool exited;
+
+  void drain(const Ring &ring);
+  void drain_all();
+
+public:
+  // Data pages per ring buffer, must be a power of two
+  static constexpr size_t ring_pages = 16;
+
+  explicit PerfBackend(Process &process);
+  PerfBackend(const PerfBackend &) = delete;
+  PerfBackend &operator=(const PerfBackend &) = delete;
+  ~PerfBackend() override;
+
+  uint32_t arm(const Watch &watch, bool write_only) override;
+  bool next_event(WatchEvent &event) override;
+  bool has_finished() const override;
+  // Events the kernel dropped because a ring buffer was full
+  uint64_t get_lost() const;
+};
@@ -1,12 +1,19 @@
 #include "process.h"
+#include "overhead.h"
+#include "symbol_loader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
 #include <fstream>
 #include <iostream>
 #include <limits.h>
-#include <limits>
 #include <signal.h>
-#include <sstream>
 #include <stdexcept>
+#include <sys/auxv.h>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -19,11 +26,77 @@ static std::string canonicalize_path(const std::string &path) {
   return std::string(real_path);
 }
 
+static size_t debug_register_offset(int index) {
+  return offsetof(user, u_debugreg) + index * sizeof(long);
+}
+
+static int to_protection(uint32_t permissions) {
+  return (permissions & MappingRead ? PROT_READ : 0) |
+         (permissions & MappingWrite ? PROT_WRITE : 0) |
+         (permissions & MappingExecute ? PROT_EXEC : 0);
+}
+
+static std::vector<pid_t> list_threads(pid_t pid) {
+  std::string task_path = "/proc/" + std::to_string(pid) + "/task";
+  DIR *task_dir = opendir(task_path.c_str());
+  if (!task_dir) {
+    throw std::runtime_error("Failed to list threads of process " +
+                             std::to_string(pid));
+  }
+  std::vector<pid_t> tids;
+  while (dirent *entry = readdir(task_dir)) {
+    if (entry->d_name[0] != '.') {
+      tids.push_back(std::stoi(entry->d_name));
+    }
+  }
+  closedir(task_dir);
+  return tids;
+}
+
+// Position of the ':' after the object in "object:symbol", npos if the name
+// has no object. A lone ':' separates it, "::" is part of a C++ name.
+static size_t find_object_separator(const std::string &name) {
+  size_t colon = 0;
+  while ((colon = name.find(':', colon)) != std::string::npos &&
+         colon + 1 < name.size() && name[colon + 1] == ':') {
+    colon += 2;
+  }
+  return colon;
+}
+
+// Thread group, i.e. process, a thread belongs to, 0 if it is gone
+static pid_t read_thread_group(pid_t tid) {
+  std::ifstream status("/proc/" + std::to_string(tid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 5, "Tgid:") == 0) {
+      return std::stoi(line.substr(5));
+    }
+  }
+  return 0;
+}
+
+std::unordered_map<pid_t, Process *> Process::owners;
+
 Process::Process(const ELF &executable, const std::vector<std::string> &&args)
-    : pid(0), executable(executable), args(args), running(false),
-      symbol_cache() {}
+    : pid(0), executable(executable),
+      compat(executable.getSize() == ELFSize::ELF32), args(args),
+      running(false), attached(false), base_address(0), used_watchpoints(0),
+      debug_addresses(), dr7(0), debug_sizes(), memory(), address_space(),
+      objects(), at_exec_stop(false), threads(), current_thread(0),
+      stopped_threads(), pending_stops(), stray_stops(), guarded_pages(),
+      fault_address(0), stop_started(0), stop_listener() {}
 
 pid_t Process::get_pid() const { return pid; }
+
+pid_t Process::get_current_thread() const { return current_thread; }
+
+size_t Process::get_thread_count() const { return threads.size(); }
+
+const std::unordered_set<pid_t> &Process::get_threads() const {
+  return threads;
+}
+
 void Process::spawn() {
   // Implementation of spawning the process
   pid = fork();
@@ -41,10 +114,19 @@ void Process::spawn() {
 
   } else if (pid > 0) {
     running = true;
+    memory = RemoteMemory(pid);
+    address_space = AddressSpace(pid);
     int status;
     waitpid(pid, &status, 0); // Wait for initial stop
-    base_address = get_base_address().value_or(0);
+    base_address = get_base_address();
     if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP) {
+      // Debug registers are per thread, so we need to see every new one
+      ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACECLONE);
+      threads.insert(pid);
+      owners[pid] = this;
+      stopped_threads.insert(pid);
+      current_thread = pid;
+      at_exec_stop = true;
       return;
     } else {
       throw std::runtime_error("Child process did not stop as expected");
@@ -55,134 +137,900 @@ void Process::spawn() {
   }
 }
 
+void Process::attach(pid_t target) {
+  pid = target;
+  memory = RemoteMemory(pid);
+  address_space = AddressSpace(pid);
+
+  // Threads may start while we attach, repeat until no new ones show up.
+  // Ones started after we seized their parent are attached automatically
+  // and get handled as new threads by wait().
+  bool found_new = true;
+  while (found_new) {
+    found_new = false;
+    for (pid_t tid : list_threads(pid)) {
+      if (threads.count(tid)) {
+        continue;
+      }
+      if (ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACECLONE) == -1) {
+        if (errno == ESRCH || (errno == EPERM && !threads.empty())) {
+          continue; // Exited meanwhile or already attached through a clone
+        }
+        throw std::runtime_error("Failed to attach to process " +
+                                 std::to_string(pid));
+      }
+      ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+      threads.insert(tid);
+      found_new = true;
+    }
+  }
+  running = true;
+  attached = true;
+
+  for (auto it = threads.begin(); it != threads.end();) {
+    int status;
+    if (waitpid(*it, &status, __WALL) == *it && WIFSTOPPED(status)) {
+      stopped_threads.insert(*it);
+      ++it;
+    } else {
+      it = threads.erase(it); // Exited before it could stop
+    }
+  }
+  if (!threads.count(pid)) {
+    throw std::runtime_error("Process exited while attaching: " +
+                             std::to_string(pid));
+  }
+  owners[pid] = this;
+  current_thread = pid;
+  base_address = get_base_address();
+}
+
 void Process::continue_execution() {
   if (!running) {
     throw std::runtime_error("Process is not running");
   }
-  ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+  OverheadTimer timer(OverheadPhase::Resume);
+  for (pid_t tid : stopped_threads) {
+    ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+  }
+  overhead.add_syscalls(stopped_threads.size());
+  stopped_threads.clear();
+  at_exec_stop = false;
+}
+
+void Process::stop() {
+  if (!running) {
+    throw std::runtime_error("Process is not running");
+  }
+  stop_threads();
 }
 
-long Process::read_memory(const std::string &symbol_name) {
-  errno = 0;
-  const elf64_sym_t *symbol = find_symbol(symbol_name);
-  long data = ptrace(PTRACE_PEEKDATA, pid,
-                     calculate_address(symbol->value) & ~0b111, nullptr);
-  if (errno != 0) {
-    throw std::runtime_error("Failed to read memory");
+uintptr_t Process::get_symbol_address(const std::string &symbol_name) {
+  return find_symbol(symbol_name).address;
+}
+
+ResolvedSymbol Process::resolve_region(const std::string &name) {
+  ResolvedSymbol region = find_symbol(name);
+  if (region.size == 0) {
+    throw std::invalid_argument("Region has no size: " + name);
   }
+  return region;
+}
 
-  uintptr_t offset = calculate_address(symbol->value) & 0b111;
-  data >>= (offset * 8);
-  long mask = (std::numeric_limits<long>::max()) >> (64 - symbol->size * 8);
-  data &= mask;
+Watch Process::resolve_watch(const std::string &symbol_name) {
+  ResolvedSymbol symbol = find_symbol(symbol_name);
+  if (symbol.size == 0 || symbol.size > max_watch_size) {
+    throw std::invalid_argument("Invalid size for watched variable: " +
+                                symbol_name);
+  }
+  Watch watch;
+  watch.address = symbol.address;
+  watch.word = watch.address & ~uintptr_t(sizeof(long) - 1);
+  watch.size = symbol.size;
+  watch.shift = (watch.address - watch.word) * 8;
+  watch.slots = 0;
+  watch.mask = watch.size >= sizeof(long)
+                   ? ~uint64_t(0)
+                   : (uint64_t(1) << (watch.size * 8)) - 1;
+  watch.last_value = 0;
+  watch.last_value = read_watch(watch);
+  return watch;
+}
 
+void Process::resolve_watches(
+    const std::vector<std::string> &names,
+    const std::function<void(size_t, Watch &)> &on_resolved,
+    unsigned workers) {
+  // Table each name is looked up in, the executable or a loaded object
+  constexpr size_t in_executable = SIZE_MAX;
+  std::vector<size_t> tables(names.size(), in_executable);
+  for (size_t i = 0; i < names.size(); ++i) {
+    size_t colon = find_object_separator(names[i]);
+    if (colon != std::string::npos) {
+      tables[i] = find_loaded_object(names[i].substr(0, colon));
+    }
+  }
+
+  // One task per table that isn't indexed yet. The executable's index is
+  // shared between copies, so it is simply built on a worker too.
+  SymbolLoader loader(workers);
+  std::unordered_map<size_t, size_t> table_tasks;
+  std::vector<size_t> task_tables;
+  std::vector<bool> waiting(names.size(), false);
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (tables[i] != in_executable && objects.is_resident(tables[i])) {
+      continue;
+    }
+    waiting[i] = true;
+    if (table_tasks.count(tables[i])) {
+      continue;
+    }
+    table_tasks[tables[i]] = tables[i] == in_executable
+                                 ? loader.add(executable)
+                                 : loader.add(objects.get_path(tables[i]));
+    task_tables.push_back(tables[i]);
+  }
+
+  // Names whose tables are in already go first, the others as soon as
+  // their own table is done, without waiting for the rest
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (!waiting[i]) {
+      Watch watch = resolve_watch(names[i]);
+      on_resolved(i, watch);
+    }
+  }
+  SymbolLoader::Result result;
+  while (loader.next(result)) {
+    if (!result.elf) {
+      throw std::runtime_error(result.error);
+    }
+    size_t table = task_tables[result.task];
+    if (table != in_executable) {
+      objects.adopt(table, std::move(result.elf));
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (waiting[i] && tables[i] == table) {
+        waiting[i] = false;
+        Watch watch = resolve_watch(names[i]);
+        on_resolved(i, watch);
+      }
+    }
+  }
+}
+
+long Process::read_watch(const Watch &watch) {
+  OverheadTimer timer(OverheadPhase::MemoryRead);
+  uint64_t word = 0;
+  if (watch.shift / 8 + watch.size > sizeof(word)) {
+    // Unaligned variable spilling into the next word, or a larger one
+    memory.read(watch.address, &word,
+                watch.size < sizeof(word) ? watch.size : sizeof(word));
+    return static_cast<long>(word);
+  }
+  memory.read(watch.word, &word, sizeof(word));
+  return static_cast<long>((word >> watch.shift) & watch.mask);
+}
+
+long Process::read_memory(const std::string &symbol_name) {
+  ResolvedSymbol symbol = find_symbol(symbol_name);
+  long data = 0;
+  size_t size = symbol.size < sizeof(data) ? symbol.size : sizeof(data);
+  memory.read(symbol.address, &data, size);
   return data;
 }
 
+void Process::read_memory(const MemoryRange *ranges, size_t count) {
+  OverheadTimer timer(OverheadPhase::MemoryRead);
+  memory.read(ranges, count);
+}
+
+void Process::read_memory(uintptr_t address, void *buffer, size_t size) {
+  OverheadTimer timer(OverheadPhase::MemoryRead);
+  memory.read(address, buffer, size);
+}
+
 // UNUSED function written for completeness
 void Process::write_memory(const std::string &symbol_name, long value) {
-  const elf64_sym_t *symbol = find_symbol(symbol_name);
-  if (ptrace(PTRACE_POKEDATA, pid, calculate_address(symbol->value), value) ==
-      -1) {
-    throw std::runtime_error("Failed to write memory");
-  }
+  ResolvedSymbol symbol = find_symbol(symbol_name);
+  size_t size = symbol.size < sizeof(value) ? symbol.size : sizeof(value);
+  memory.write(symbol.address, &value, size);
 }
 
 void Process::kill() {
   if (running) {
-    ptrace(PTRACE_KILL, pid, nullptr, nullptr);
-    waitpid(pid, nullptr, 0); // Wait for child to terminate
+    // Unlike PTRACE_KILL this also works after detaching
+    ::kill(pid, SIGKILL);
+    // Traced threads stay zombies until we reap them, and the main thread
+    // is only reported once all the others are gone
+    for (pid_t tid : threads) {
+      if (tid != pid) {
+        while (waitpid(tid, nullptr, __WALL) < 0 && errno == EINTR) {
+        }
+      }
+    }
+    waitpid(pid, nullptr, __WALL); // Wait for child to terminate
+    threads.clear();
+    stopped_threads.clear();
+    pending_stops.clear();
+    running = false;
+  }
+}
+
+void Process::detach() {
+  if (!running) {
+    throw std::runtime_error("Process is not running");
+  }
+  // Threads can only be detached while stopped
+  stop_threads();
+  // Stops already collected but not handed out yet
+  for (const auto &[tid, status] : pending_stops) {
+    if (WIFSTOPPED(status)) {
+      stopped_threads.insert(tid);
+    } else {
+      threads.erase(tid);
+    }
+  }
+  pending_stops.clear();
+
+  if (!guarded_pages.empty()) {
+    // Left guarded, the tracee would crash on its next access. Any stopped
+    // thread can make the call, the one we last saw may have exited since.
+    if (!stopped_threads.count(current_thread) ||
+        !threads.count(current_thread)) {
+      auto it = std::find_if(
+          stopped_threads.begin(), stopped_threads.end(),
+          [this](pid_t tid) { return threads.count(tid) != 0; });
+      if (it == stopped_threads.end()) {
+        throw std::runtime_error(
+            "No stopped thread left to restore guarded pages");
+      }
+      current_thread = *it;
+    }
+    for (const GuardedPage &page : guarded_pages) {
+      protect(page.address, page.original);
+    }
+  }
+  guarded_pages.clear();
+
+  for (pid_t tid : threads) {
+    ptrace(PTRACE_POKEUSER, tid, debug_register_offset(7), 0);
+    ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+  }
+  threads.clear();
+  stopped_threads.clear();
+  stray_stops.clear();
+  used_watchpoints = 0;
+  dr7 = 0;
+  if (attached) {
+    // Not our child, nothing left for us to reap
+    running = false;
+  }
+}
+
+bool Process::is_running() const { return running; }
+
+bool Process::is_attached() const { return attached; }
+
+bool Process::is_compat() const { return compat; }
+
+bool Process::has_exited() {
+  if (attached) {
+    // Not our child, so waitpid can't tell once we've detached
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line) || line.rfind(')') == std::string::npos) {
+      return true;
+    }
+    char state = line[line.rfind(')') + 2];
+    return state == 'Z' || state == 'X';
+  }
+  if (!running) {
+    return true;
+  }
+  for (const auto &[tid, status] : pending_stops) {
+    if (tid == pid && (WIFEXITED(status) || WIFSIGNALED(status))) {
+      // Reaped while stopping threads, before wait() got to it
+      running = false;
+      return true;
+    }
+  }
+  int status;
+  if (waitpid(pid, &status, WNOHANG) == pid &&
+      (WIFEXITED(status) || WIFSIGNALED(status))) {
     running = false;
   }
+  return !running;
+}
+
+uintptr_t Process::get_instruction_pointer() {
+  OverheadTimer timer(OverheadPhase::RegisterRead);
+  overhead.add_syscalls(1);
+  errno = 0;
+  long ip = ptrace(PTRACE_PEEKUSER, current_thread, offsetof(user, regs.rip),
+                   nullptr);
+  if (errno != 0) {
+    throw std::runtime_error("Failed to read instruction pointer");
+  }
+  return ip;
 }
 
+uintptr_t Process::get_load_base() const { return base_address; }
+
 Process::~Process() {
-  if (running) {
+  if (running && attached) {
+    detach();
+  } else if (running) {
     kill();
     running = false;
   }
+  for (auto it = owners.begin(); it != owners.end();) {
+    it = it->second == this ? owners.erase(it) : std::next(it);
+  }
 }
 
-void Process::set_watchpoint(const std::string &symbol_name, bool write_only) {
-  const elf64_sym_t *symbol = find_symbol(symbol_name);
-  long dr7 =
-      ptrace(PTRACE_PEEKUSER, pid, offsetof(user, u_debugreg[7]), nullptr);
-  dr7 |= 1; // Enable local breakpoint 0
+int Process::set_watchpoint(const std::string &symbol_name, bool write_only) {
+  ResolvedSymbol symbol = find_symbol(symbol_name);
+  unsigned slots = arm_watchpoint(symbol.address, symbol.size, write_only);
+  return __builtin_ctz(slots);
+}
 
-  int rw = write_only ? 1 : 3; // 1 for write, 3 for read/write
-  int len_bits;
-  switch (symbol->size) {
-  case 1:
-    len_bits = 0;
-    break;
-  case 2:
-    len_bits = 1;
-    break;
-  case 4:
-    len_bits = 3;
-    break;
-  case 8:
-    len_bits = 2;
-    break;
-  default:
+int Process::set_watchpoint(Watch &watch, bool write_only) {
+  watch.slots = arm_watchpoint(watch.address, watch.size, write_only);
+  return __builtin_ctz(watch.slots);
+}
+
+std::vector<WatchPiece> Process::split_watch(uintptr_t address,
+                                             size_t size) {
+  std::vector<WatchPiece> pieces;
+  uintptr_t end = address + size;
+  while (address < end) {
+    // Largest length the address is aligned to that doesn't overshoot
+    uint8_t length = 8;
+    while (address % length || address + length > end) {
+      length /= 2;
+    }
+    pieces.push_back({address, length});
+    address += length;
+  }
+  return pieces;
+}
+
+unsigned Process::arm_watchpoint(uintptr_t address, uint64_t size,
+                                 bool write_only) {
+  if (size == 0 || size > max_watch_size) {
     throw std::invalid_argument("Invalid length for watchpoint");
   }
-  // Clear RW + LEN bits for breakpoint 0
-  dr7 &= ~((0b11 << 16) | (0b11 << 18)); // clear RW0+LEN0
-  dr7 |= (rw << 16) | (len_bits << 18);
+  std::vector<WatchPiece> pieces = split_watch(address, size);
+  int free_slots = max_watchpoints - __builtin_popcount(used_watchpoints);
+  if (pieces.size() > static_cast<size_t>(free_slots)) {
+    throw std::runtime_error(
+        free_slots ? "Not enough free debug registers for watchpoint"
+                   : "No free debug register for watchpoint");
+  }
 
-  ptrace(PTRACE_POKEUSER, pid, offsetof(user, u_debugreg[0]),
-         calculate_address(symbol->value));
-  ptrace(PTRACE_POKEUSER, pid, offsetof(user, u_debugreg[7]), dr7);
+  int rw = write_only ? 1 : 3; // 1 for write, 3 for read/write
+  uintptr_t old_addresses[max_watchpoints];
+  std::copy(debug_addresses, debug_addresses + max_watchpoints,
+            old_addresses);
+  long old_dr7 = dr7;
+  unsigned slots = 0;
+  int slot = 0;
+  for (const WatchPiece &piece : pieces) {
+    while (used_watchpoints & (1 << slot)) {
+      ++slot;
+    }
+    int len_bits;
+    switch (piece.size) {
+    case 1:
+      len_bits = 0;
+      break;
+    case 2:
+      len_bits = 1;
+      break;
+    case 4:
+      len_bits = 3;
+      break;
+    default:
+      len_bits = 2;
+      break;
+    }
+    dr7 |= 1 << (slot * 2); // Enable local breakpoint
+    // Clear RW + LEN bits for the slot
+    dr7 &= ~(0b1111l << (16 + slot * 4));
+    dr7 |= (long)((len_bits << 2) | rw) << (16 + slot * 4);
+    debug_addresses[slot] = piece.address;
+    debug_sizes[slot] = piece.size;
+    slots |= 1 << slot;
+    ++slot;
+  }
+
+  try {
+    for (pid_t tid : threads) {
+      apply_debug_registers(tid);
+    }
+  } catch (const std::runtime_error &) {
+    std::copy(old_addresses, old_addresses + max_watchpoints,
+              debug_addresses);
+    dr7 = old_dr7;
+    throw;
+  }
+  used_watchpoints |= slots;
+  return slots;
+}
+
+WatchPiece Process::get_watchpoint_piece(int slot) const {
+  if (slot < 0 || slot >= max_watchpoints ||
+      !(used_watchpoints & (1 << slot))) {
+    throw std::out_of_range("Watchpoint slot not armed");
+  }
+  return {debug_addresses[slot], debug_sizes[slot]};
+}
+
+void Process::apply_debug_registers(pid_t tid) {
+  // DR7 last, so a slot is never enabled with a stale address
+  for (int slot = 0; slot < max_watchpoints; ++slot) {
+    if (debug_addresses[slot]) {
+      ptrace(PTRACE_POKEUSER, tid, debug_register_offset(slot),
+             debug_addresses[slot]);
+    }
+  }
+  if (ptrace(PTRACE_POKEUSER, tid, debug_register_offset(7), dr7) == -1) {
+    throw std::runtime_error("Failed to arm watchpoint in thread " +
+                             std::to_string(tid));
+  }
+}
+
+void Process::remove_watchpoint(int slot) {
+  if (slot < 0 || slot >= max_watchpoints) {
+    throw std::out_of_range("Watchpoint slot out of range");
+  }
+  long old_dr7 = dr7;
+  dr7 &= ~(0b11l << (slot * 2));
+  dr7 &= ~(0b1111l << (16 + slot * 4));
+  // Running threads can't be poked, stop them like set_watchpoint_enabled
+  stop_threads();
+  for (pid_t tid : threads) {
+    if (ptrace(PTRACE_POKEUSER, tid, debug_register_offset(7), dr7) == -1) {
+      dr7 = old_dr7;
+      throw std::runtime_error("Failed to disarm watchpoint in thread " +
+                               std::to_string(tid));
+    }
+  }
+  used_watchpoints &= ~(1 << slot);
+}
+
+void Process::set_watchpoint_enabled(int slot, bool enabled) {
+  if (slot < 0 || slot >= max_watchpoints ||
+      !(used_watchpoints & (1 << slot))) {
+    throw std::out_of_range("Watchpoint slot not armed");
+  }
+  long old_dr7 = dr7;
+  if (enabled) {
+    dr7 |= 1l << (slot * 2);
+  } else {
+    dr7 &= ~(1l << (slot * 2));
+  }
+  stop_threads();
+  for (pid_t tid : threads) {
+    if (ptrace(PTRACE_POKEUSER, tid, debug_register_offset(7), dr7) == -1) {
+      dr7 = old_dr7;
+      throw std::runtime_error("Failed to update watchpoint in thread " +
+                               std::to_string(tid));
+    }
+  }
+}
+
+bool Process::wait_thread(pid_t tid, int &status) {
+  while (true) {
+    pid_t result = waitpid(-1, &status, __WALL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (result == tid) {
+      return true;
+    }
+    queue_stop(result, status);
+  }
+}
+
+void Process::stop_threads() {
+  std::unordered_set<pid_t> queued;
+  for (const auto &stop : pending_stops) {
+    queued.insert(stop.first);
+  }
+  for (auto it = threads.begin(); it != threads.end();) {
+    pid_t tid = *it;
+    if (stopped_threads.count(tid) || queued.count(tid)) {
+      ++it;
+      continue;
+    }
+    if (attached) {
+      ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+    } else {
+      // PTRACE_INTERRUPT only works on seized threads
+      tgkill(pid, tid, SIGSTOP);
+    }
+    size_t already_queued = pending_stops.size();
+    int status;
+    if (!wait_thread(tid, status)) {
+      it = threads.erase(it);
+      continue;
+    }
+    for (size_t i = already_queued; i < pending_stops.size(); ++i) {
+      queued.insert(pending_stops[i].first);
+    }
+    bool ours = attached ? (status >> 16) == PTRACE_EVENT_STOP
+                         : WIFSTOPPED(status) && WSTOPSIG(status) == SIGSTOP;
+    if (ours) {
+      stopped_threads.insert(tid);
+    } else {
+      // Hit a watchpoint or exited before our stop got there
+      pending_stops.emplace_back(tid, status);
+      if (!attached && WIFSTOPPED(status)) {
+        stray_stops.insert(tid);
+      }
+    }
+    ++it;
+  }
+}
+
+unsigned Process::read_triggered_watchpoints() {
+  OverheadTimer timer(OverheadPhase::RegisterRead);
+  long dr6 = ptrace(PTRACE_PEEKUSER, current_thread, debug_register_offset(6),
+                    nullptr);
+  overhead.add_syscalls(1);
+  unsigned triggered = dr6 & used_watchpoints;
+  if (dr6 & 0b1111) {
+    ptrace(PTRACE_POKEUSER, current_thread, debug_register_offset(6), 0);
+    overhead.add_syscalls(1);
+  }
+  return triggered;
+}
+
+size_t Process::page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+long Process::inject_syscall(long number, long arg0, long arg1, long arg2) {
+  // No other thread may run into the patched instruction
+  stop_threads();
+  pid_t tid = current_thread;
+  user_regs_struct saved;
+  if (ptrace(PTRACE_GETREGS, tid, nullptr, &saved) == -1) {
+    throw std::runtime_error("Failed to read registers of thread " +
+                             std::to_string(tid));
+  }
+  errno = 0;
+  long code = ptrace(PTRACE_PEEKTEXT, tid, saved.rip, nullptr);
+  if (errno != 0) {
+    throw std::runtime_error("Failed to read code of thread " +
+                             std::to_string(tid));
+  }
+  user_regs_struct regs = saved;
+  regs.rax = number;
+  regs.orig_rax = -1; // Not in a syscall, nothing to restart
+  long patched;
+  if (compat) {
+    patched = (code & ~0xffffl) | 0x80cd; // int 0x80
+    regs.rbx = arg0;
+    regs.rcx = arg1;
+    regs.rdx = arg2;
+  } else {
+    patched = (code & ~0xffffl) | 0x050f; // syscall
+    regs.rdi = arg0;
+    regs.rsi = arg1;
+    regs.rdx = arg2;
+  }
+  ptrace(PTRACE_POKETEXT, tid, saved.rip, patched);
+  ptrace(PTRACE_SETREGS, tid, nullptr, &regs);
+
+  int deferred = 0;
+  while (true) {
+    ptrace(PTRACE_SINGLESTEP, tid, nullptr, nullptr);
+    int status;
+    if (!wait_thread(tid, status)) {
+      throw std::runtime_error("Failed to wait for injected syscall");
+    }
+    if (!WIFSTOPPED(status)) {
+      // Killed under us, there is nothing left to restore
+      pending_stops.emplace_back(tid, status);
+      throw std::runtime_error("Thread exited during injected syscall");
+    }
+    if (WSTOPSIG(status) == SIGTRAP) {
+      break;
+    }
+    // Arrived before the step, delivered once we're done
+    deferred = WSTOPSIG(status);
+  }
+  ptrace(PTRACE_GETREGS, tid, nullptr, &regs);
+  ptrace(PTRACE_POKETEXT, tid, saved.rip, code);
+  ptrace(PTRACE_SETREGS, tid, nullptr, &saved);
+  if (deferred) {
+    tgkill(pid, tid, deferred);
+  }
+  return compat ? long(int32_t(regs.rax)) : long(regs.rax);
+}
+
+void Process::protect(uintptr_t page, int protection) {
+  long number = compat ? 125 /* i386 mprotect */ : SYS_mprotect;
+  long result = inject_syscall(number, page, page_size(), protection);
+  if (result < 0) {
+    throw std::runtime_error("mprotect failed in the tracee: " +
+                             std::string(strerror(-result)));
+  }
+}
+
+void Process::guard_page(uintptr_t address, int protection) {
+  uintptr_t page = address & ~(page_size() - 1);
+  auto it = std::lower_bound(
+      guarded_pages.begin(), guarded_pages.end(), page,
+      [](const GuardedPage &a, uintptr_t b) { return a.address < b; });
+  if (it == guarded_pages.end() || it->address != page) {
+    address_space.refresh();
+    const Mapping *mapping = address_space.find(page);
+    if (!mapping) {
+      throw std::runtime_error("Address is not mapped: " +
+                               std::to_string(address));
+    }
+    it = guarded_pages.insert(
+        it, {page, protection, to_protection(mapping->permissions)});
+  }
+  protect(page, protection);
+  it->protection = protection;
+}
+
+const GuardedPage *Process::find_guarded_page(uintptr_t address) const {
+  uintptr_t page = address & ~(page_size() - 1);
+  auto it = std::lower_bound(
+      guarded_pages.begin(), guarded_pages.end(), page,
+      [](const GuardedPage &a, uintptr_t b) { return a.address < b; });
+  return it != guarded_pages.end() && it->address == page ? &*it : nullptr;
+}
+
+uintptr_t Process::get_fault_address() const { return fault_address; }
+
+void Process::step_over_fault() {
+  if (!fault_address) {
+    throw std::runtime_error("Current thread didn't fault on a guarded page");
+  }
+  // An unaligned access can span two pages, each faults on its own
+  std::vector<const GuardedPage *> opened;
+  const GuardedPage *page = find_guarded_page(fault_address);
+  int deferred = 0;
+  while (page) {
+    protect(page->address, page->original);
+    opened.push_back(page);
+    page = nullptr;
+    ptrace(PTRACE_SINGLESTEP, current_thread, nullptr, nullptr);
+    int status;
+    if (!wait_thread(current_thread, status)) {
+      throw std::runtime_error("Failed to wait for single-step");
+    }
+    if (!WIFSTOPPED(status)) {
+      pending_stops.emplace_back(current_thread, status);
+      stopped_threads.erase(current_thread);
+      fault_address = 0;
+      return; // wait() reports the exit
+    }
+    int sig = WSTOPSIG(status);
+    siginfo_t info;
+    if (sig == SIGSEGV &&
+        ptrace(PTRACE_GETSIGINFO, current_thread, nullptr, &info) == 0) {
+      page = find_guarded_page(reinterpret_cast<uintptr_t>(info.si_addr));
+      if (!page || std::find(opened.begin(), opened.end(), page) !=
+                       opened.end()) {
+        deferred = sig; // A real crash, let the tracee have it
+        page = nullptr;
+      }
+    } else if (sig != SIGTRAP) {
+      deferred = sig;
+      page = opened.back(); // Didn't get to run the instruction, retry
+      opened.pop_back();
+    }
+  }
+  for (const GuardedPage *guarded : opened) {
+    protect(guarded->address, guarded->protection);
+  }
+  if (deferred) {
+    tgkill(pid, current_thread, deferred);
+  }
+  fault_address = 0;
+}
+
+std::pair<pid_t, int> Process::next_stop() {
+  if (!pending_stops.empty()) {
+    // Collected earlier, handling it starts now
+    stop_started = overhead.start(OverheadPhase::StopDetection);
+  }
+  // Stops of other processes we trace go to their own queues
+  while (pending_stops.empty()) {
+    if (stop_listener) {
+      return {0, 0}; // Someone else waits for us
+    }
+    int status;
+    pid_t tid = waitpid(-1, &status, __WALL);
+    overhead.add_syscalls(1);
+    if (tid < 0) {
+      if (errno == EINTR) {
+        return {0, 0};
+      }
+      throw std::runtime_error("Failed to wait for process");
+    }
+    stop_started = overhead.start(OverheadPhase::StopDetection);
+    queue_stop(tid, status);
+    // Everything that stopped meanwhile is queued behind it
+    while ((tid = waitpid(-1, &status, __WALL | WNOHANG)) > 0) {
+      overhead.add_syscalls(1);
+      queue_stop(tid, status);
+    }
+    overhead.add_syscalls(1);
+  }
+  std::pair<pid_t, int> stop = pending_stops.front();
+  pending_stops.pop_front();
+  return stop;
+}
+
+Process *Process::find_owner(pid_t tid) {
+  auto it = owners.find(tid);
+  if (it != owners.end() && it->second->threads.count(tid)) {
+    return it->second;
+  }
+  // A new thread, or a thread id that was reused
+  it = owners.find(read_thread_group(tid));
+  if (it == owners.end() || it->second->pid != it->first) {
+    return nullptr;
+  }
+  owners[tid] = it->second;
+  return it->second;
+}
+
+void Process::queue_stop(pid_t tid, int status) {
+  Process *owner = threads.count(tid) ? this : find_owner(tid);
+  if (!owner || owner == this) {
+    pending_stops.emplace_back(tid, status);
+    return;
+  }
+  owner->pending_stops.emplace_back(tid, status);
+  if (owner->stop_listener) {
+    owner->stop_listener();
+  }
+}
+
+Process *Process::dispatch_stop(pid_t tid, int status) {
+  Process *owner = find_owner(tid);
+  if (owner) {
+    owner->pending_stops.emplace_back(tid, status);
+    if (owner->stop_listener) {
+      owner->stop_listener();
+    }
+  }
+  return owner;
+}
+
+void Process::set_stop_listener(std::function<void()> listener) {
+  stop_listener = std::move(listener);
 }
 
 bool Process::wait() {
   if (!running) {
     throw std::runtime_error("Process is not running");
   }
-  int status;
-  waitpid(pid, &status, 0);
-  if (WIFSTOPPED(status)) {
+  while (true) {
+    auto [tid, status] = next_stop();
+    if (tid == 0) {
+      return false; // Interrupted by a signal
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      threads.erase(tid);
+      stopped_threads.erase(tid);
+      if (tid == pid) {
+        // The main thread is reported last, once the whole group is gone
+        running = false; // Already reaped, the pid may be reused from now on
+        return false;
+      }
+      continue;
+    }
+    if (!WIFSTOPPED(status)) {
+      continue;
+    }
+
     int sig = WSTOPSIG(status);
+    int event = status >> 16;
+    if (sig == SIGTRAP && event == PTRACE_EVENT_CLONE) {
+      // The new thread reports its own first stop below
+      ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+      overhead.add_syscalls(1);
+      continue;
+    }
+    if (threads.find(tid) == threads.end()) {
+      // First stop of a new thread, SIGSTOP or PTRACE_EVENT_STOP if seized
+      threads.insert(tid);
+      apply_debug_registers(tid);
+      ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+      overhead.add_syscalls(1);
+      continue;
+    }
+    if (event == PTRACE_EVENT_STOP) {
+      // Group-stop or a leftover interrupt of a seized thread
+      ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+      overhead.add_syscalls(1);
+      continue;
+    }
+    if (sig == SIGSTOP && stray_stops.erase(tid)) {
+      // Late arrival of a stop we asked for in stop_threads()
+      ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+      overhead.add_syscalls(1);
+      continue;
+    }
     if (sig == SIGTRAP) {
       // This is nice, return
+      current_thread = tid;
+      stopped_threads.insert(tid);
+      fault_address = 0;
+      overhead.finish(OverheadPhase::StopDetection, stop_started);
       return true;
     }
-    throw std::runtime_error("Process stopped with signal: " +
-                             std::to_string(sig));
+    siginfo_t info;
+    bool guarded = false;
+    if (sig == SIGSEGV && !guarded_pages.empty()) {
+      overhead.add_syscalls(1);
+      guarded =
+          ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info) == 0 &&
+          info.si_code == SEGV_ACCERR &&
+          find_guarded_page(reinterpret_cast<uintptr_t>(info.si_addr));
+    }
+    if (guarded) {
+      // A guarded page, the signal is dropped when the thread is resumed
+      current_thread = tid;
+      stopped_threads.insert(tid);
+      fault_address = reinterpret_cast<uintptr_t>(info.si_addr);
+      overhead.finish(OverheadPhase::StopDetection, stop_started);
+      return true;
+    }
+    // Not ours, let the tracee handle it as if we weren't there
+    ptrace(PTRACE_CONT, tid, nullptr, sig);
+    overhead.add_syscalls(1);
   }
-  return false;
 }
 
-std::optional<uintptr_t> Process::get_base_address() {
-  std::string maps_path = "/proc/" + std::to_string(pid) + "/maps";
-  std::ifstream maps_file(maps_path);
-  if (!maps_file.is_open()) {
-    return std::nullopt;
+std::string Process::get_executable_path(pid_t pid) {
+  std::string exe_link = "/proc/" + std::to_string(pid) + "/exe";
+  char path[PATH_MAX];
+  ssize_t length = readlink(exe_link.c_str(), path, sizeof(path) - 1);
+  if (length < 0) {
+    throw std::runtime_error("Failed to find executable of process " +
+                             std::to_string(pid));
   }
-  std::string line;
-  // Get canonical path of the executable
-  std::string exe_path = canonicalize_path(executable.get_path());
-  while (std::getline(maps_file, line)) {
-    std::istringstream iss(line);
-    std::string address_range, perms, offset, dev, inode, pathname;
-    if (!(iss >> address_range >> perms >> offset >> dev >> inode)) {
-      continue;
-    }
-    std::getline(iss, pathname); // Get the rest of the line as pathname
-    pathname.erase(0, pathname.find_first_not_of(" \t"));
-    if (canonicalize_path(pathname) == exe_path) {
-      size_t dash_pos = address_range.find('-');
-      if (dash_pos != std::string::npos) {
-        std::string start_addr_str = address_range.substr(0, dash_pos);
-        uintptr_t start_addr = std::stoull(start_addr_str, nullptr, 16);
-        return start_addr;
-      }
-    }
+  return std::string(path, length);
+}
+
+std::optional<uint64_t> Process::read_entry_point() const {
+  if (compat) {
+    return address_space.read_auxv<ELFClass32>(AT_ENTRY);
+  }
+  return address_space.read_auxv<ELFClass64>(AT_ENTRY);
+}
+
+uintptr_t Process::get_base_address() {
+  if (!executable.is_pie()) {
+    return 0;
+  }
+  // The kernel tells us where it put the entry point, no parsing needed
+  if (std::optional<uint64_t> entry = read_entry_point()) {
+    return *entry - executable.get_entry();
   }
-  return std::nullopt;
+  address_space.refresh();
+  return address_space
+      .find_load_base(canonicalize_path(executable.get_path()))
+      .value_or(0);
 }
 
+AddressSpace &Process::get_address_space() { return address_space; }
+
 uintptr_t Process::calculate_address(uintptr_t addr) {
   if (executable.is_pie()) {
     return base_address + addr;
@@ -191,15 +1039,98 @@ uintptr_t Process::calculate_address(uintptr_t addr) {
   }
 }
 
-const elf64_sym_t *Process::find_symbol(const std::string &name) {
-  // Check in cache first
-  if (symbol_cache.find(name) != symbol_cache.end()) {
-    return &symbol_cache[name];
+ResolvedSymbol Process::find_symbol(const std::string &name) {
+  size_t colon = find_object_separator(name);
+
+  if (colon == std::string::npos) {
+    if (!name.empty() && name[0] == '.') {
+      const elf64_shdr_t *section = executable.find_section_header(name);
+      if (section && (section->flags & 0x2) /* SHF_ALLOC */) {
+        return ResolvedSymbol{calculate_address(section->addr), section->size};
+      }
+      throw std::runtime_error("Section not loaded: " + name);
+    }
+    const elf64_sym_t *symbol = executable.get_symbol(name);
+    if (symbol) {
+      return ResolvedSymbol{calculate_address(symbol->value), symbol->size};
+    }
+    throw std::runtime_error("Symbol not found: " + name);
+  }
+
+  std::string symbol_name = name.substr(colon + 1);
+  size_t object = find_loaded_object(name.substr(0, colon));
+  if (!symbol_name.empty() && symbol_name[0] == '.') {
+    std::optional<ResolvedSymbol> section =
+        objects.lookup_section(object, symbol_name);
+    if (!section) {
+      throw std::runtime_error("Section not loaded: " + name);
+    }
+    return *section;
+  }
+  std::optional<ResolvedSymbol> symbol = objects.lookup(object, symbol_name);
+  if (!symbol) {
+    throw std::runtime_error("Symbol not found: " + name);
+  }
+  // A global variable the executable defines too interposes the library's
+  // one, that is what copy relocations of library variables end up as
+  const elf64_sym_t *own = executable.get_symbol(symbol_name);
+  if (own && own->shndx != 0 && (own->info >> 4) == 1 /* STB_GLOBAL */ &&
+      (own->info & 0xf) == 1 /* STT_OBJECT */) {
+    return ResolvedSymbol{calculate_address(own->value), own->size};
+  }
+  return *symbol;
+}
+
+size_t Process::find_loaded_object(const std::string &name) {
+  address_space.refresh();
+  objects.update(address_space);
+  std::optional<size_t> object = objects.find_object(name);
+  if (!object && at_exec_stop) {
+    run_to_entry();
+    address_space.refresh();
+    objects.update(address_space);
+    object = objects.find_object(name);
   }
-  elf64_sym_t *symbol = executable.get_symbol(name);
-  if (symbol) {
-    symbol_cache[name] = *symbol;
-    return &symbol_cache[name];
+  if (!object) {
+    throw std::runtime_error("Object not loaded: " + name);
   }
-  throw std::runtime_error("Symbol not found: " + name);
+  return *object;
+}
+
+void Process::run_to_entry() {
+  std::optional<uint64_t> entry = read_entry_point();
+  if (!entry) {
+    throw std::runtime_error("Failed to find entry point");
+  }
+  uint8_t original;
+  uint8_t breakpoint = 0xCC; // int3
+  memory.read(*entry, &original, 1);
+  memory.write(*entry, &breakpoint, 1);
+
+  int signal = 0;
+  while (true) {
+    ptrace(PTRACE_CONT, pid, nullptr, signal);
+    signal = 0;
+    int status;
+    if (waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status)) {
+      running = false;
+      throw std::runtime_error("Process exited before its entry point");
+    }
+    if (WSTOPSIG(status) != SIGTRAP) {
+      signal = WSTOPSIG(status);
+    } else if ((status >> 16) == 0 &&
+               get_instruction_pointer() == *entry + 1) {
+      break;
+    } else if ((status >> 16) == 0) {
+      // Watchpoint hit inside the dynamic linker, not worth reporting
+      ptrace(PTRACE_POKEUSER, pid, debug_register_offset(6), 0);
+    }
+  }
+
+  memory.write(*entry, &original, 1);
+  user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+  regs.rip = *entry;
+  ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+  at_exec_stop = false;
 }
@@ -1,43 +1,231 @@
 #pragma once
+#include "address_space.h"
 #include "elf.h"
-#include <map>
+#include "loaded_objects.h"
+#include "remote_memory.h"
+#include "watch.h"
+#include <deque>
+#include <functional>
 #include <optional>
 #include <string>
 #include <sys/types.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 enum class ContidtionType { Read, Write, ReadWrite };
 
+// Page protected by guard_page(), accesses to it fault
+struct GuardedPage {
+  uintptr_t address;
+  int protection; // PROT_* while guarded
+  int original;   // PROT_* to restore
+};
+
 class Process {
   pid_t pid;
   ELF executable;
+  // A 32-bit x86 executable, its auxv and syscalls follow the i386 ABI
+  bool compat;
   std::vector<std::string> args;
   bool running;
+  // Attached to a process we didn't start, it must survive us
+  bool attached;
   uintptr_t base_address;
-  std::map<std::string, elf64_sym_t> symbol_cache;
+  // Bit n set when debug register DRn holds an armed watchpoint
+  uint8_t used_watchpoints;
+  // Debug register contents every thread gets, DR0-DR3 then DR7
+  uintptr_t debug_addresses[4];
+  long dr7;
+  // Length each of DR0-DR3 watches, in bytes
+  uint8_t debug_sizes[4];
+  RemoteMemory memory;
+  AddressSpace address_space;
+  ObjectTable objects;
+  // Still stopped right after exec, shared libraries aren't loaded yet
+  bool at_exec_stop;
+  // Every traced thread, the main one included
+  std::unordered_set<pid_t> threads;
+  // Thread whose stop was returned by the last wait()
+  pid_t current_thread;
+  // Threads in a ptrace stop we handed out, resumed by continue_execution
+  std::unordered_set<pid_t> stopped_threads;
+  // Stops collected by waitpid but not handled yet, oldest first
+  std::deque<std::pair<pid_t, int>> pending_stops;
+  // Threads with a SIGSTOP of ours still to come, it stopped for something
+  // else first
+  std::unordered_set<pid_t> stray_stops;
+  // Sorted by address
+  std::vector<GuardedPage> guarded_pages;
+  // Address the current thread faulted on in a guarded page, 0 if the last
+  // stop was a trap
+  uintptr_t fault_address;
+  // When the stop wait() is handling was seen, 0 unless it is sampled
+  uint64_t stop_started;
+  // Set when someone else waits for our stops, see set_stop_listener
+  std::function<void()> stop_listener;
+  // Process of each thread seen so far, across all instances, so that a
+  // wait for any child can hand stops to whoever traces the thread.
+  // Entries may be stale, they are checked against the owner's threads.
+  static std::unordered_map<pid_t, Process *> owners;
 
 public:
   Process(const ELF &executable, const std::vector<std::string> &&args);
+  Process(const Process &) = delete;
+  Process &operator=(const Process &) = delete;
 
   pid_t get_pid() const;
+  // Thread that caused the last stop returned by wait()
+  pid_t get_current_thread() const;
+  size_t get_thread_count() const;
+  const std::unordered_set<pid_t> &get_threads() const;
   void spawn();
+  // Attaches to every thread of a running process with PTRACE_SEIZE and
+  // leaves them stopped, like spawn() does
+  void attach(pid_t target);
+  // Resumes the thread that caused the last stop (all threads after attach)
   void continue_execution();
+  // Stops every thread, e.g. to read a consistent view of memory.
+  // continue_execution() resumes them, other stops that arrived meanwhile
+  // are handed out by wait().
+  void stop();
   void kill();
+  // Clears the watchpoints and stops tracing, the process keeps running on
+  // its own
+  void detach();
+  bool is_running() const;
+  bool is_attached() const;
+  // 32-bit x86 tracee
+  bool is_compat() const;
+  // Non-blocking check for exit, usable once detached
+  bool has_exited();
+
+  // Of the current thread
+  uintptr_t get_instruction_pointer();
+  // Load base of the executable found at spawn/attach, 0 for non-PIE ones
+  uintptr_t get_load_base() const;
+  // Mappings as of the last refresh
+  AddressSpace &get_address_space();
+
+  // Symbol names are either "symbol", searched in the executable, or
+  // "object:symbol" for a symbol of a loaded shared object, e.g.
+  // "libfoo.so:counter". Names starting with '.' are sections instead, e.g.
+  // ".bss" or "libfoo.so:.bss".
+
+  // Address of the symbol in the running process
+  uintptr_t get_symbol_address(const std::string &symbol_name);
+  // Address and size of a symbol or section, however large
+  ResolvedSymbol resolve_region(const std::string &name);
+
+  // Resolves a variable into a descriptor, reading its current value
+  Watch resolve_watch(const std::string &symbol_name);
+  // Resolves many variables at once. The symbol tables of the executable
+  // and of every object named are loaded and indexed on `workers` threads
+  // (0 for one per CPU). on_resolved(i, watch) is called on this thread
+  // for names[i] as soon as its own table is ready, e.g. to arm it.
+  void resolve_watches(const std::vector<std::string> &names,
+                       const std::function<void(size_t, Watch &)> &on_resolved,
+                       unsigned workers = 0);
+  // Current value of a watched variable, a single read with no lookups
+  long read_watch(const Watch &watch);
 
   long read_memory(const std::string &symbol_name);
+  // Reads all ranges in as few syscalls as possible
+  void read_memory(const MemoryRange *ranges, size_t count);
+  void read_memory(uintptr_t address, void *buffer, size_t size);
   // UNUSED function written for completeness
   void write_memory(const std::string &symbol_name, long value);
 
-  void set_watchpoint(const std::string &symbol_name, bool write_only);
+  static constexpr int max_watchpoints = 4; // DR0-DR3
+
+  // Arms free debug registers, one per piece of the variable (one for
+  // aligned variables of 1, 2, 4 or 8 bytes), returns the first slot (0-3)
+  // Throws if there aren't enough free slots
+  int set_watchpoint(const std::string &symbol_name, bool write_only);
+  // Same as above, also records the slots in the descriptor
+  int set_watchpoint(Watch &watch, bool write_only);
+  void remove_watchpoint(int slot);
+  // Range an armed slot watches
+  WatchPiece get_watchpoint_piece(int slot) const;
+  // Splits a range into the fewest aligned 1, 2, 4 or 8 byte pieces, the
+  // only ranges a debug register can watch
+  static std::vector<WatchPiece> split_watch(uintptr_t address, size_t size);
+  // Sets or clears the enable bit of an armed slot in DR7, keeping the rest
+  // of its setup. Every thread is stopped to get the new DR7, they are
+  // resumed by continue_execution().
+  void set_watchpoint_enabled(int slot, bool enabled);
+  // Bitmask of slots that fired in the current thread, read from its DR6
+  // DR6 is cleared afterwards, as the hardware never does it by itself
+  unsigned read_triggered_watchpoints();
+
+  // Software watchpoints. Pages are protected by making the tracee call
+  // mprotect, every thread is stopped while it does. Accesses the protection
+  // forbids stop the thread with a SIGSEGV, which wait() reports like a
+  // trap. Guarded pages get their protection back on detach.
+  static size_t page_size();
+  // Protects the page containing `address`, `protection` is PROT_*
+  void guard_page(uintptr_t address, int protection);
+  const GuardedPage *find_guarded_page(uintptr_t address) const;
+  // Address of the access the current thread faulted on, 0 for other stops
+  uintptr_t get_fault_address() const;
+  // Lets the current thread finish the faulting access with the pages it
+  // touches unprotected, other threads stay stopped. The pages are guarded
+  // again afterwards.
+  void step_over_fault();
 
+  // Waits for any thread to stop, new threads get the watchpoints applied
+  // Stops are handled in the order they happened, so a thread that stops
+  // all the time can't starve the others
+  // Signals other than SIGTRAP are passed on to the tracee
   // Returns true if process hasn't exited yet
-  // Throws if process stopped with a signal other than SIGTRAP
-  // Returns false if process has exited
+  // Returns false if process has exited or a signal interrupted the wait
   bool wait();
 
+  // Hands waiting over to the caller, e.g. a Session tracing several
+  // processes: wait() then only handles stops already queued, and returns
+  // false with the process still running when there are none. `listener` is
+  // called whenever a stop of ours is queued.
+  void set_stop_listener(std::function<void()> listener);
+  // Queues a stop collected by a wait for any child on the process tracing
+  // the thread. Returns that process, nullptr if no one traces it.
+  static Process *dispatch_stop(pid_t tid, int status);
+
+  // Path of the executable a running process was started from
+  static std::string get_executable_path(pid_t pid);
+
   ~Process();
 
 private:
-  std::optional<uintptr_t> get_base_address();
+  // AT_ENTRY from the auxiliary vector
+  std::optional<uint64_t> read_entry_point() const;
+  // Load base of the executable, 0 for non-PIE ones
+  uintptr_t get_base_address();
   uintptr_t calculate_address(uintptr_t addr);
-  const elf64_sym_t *find_symbol(const std::string &name);
+  // Returns the slots used, bit n for DRn
+  unsigned arm_watchpoint(uintptr_t address, uint64_t size, bool write_only);
+  // Writes the debug registers into a stopped thread
+  void apply_debug_registers(pid_t tid);
+  // Runs a syscall in the current thread by pointing it at a syscall
+  // instruction written over its current one, everything is restored after.
+  // Returns what the syscall returned, -errno on failure.
+  long inject_syscall(long number, long arg0, long arg1, long arg2);
+  // mprotect in the tracee, throws on failure
+  void protect(uintptr_t page, int protection);
+  // Blocks until `tid` reports, stops and exits of other threads meanwhile
+  // are queued for wait(). A thread group leader only reports its exit once
+  // the others are reaped, waiting for it alone could block forever.
+  bool wait_thread(pid_t tid, int &status);
+  // Stops every running thread. Stops that weren't the one we asked for are
+  // queued for wait() to handle.
+  void stop_threads();
+  // Next stop, queued ones first, otherwise blocks for one and queues all
+  // others that are already waiting
+  std::pair<pid_t, int> next_stop();
+  // Queues a stop on the process tracing the thread, ourselves if unknown
+  void queue_stop(pid_t tid, int status);
+  static Process *find_owner(pid_t tid);
+  ResolvedSymbol find_symbol(const std::string &name);
+  size_t find_loaded_object(const std::string &name);
+  // Lets the dynamic linker load the libraries, stopping at the entry point
+  void run_to_entry();
 };
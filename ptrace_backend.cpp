@@ -0,0 +1,155 @@
+#include "ptrace_backend.h"
+#include <csignal>
+#include <sys/time.h>
+#include <time.h>
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static volatile sig_atomic_t rearm_timer_fired = 0;
+
+static void handle_rearm_timer(int) { rearm_timer_fired = 1; }
+
+// Fires after `delay_ns`, then every retry interval in case the signal came
+// just before we blocked in waitpid and didn't interrupt it. 0 cancels.
+static void set_timer(uint64_t delay_ns) {
+  itimerval timer = {};
+  if (delay_ns) {
+    timer.it_interval.tv_usec = 10000;
+  }
+  timer.it_value.tv_sec = delay_ns / 1000000000;
+  timer.it_value.tv_usec = (delay_ns % 1000000000) / 1000;
+  if (delay_ns && timer.it_value.tv_sec == 0 && timer.it_value.tv_usec == 0) {
+    timer.it_value.tv_usec = 1;
+  }
+  setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+PtraceBackend::PtraceBackend(Process &process)
+    : process(process), watches(), slot_watch(), pending(0), stopped(true),
+      throttle(), stop_start_ns(0), stop_slots(0) {}
+
+PtraceBackend::~PtraceBackend() {
+  if (throttle.is_enabled()) {
+    set_timer(0);
+  }
+}
+
+void PtraceBackend::set_budget(const WatchBudget &budget) {
+  throttle = Throttle(budget);
+  if (throttle.is_enabled()) {
+    // Without SA_RESTART, so that the timer gets us out of waitpid
+    struct sigaction action = {};
+    action.sa_handler = handle_rearm_timer;
+    sigaction(SIGALRM, &action, nullptr);
+  }
+}
+
+uint32_t PtraceBackend::arm(const Watch &watch, bool write_only) {
+  watches.push_back(watch);
+  process.set_watchpoint(watches.back(), write_only);
+  for (unsigned slots = watches.back().slots; slots; slots &= slots - 1) {
+    slot_watch[__builtin_ctz(slots)] = watches.size() - 1;
+  }
+  throttle.add_watch(monotonic_ns());
+  return watches.size() - 1;
+}
+
+void PtraceBackend::account_stop() {
+  if (!throttle.is_enabled() || !stop_slots) {
+    return;
+  }
+  uint64_t now = monotonic_ns();
+  bool throttled = false;
+  while (stop_slots) {
+    // A watch split over several slots is charged once per stop
+    uint32_t index = slot_watch[__builtin_ctz(stop_slots)];
+    stop_slots &= ~watches[index].slots;
+    if (throttle.record_hit(index, now, now - stop_start_ns)) {
+      set_enabled(watches[index], false);
+      throttled = true;
+    }
+  }
+  stop_slots = 0;
+  if (throttled) {
+    schedule_rearm();
+  }
+}
+
+void PtraceBackend::set_enabled(const Watch &watch, bool enabled) {
+  for (unsigned slots = watch.slots; slots; slots &= slots - 1) {
+    process.set_watchpoint_enabled(__builtin_ctz(slots), enabled);
+  }
+}
+
+void PtraceBackend::rearm_due() {
+  uint32_t index;
+  while (throttle.take_due(monotonic_ns(), index)) {
+    set_enabled(watches[index], true);
+  }
+  schedule_rearm();
+}
+
+void PtraceBackend::schedule_rearm() {
+  uint64_t next = throttle.next_rearm();
+  uint64_t now = monotonic_ns();
+  set_timer(!next ? 0 : next > now ? next - now : 1);
+}
+
+bool PtraceBackend::next_event(WatchEvent &event) {
+  // A single instruction can touch several watched variables at once
+  while (!pending) {
+    if (rearm_timer_fired) {
+      // Re-arming stops every thread
+      rearm_timer_fired = 0;
+      rearm_due();
+      stopped = true;
+    }
+    if (stopped) {
+      account_stop();
+      process.continue_execution();
+      stopped = false;
+    }
+    if (!process.wait()) {
+      if (rearm_timer_fired && process.is_running()) {
+        continue;
+      }
+      return false;
+    }
+    stopped = true;
+    stop_start_ns = monotonic_ns();
+    pending = process.read_triggered_watchpoints();
+    stop_slots = pending;
+  }
+
+  int slot = __builtin_ctz(pending);
+  const Watch &watch = watches[slot_watch[slot]];
+  event.watch = slot_watch[slot];
+  event.tid = process.get_current_thread();
+  event.ip = process.get_instruction_pointer();
+  event.time_ns = stop_start_ns;
+  if (watch.size <= sizeof(long)) {
+    // Small variables are reported whole, however many pieces fired
+    pending &= ~watch.slots;
+    event.offset = 0;
+    event.size = watch.size;
+    event.value = process.read_watch(watch);
+  } else {
+    // DR6 says which piece was touched
+    pending &= pending - 1;
+    WatchPiece piece = process.get_watchpoint_piece(slot);
+    uint64_t value = 0;
+    process.read_memory(piece.address, &value, piece.size);
+    event.offset = piece.address - watch.address;
+    event.size = piece.size;
+    event.value = static_cast<long>(value);
+  }
+  return true;
+}
+
+const Throttle &PtraceBackend::get_throttle() const { return throttle; }
+
+bool PtraceBackend::has_finished() const { return !process.is_running(); }
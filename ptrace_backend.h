@@ -0,0 +1,43 @@
+#pragma once
+#include "process.h"
+#include "throttle.h"
+#include "watch.h"
+#include <vector>
+
+// Hits are hardware watchpoints delivered as ptrace stops
+class PtraceBackend : public WatchBackend {
+  Process &process;
+  std::vector<Watch> watches;
+  uint32_t slot_watch[Process::max_watchpoints];
+  // Slots that fired in the current stop and haven't been reported yet
+  unsigned pending;
+  bool stopped;
+  Throttle throttle;
+  // Start of the current stop and the slots that caused it
+  uint64_t stop_start_ns;
+  unsigned stop_slots;
+
+  // Charges the stop that is about to end to its watches, disarming the
+  // ones that went over budget
+  void account_stop();
+  // Sets the enable bit of every slot of a watch
+  void set_enabled(const Watch &watch, bool enabled);
+  // Re-arms throttled watches that are due and sets the timer for the next
+  void rearm_due();
+  void schedule_rearm();
+
+public:
+  explicit PtraceBackend(Process &process);
+  PtraceBackend(const PtraceBackend &) = delete;
+  PtraceBackend &operator=(const PtraceBackend &) = delete;
+  ~PtraceBackend() override;
+
+  // Watches that cost more than this are disarmed for a while, call before
+  // arming any. Re-arming is driven by SIGALRM, so the caller must not use
+  // it for anything else.
+  void set_budget(const WatchBudget &budget);
+  uint32_t arm(const Watch &watch, bool write_only) override;
+  bool next_event(WatchEvent &event) override;
+  bool has_finished() const override;
+  const Throttle &get_throttle() const;
+};
@@ -0,0 +1,161 @@
+#include "remote_memory.h"
+#include "overhead.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Kernel limit on iovecs per process_vm_readv/writev call
+static constexpr size_t max_iovecs = IOV_MAX;
+
+static size_t page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+RemoteMemory::RemoteMemory(pid_t pid) : pid(pid), vm_calls_supported(true) {}
+
+pid_t RemoteMemory::get_pid() const { return pid; }
+
+// Transfers a prefix of the ranges, returns how many were fully transferred
+size_t RemoteMemory::transfer_vm(const MemoryRange *ranges, size_t count,
+                                 bool write) {
+  if (!vm_calls_supported) {
+    return 0;
+  }
+  iovec local[max_iovecs];
+  iovec remote[max_iovecs];
+  count = count < max_iovecs ? count : max_iovecs;
+  for (size_t i = 0; i < count; ++i) {
+    local[i] = {ranges[i].buffer, ranges[i].size};
+    remote[i] = {reinterpret_cast<void *>(ranges[i].address), ranges[i].size};
+  }
+
+  ssize_t done = write ? process_vm_writev(pid, local, count, remote, count, 0)
+                       : process_vm_readv(pid, local, count, remote, count, 0);
+  overhead.add_syscalls(1);
+  if (!write && done > 0) {
+    overhead.add_bytes_read(done);
+  }
+  if (done < 0) {
+    if (errno == ENOSYS) {
+      vm_calls_supported = false;
+    }
+    return 0;
+  }
+  // Partial transfers never split an iovec element
+  size_t complete = 0;
+  size_t bytes = static_cast<size_t>(done);
+  while (complete < count && ranges[complete].size <= bytes) {
+    bytes -= ranges[complete].size;
+    ++complete;
+  }
+  return complete;
+}
+
+// Moves a range the fast calls refused, page by page, so that only the
+// pages they can't handle are done a word at a time through ptrace
+void RemoteMemory::transfer_fallback(const MemoryRange &range, bool write) {
+  uintptr_t address = range.address;
+  uint8_t *buffer = static_cast<uint8_t *>(range.buffer);
+  size_t left = range.size;
+  while (left > 0) {
+    size_t chunk = page_size() - (address & (page_size() - 1));
+    chunk = chunk < left ? chunk : left;
+    MemoryRange page{address, buffer, chunk};
+    if (transfer_vm(&page, 1, write) != 1) {
+      if (write) {
+        write_ptrace(address, buffer, chunk);
+      } else {
+        read_ptrace(address, buffer, chunk);
+      }
+    }
+    address += chunk;
+    buffer += chunk;
+    left -= chunk;
+  }
+}
+
+void RemoteMemory::read_ptrace(uintptr_t address, uint8_t *buffer,
+                               size_t size) const {
+  while (size > 0) {
+    uintptr_t word_address = address & ~uintptr_t(sizeof(long) - 1);
+    size_t offset = address - word_address;
+    errno = 0;
+    long word = ptrace(PTRACE_PEEKDATA, pid, word_address, nullptr);
+    overhead.add_syscalls(1);
+    if (errno != 0) {
+      throw std::runtime_error("Failed to read memory at " +
+                               std::to_string(address));
+    }
+    size_t chunk = sizeof(long) - offset;
+    chunk = chunk < size ? chunk : size;
+    overhead.add_bytes_read(chunk);
+    std::memcpy(buffer, reinterpret_cast<uint8_t *>(&word) + offset, chunk);
+    address += chunk;
+    buffer += chunk;
+    size -= chunk;
+  }
+}
+
+void RemoteMemory::write_ptrace(uintptr_t address, const uint8_t *buffer,
+                                size_t size) const {
+  while (size > 0) {
+    uintptr_t word_address = address & ~uintptr_t(sizeof(long) - 1);
+    size_t offset = address - word_address;
+    size_t chunk = sizeof(long) - offset;
+    chunk = chunk < size ? chunk : size;
+    long word = 0;
+    if (chunk != sizeof(long)) {
+      // Keep the neighbouring bytes of a partial word intact
+      errno = 0;
+      word = ptrace(PTRACE_PEEKDATA, pid, word_address, nullptr);
+      if (errno != 0) {
+        throw std::runtime_error("Failed to write memory at " +
+                                 std::to_string(address));
+      }
+    }
+    std::memcpy(reinterpret_cast<uint8_t *>(&word) + offset, buffer, chunk);
+    if (ptrace(PTRACE_POKEDATA, pid, word_address, word) == -1) {
+      throw std::runtime_error("Failed to write memory at " +
+                               std::to_string(address));
+    }
+    address += chunk;
+    buffer += chunk;
+    size -= chunk;
+  }
+}
+
+void RemoteMemory::transfer(const MemoryRange *ranges, size_t count,
+                            bool write) {
+  size_t next = 0;
+  while (next < count) {
+    next += transfer_vm(ranges + next, count - next, write);
+    if (next < count) {
+      transfer_fallback(ranges[next], write);
+      ++next;
+    }
+  }
+}
+
+void RemoteMemory::read(const MemoryRange *ranges, size_t count) {
+  transfer(ranges, count, false);
+}
+
+void RemoteMemory::read(uintptr_t address, void *buffer, size_t size) {
+  MemoryRange range{address, buffer, size};
+  transfer(&range, 1, false);
+}
+
+void RemoteMemory::write(const MemoryRange *ranges, size_t count) {
+  transfer(ranges, count, true);
+}
+
+void RemoteMemory::write(uintptr_t address, const void *buffer, size_t size) {
+  MemoryRange range{address, const_cast<void *>(buffer), size};
+  transfer(&range, 1, true);
+}
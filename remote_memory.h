@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// One contiguous piece of tracee memory and its local counterpart
+struct MemoryRange {
+  uintptr_t address;
+  void *buffer;
+  size_t size;
+};
+
+// Bulk access to another process' memory. Scattered ranges are moved with
+// as few process_vm_readv/process_vm_writev calls as possible. Pages those
+// refuse (e.g. PROT_NONE, or read-only pages on write) go through ptrace,
+// which needs the process to be traced by us and stopped.
+class RemoteMemory {
+  pid_t pid;
+  // Cleared when the kernel lacks process_vm_readv/writev
+  bool vm_calls_supported;
+
+  size_t transfer_vm(const MemoryRange *ranges, size_t count, bool write);
+  void transfer_fallback(const MemoryRange &range, bool write);
+  void read_ptrace(uintptr_t address, uint8_t *buffer, size_t size) const;
+  void write_ptrace(uintptr_t address, const uint8_t *buffer,
+                    size_t size) const;
+  void transfer(const MemoryRange *ranges, size_t count, bool write);
+
+public:
+  explicit RemoteMemory(pid_t pid = 0);
+  pid_t get_pid() const;
+
+  // Throw std::runtime_error if any byte can't be transferred
+  void read(const MemoryRange *ranges, size_t count);
+  void read(uintptr_t address, void *buffer, size_t size);
+  void write(const MemoryRange *ranges, size_t count);
+  void write(uintptr_t address, const void *buffer, size_t size);
+};
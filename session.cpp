@@ -0,0 +1,88 @@
+#include "session.h"
+#include "overhead.h"
+#include <cerrno>
+#include <stdexcept>
+#include <sys/wait.h>
+
+Session::Session() : tracees(), ready(), live(0) {}
+
+size_t Session::add(std::unique_ptr<Process> process) {
+  size_t index = tracees.size();
+  process->set_stop_listener([this, index] { mark_ready(index); });
+  auto backend = std::make_unique<PtraceBackend>(*process);
+  tracees.push_back({std::move(process), std::move(backend), false, false});
+  ++live;
+  // Stopped, the first next_event resumes it
+  mark_ready(index);
+  return index;
+}
+
+size_t Session::get_tracee_count() const { return tracees.size(); }
+
+Process &Session::get_process(size_t index) {
+  return *tracees.at(index).process;
+}
+
+PtraceBackend &Session::get_backend(size_t index) {
+  return *tracees.at(index).backend;
+}
+
+void Session::mark_ready(size_t index) {
+  Tracee &tracee = tracees[index];
+  if (!tracee.ready && !tracee.finished) {
+    tracee.ready = true;
+    ready.push_back(index);
+  }
+}
+
+bool Session::collect() {
+  int status;
+  pid_t tid = waitpid(-1, &status, __WALL);
+  overhead.add_syscalls(1);
+  if (tid < 0) {
+    if (errno == EINTR) {
+      return false;
+    }
+    throw std::runtime_error("Failed to wait for tracees");
+  }
+  // The owner's listener puts it in the ready queue
+  do {
+    Process::dispatch_stop(tid, status);
+    overhead.add_syscalls(1);
+  } while ((tid = waitpid(-1, &status, __WALL | WNOHANG)) > 0);
+  return true;
+}
+
+bool Session::next_event(size_t &index, WatchEvent &event) {
+  while (live > 0) {
+    while (!ready.empty()) {
+      Tracee &tracee = tracees[ready.front()];
+      // Handles the queued stops, resumes the tracee once they are done
+      if (tracee.backend->next_event(event)) {
+        // Stays at the front, a stop can report several watches
+        index = ready.front();
+        return true;
+      }
+      tracee.ready = false;
+      ready.pop_front();
+      if (tracee.backend->has_finished()) {
+        tracee.finished = true;
+        --live;
+      }
+    }
+    if (live == 0 || !collect()) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool Session::has_finished() const { return live == 0; }
+
+void Session::detach() {
+  for (Tracee &tracee : tracees) {
+    if (tracee.process->is_running() && tracee.process->is_attached()) {
+      tracee.process->detach();
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "process.h"
+#include "ptrace_backend.h"
+#include "watch.h"
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Several tracees watched with the ptrace backend from one event loop. A
+// single wait for any child collects the stops of all of them, each stop is
+// queued on the Process tracing the thread, and only tracees with queued
+// stops are looked at. The loop costs follow the hits, not the number of
+// tracees.
+class Session {
+  struct Tracee {
+    std::unique_ptr<Process> process;
+    std::unique_ptr<PtraceBackend> backend;
+    bool ready; // In the ready queue
+    bool finished;
+  };
+
+  std::vector<Tracee> tracees;
+  // Tracees with stops to handle or to be resumed, oldest first
+  std::deque<size_t> ready;
+  size_t live;
+
+  void mark_ready(size_t index);
+  // Blocks for the next stop of any tracee and queues everything that has
+  // stopped, false if a signal interrupted the wait
+  bool collect();
+
+public:
+  Session();
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  // Takes a spawned or attached process, stopped as both leave it
+  size_t add(std::unique_ptr<Process> process);
+  size_t get_tracee_count() const;
+  Process &get_process(size_t index);
+  // Watches of a tracee are armed through its backend
+  PtraceBackend &get_backend(size_t index);
+
+  // Next hit of any tracee, in the order their stops arrived
+  // Returns false once every tracee has exited or a signal interrupted us
+  bool next_event(size_t &tracee, WatchEvent &event);
+  // Whether every tracee has exited
+  bool has_finished() const;
+  // Detaches from the attached tracees that are still running
+  void detach();
+};
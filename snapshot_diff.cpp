@@ -0,0 +1,144 @@
+#include "snapshot_diff.h"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Bytes compared at once before looking at single words
+static constexpr size_t block_size = 128;
+
+static uint64_t load_word(const uint8_t *p) {
+  uint64_t word;
+  std::memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// Word by word over [begin, end), which is only a few blocks at most
+static void diff_words(const uint8_t *old, const uint8_t *current,
+                       size_t begin, size_t end, std::vector<size_t> &changed) {
+  size_t offset = begin;
+  for (; offset + 8 <= end; offset += 8) {
+    if (load_word(old + offset) != load_word(current + offset)) {
+      changed.push_back(offset);
+    }
+  }
+  if (offset < end &&
+      std::memcmp(old + offset, current + offset, end - offset) != 0) {
+    changed.push_back(offset);
+  }
+}
+
+static void diff_scalar(const uint8_t *old, const uint8_t *current,
+                        size_t size, std::vector<size_t> &changed) {
+  size_t offset = 0;
+  for (; offset + block_size <= size; offset += block_size) {
+    uint64_t difference = 0;
+    for (size_t i = 0; i < block_size; i += 8) {
+      difference |=
+          load_word(old + offset + i) ^ load_word(current + offset + i);
+    }
+    if (difference) {
+      diff_words(old, current, offset, offset + block_size, changed);
+    }
+  }
+  diff_words(old, current, offset, size, changed);
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, no check needed
+static void diff_sse2(const uint8_t *old, const uint8_t *current, size_t size,
+                      std::vector<size_t> &changed) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t offset = 0;
+  for (; offset + block_size <= size; offset += block_size) {
+    __m128i difference = zero;
+    for (size_t i = 0; i < block_size; i += 16) {
+      __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(old + offset + i));
+      __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(current + offset + i));
+      difference = _mm_or_si128(difference, _mm_xor_si128(a, b));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(difference, zero)) != 0xffff) {
+      diff_words(old, current, offset, offset + block_size, changed);
+    }
+  }
+  diff_words(old, current, offset, size, changed);
+}
+
+__attribute__((target("avx2"))) static void
+diff_avx2(const uint8_t *old, const uint8_t *current, size_t size,
+          std::vector<size_t> &changed) {
+  size_t offset = 0;
+  for (; offset + block_size <= size; offset += block_size) {
+    __m256i difference = _mm256_setzero_si256();
+    for (size_t i = 0; i < block_size; i += 32) {
+      __m256i a = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(old + offset + i));
+      __m256i b = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(current + offset + i));
+      difference = _mm256_or_si256(difference, _mm256_xor_si256(a, b));
+    }
+    if (!_mm256_testz_si256(difference, difference)) {
+      diff_words(old, current, offset, offset + block_size, changed);
+    }
+  }
+  diff_words(old, current, offset, size, changed);
+}
+#endif
+
+bool diff_kernel_supported(DiffKernel kernel) {
+  switch (kernel) {
+  case DiffKernel::Scalar:
+    return true;
+#if defined(__x86_64__)
+  case DiffKernel::SSE2:
+    return true;
+  case DiffKernel::AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+DiffKernel best_diff_kernel() {
+  static const DiffKernel kernel =
+      diff_kernel_supported(DiffKernel::AVX2)   ? DiffKernel::AVX2
+      : diff_kernel_supported(DiffKernel::SSE2) ? DiffKernel::SSE2
+                                                : DiffKernel::Scalar;
+  return kernel;
+}
+
+const char *diff_kernel_name(DiffKernel kernel) {
+  switch (kernel) {
+  case DiffKernel::SSE2:
+    return "sse2";
+  case DiffKernel::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+void diff_snapshots(DiffKernel kernel, const uint8_t *old,
+                    const uint8_t *current, size_t size,
+                    std::vector<size_t> &changed) {
+  switch (kernel) {
+#if defined(__x86_64__)
+  case DiffKernel::SSE2:
+    diff_sse2(old, current, size, changed);
+    return;
+  case DiffKernel::AVX2:
+    diff_avx2(old, current, size, changed);
+    return;
+#endif
+  default:
+    diff_scalar(old, current, size, changed);
+  }
+}
+
+void diff_snapshots(const uint8_t *old, const uint8_t *current, size_t size,
+                    std::vector<size_t> &changed) {
+  diff_snapshots(best_diff_kernel(), old, current, size, changed);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compares two snapshots of the same memory. Unchanged memory is skipped
+// 128 bytes at a time, only blocks that differ are looked at word by word.
+enum class DiffKernel : uint8_t { Scalar, SSE2, AVX2 };
+
+// Fastest kernel the CPU supports, checked once
+DiffKernel best_diff_kernel();
+const char *diff_kernel_name(DiffKernel kernel);
+bool diff_kernel_supported(DiffKernel kernel);
+
+// Appends to `changed` the offset of every 8 byte word, counted from the
+// start of the snapshots, that differs between them, in increasing order.
+// The last word may be shorter than 8 bytes.
+void diff_snapshots(DiffKernel kernel, const uint8_t *old,
+                    const uint8_t *current, size_t size,
+                    std::vector<size_t> &changed);
+void diff_snapshots(const uint8_t *old, const uint8_t *current, size_t size,
+                    std::vector<size_t> &changed);
@@ -0,0 +1,191 @@
+#include "snapshot_poller.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <sys/time.h>
+#include <time.h>
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static volatile sig_atomic_t snapshot_due = 0;
+
+static void handle_snapshot_timer(int) { snapshot_due = 1; }
+
+// Periodic, so a tick that came just before we blocked in waitpid and didn't
+// interrupt it is followed by another one. 0 cancels.
+static void set_timer(uint64_t interval_ns) {
+  itimerval timer = {};
+  timer.it_interval.tv_sec = interval_ns / 1000000000;
+  timer.it_interval.tv_usec = (interval_ns % 1000000000) / 1000;
+  if (interval_ns && timer.it_interval.tv_sec == 0 &&
+      timer.it_interval.tv_usec == 0) {
+    timer.it_interval.tv_usec = 1;
+  }
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+SnapshotPoller::SnapshotPoller(Process &process, uint64_t interval_ns,
+                               uint8_t width, bool consistent)
+    : process(process), interval_ns(interval_ns), width(width),
+      consistent(consistent), ranges(), offsets(), previous(), current(),
+      changed(), kernel(best_diff_kernel()), started(false), finished(false),
+      snapshots(0) {
+  if (width != 1 && width != 2 && width != 4 && width != 8) {
+    throw std::invalid_argument("Poll width must be 1, 2, 4 or 8 bytes");
+  }
+  if (interval_ns == 0) {
+    throw std::invalid_argument("Poll interval must not be 0");
+  }
+}
+
+SnapshotPoller::~SnapshotPoller() {
+  if (consistent && started) {
+    set_timer(0);
+  }
+}
+
+uint32_t SnapshotPoller::add(uintptr_t address, size_t size) {
+  if (started) {
+    throw std::runtime_error("Regions must be added before the first poll");
+  }
+  size_t offset = (current.size() + 7) & ~size_t(7);
+  offsets.push_back(offset);
+  ranges.push_back({address, nullptr, size});
+  // Padding stays zero in both snapshots, it never shows up as a change
+  current.resize(offset + size);
+  previous.resize(offset + size);
+  return ranges.size() - 1;
+}
+
+bool SnapshotPoller::take_snapshot() {
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    ranges[i].buffer = current.data() + offsets[i];
+  }
+  try {
+    // A single process_vm_readv for everything that is readable
+    process.read_memory(ranges.data(), ranges.size());
+  } catch (const std::runtime_error &) {
+    if (process.has_exited()) {
+      finished = true;
+      return false;
+    }
+    throw;
+  }
+  ++snapshots;
+  return true;
+}
+
+bool SnapshotPoller::wait_interval() {
+  if (!consistent) {
+    timespec delay = {time_t(interval_ns / 1000000000),
+                      long(interval_ns % 1000000000)};
+    if (clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, nullptr) == EINTR) {
+      return false;
+    }
+    finished = process.has_exited();
+    return !finished;
+  }
+  // Stops of the tracee (signals, new threads) are handled while waiting
+  while (!snapshot_due) {
+    if (process.wait()) {
+      // A trap of the tracee's own, we set no watchpoints
+      process.continue_execution();
+    } else if (!snapshot_due) {
+      finished = !process.is_running();
+      return false;
+    }
+  }
+  snapshot_due = 0;
+  // The tracee can exit in the same wait the timer went off in
+  if (!process.is_running()) {
+    finished = true;
+    return false;
+  }
+  return true;
+}
+
+void SnapshotPoller::add_changes(uint64_t time_ns,
+                                 std::vector<RegionChange> &changes) {
+  size_t region = 0;
+  for (size_t word : changed) {
+    while (region + 1 < offsets.size() && offsets[region + 1] <= word) {
+      ++region;
+    }
+    size_t start = offsets[region];
+    size_t end = start + ranges[region].size;
+    for (size_t piece = word; piece < word + 8 && piece < end;
+         piece += width) {
+      size_t size = std::min<size_t>(width, end - piece);
+      if (std::memcmp(previous.data() + piece, current.data() + piece,
+                      size) == 0) {
+        continue;
+      }
+      RegionChange change;
+      change.region = region;
+      change.offset = piece - start;
+      change.size = size;
+      change.time_ns = time_ns;
+      change.old_value = 0;
+      change.value = 0;
+      std::memcpy(&change.old_value, previous.data() + piece, size);
+      std::memcpy(&change.value, current.data() + piece, size);
+      changes.push_back(change);
+    }
+  }
+}
+
+bool SnapshotPoller::poll(std::vector<RegionChange> &changes) {
+  if (!started) {
+    // The tracee is still stopped from spawn or attach
+    started = true;
+    if (!take_snapshot()) {
+      return false;
+    }
+    previous.swap(current);
+    if (consistent) {
+      // Without SA_RESTART, so that the timer gets us out of waitpid
+      struct sigaction action = {};
+      action.sa_handler = handle_snapshot_timer;
+      sigaction(SIGALRM, &action, nullptr);
+      set_timer(interval_ns);
+      process.continue_execution();
+    } else {
+      // From here on the tracee is never stopped by us
+      process.detach();
+    }
+  }
+
+  if (!wait_interval()) {
+    return false;
+  }
+  if (consistent) {
+    process.stop();
+  }
+  uint64_t time_ns = monotonic_ns();
+  bool taken = take_snapshot();
+  if (consistent && process.is_running()) {
+    process.continue_execution();
+  }
+  if (!taken) {
+    return false;
+  }
+  changed.clear();
+  diff_snapshots(kernel, previous.data(), current.data(), current.size(),
+                 changed);
+  add_changes(time_ns, changes);
+  previous.swap(current);
+  return true;
+}
+
+bool SnapshotPoller::has_finished() const { return finished; }
+
+uint64_t SnapshotPoller::get_snapshots() const { return snapshots; }
+
+DiffKernel SnapshotPoller::get_kernel() const { return kernel; }
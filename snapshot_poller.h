@@ -0,0 +1,65 @@
+#pragma once
+#include "process.h"
+#include "remote_memory.h"
+#include "snapshot_diff.h"
+#include <cstdint>
+#include <vector>
+
+// Part of a polled region that changed between two snapshots
+struct RegionChange {
+  uint32_t region;  // Index returned by SnapshotPoller::add
+  uint64_t offset;  // Into the region
+  uint8_t size;     // The poller's width, less at the end of a region
+  uint64_t time_ns; // CLOCK_MONOTONIC, when the new snapshot was taken
+  int64_t old_value;
+  int64_t value;
+};
+
+// Watches regions too large for watchpoints, e.g. whole arrays or the .bss
+// of an object. Every interval all regions are read in one bulk read and
+// compared with the previous snapshot, so only the last of several writes
+// between two snapshots is seen. The tracee is never stopped, unless the
+// snapshots have to be consistent: then every thread is stopped while they
+// are read.
+class SnapshotPoller {
+  Process &process;
+  uint64_t interval_ns;
+  uint8_t width;
+  bool consistent;
+  std::vector<MemoryRange> ranges; // Buffers point into `current`
+  // Where each region starts in the snapshots, 8 byte aligned so that words
+  // never straddle two regions
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> previous;
+  std::vector<uint8_t> current;
+  std::vector<size_t> changed;
+  DiffKernel kernel;
+  bool started;
+  bool finished;
+  uint64_t snapshots;
+
+  // Waits for the interval to pass, false if the tracee exited or a signal
+  // interrupted us
+  bool wait_interval();
+  // Reads every region into `current`, false if the tracee has exited
+  bool take_snapshot();
+  void add_changes(uint64_t time_ns, std::vector<RegionChange> &changes);
+
+public:
+  // `width` is 1, 2, 4 or 8, the size changes are reported in
+  SnapshotPoller(Process &process, uint64_t interval_ns, uint8_t width = 8,
+                 bool consistent = false);
+  SnapshotPoller(const SnapshotPoller &) = delete;
+  SnapshotPoller &operator=(const SnapshotPoller &) = delete;
+  ~SnapshotPoller();
+
+  // Regions are read for the first time when the first poll starts
+  uint32_t add(uintptr_t address, size_t size);
+  // Waits for the next snapshot and appends what changed since the last one,
+  // which can be nothing
+  // Returns false once the tracee has exited or a signal interrupted us
+  bool poll(std::vector<RegionChange> &changes);
+  bool has_finished() const;
+  uint64_t get_snapshots() const;
+  DiffKernel get_kernel() const;
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded single-producer/single-consumer queue. Each side owns one index and
+// only reads the other's, so neither push nor pop takes a lock or makes a
+// syscall. Capacity is rounded up to a power of two.
+template <typename T> class SpscRing {
+  static constexpr size_t cache_line = 64;
+
+  std::unique_ptr<T[]> items;
+  size_t mask;
+  // Written by the consumer only
+  alignas(cache_line) std::atomic<size_t> head;
+  // Written by the producer only
+  alignas(cache_line) std::atomic<size_t> tail;
+  // Producer's last view of head, saves touching the consumer's cache line
+  alignas(cache_line) size_t cached_head;
+
+public:
+  explicit SpscRing(size_t capacity) : head(0), tail(0), cached_head(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    items = std::make_unique<T[]>(size);
+    mask = size - 1;
+  }
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  // Producer side, returns false when full
+  bool try_push(const T &item) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    if (position - cached_head > mask) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (position - cached_head > mask) {
+        return false;
+      }
+    }
+    items[position & mask] = item;
+    tail.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, moves up to `count` items out and returns how many
+  size_t pop(T *out, size_t count) {
+    size_t position = head.load(std::memory_order_relaxed);
+    size_t available = tail.load(std::memory_order_acquire) - position;
+    if (count > available) {
+      count = available;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = items[(position + i) & mask];
+    }
+    head.store(position + count, std::memory_order_release);
+    return count;
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+};
@@ -0,0 +1,160 @@
+#include "summary.h"
+#include "trace_writer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static uint64_t mix(uint64_t value) {
+  // splitmix64 finalizer, spreads nearby values over all bits
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ull;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebull;
+  value ^= value >> 31;
+  return value;
+}
+
+DistinctCounter::DistinctCounter() : registers() {}
+
+void DistinctCounter::add(uint64_t value) {
+  uint64_t hash = mix(value);
+  uint32_t index = hash >> (64 - index_bits);
+  uint64_t rest = hash << index_bits;
+  uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - index_bits + 1;
+  if (rank > registers[index]) {
+    registers[index] = rank;
+  }
+}
+
+uint64_t DistinctCounter::estimate() const {
+  constexpr double count = 1 << index_bits;
+  double sum = 0;
+  unsigned zeros = 0;
+  for (uint8_t rank : registers) {
+    sum += std::ldexp(1.0, -rank);
+    zeros += rank == 0;
+  }
+  double alpha = 0.7213 / (1 + 1.079 / count);
+  double estimate = alpha * count * count / sum;
+  if (estimate <= 2.5 * count && zeros) {
+    // Few values, linear counting is more accurate there
+    estimate = count * std::log(count / zeros);
+  }
+  return static_cast<uint64_t>(estimate + 0.5);
+}
+
+ValueHistogram::ValueHistogram() : negative(), positive() {}
+
+void ValueHistogram::add(int64_t value) {
+  if (value < 0) {
+    uint64_t magnitude = -static_cast<uint64_t>(value);
+    ++negative[64 - __builtin_clzll(magnitude)];
+  } else {
+    ++positive[value ? 64 - __builtin_clzll(value) : 0];
+  }
+}
+
+uint64_t ValueHistogram::get_count() const {
+  uint64_t total = 0;
+  for (int i = 0; i <= 64; ++i) {
+    total += negative[i] + positive[i];
+  }
+  return total;
+}
+
+TopK::TopK(size_t k) : entries(), capacity(k) { entries.reserve(k); }
+
+void TopK::add(uint64_t key) {
+  // Linear scans, k is small and this stays in a couple of cache lines
+  for (Entry &entry : entries) {
+    if (entry.key == key) {
+      ++entry.count;
+      return;
+    }
+  }
+  if (entries.size() < capacity) {
+    entries.push_back({key, 1, 0});
+    return;
+  }
+  Entry *smallest = &entries[0];
+  for (Entry &entry : entries) {
+    if (entry.count < smallest->count) {
+      smallest = &entry;
+    }
+  }
+  *smallest = {key, smallest->count + 1, smallest->count};
+}
+
+std::vector<TopK::Entry> TopK::get_top() const {
+  std::vector<Entry> top = entries;
+  std::sort(top.begin(), top.end(), [](const Entry &a, const Entry &b) {
+    return a.count > b.count;
+  });
+  return top;
+}
+
+void WatchSummary::add(const trace_record_t &record) {
+  if (reads + writes == 0) {
+    min = max = record.value;
+  }
+  min = std::min<int64_t>(min, record.value);
+  max = std::max<int64_t>(max, record.value);
+  if (record.access == static_cast<uint8_t>(TraceAccess::Write)) {
+    ++writes;
+    values.add(record.value);
+    distinct.add(record.value);
+    writers.add(record.ip);
+  } else {
+    ++reads;
+  }
+}
+
+Summary::Summary(std::vector<std::string> names)
+    : names(std::move(names)), watches(this->names.size()) {}
+
+void Summary::add(const trace_record_t &record) {
+  watches[record.watch].add(record);
+}
+
+const WatchSummary &Summary::get(uint32_t watch) const {
+  return watches[watch];
+}
+
+void Summary::report(std::ostream &out) const {
+  for (size_t i = 0; i < watches.size(); ++i) {
+    const WatchSummary &watch = watches[i];
+    out << names[i] << ": " << watch.reads << " reads, " << watch.writes
+        << " writes";
+    if (watch.reads + watch.writes) {
+      out << ", min " << watch.min << ", max " << watch.max;
+    }
+    out << ", about " << watch.distinct.estimate()
+        << " distinct values written\n";
+
+    if (watch.values.get_count()) {
+      out << "  written values:\n";
+      watch.values.for_each([&](int64_t low, int64_t high, uint64_t count) {
+        out << "    [" << low << ", " << high << "] " << count << "\n";
+      });
+    }
+
+    std::vector<TopK::Entry> top = watch.writers.get_top();
+    if (top.size() > WatchSummary::top_writers) {
+      top.resize(WatchSummary::top_writers);
+    }
+    if (!top.empty()) {
+      out << "  top writers:\n";
+    }
+    char address[32];
+    for (const TopK::Entry &entry : top) {
+      snprintf(address, sizeof(address), "0x%llx",
+               static_cast<unsigned long long>(entry.key));
+      out << "    " << address << " " << entry.count;
+      if (entry.error) {
+        out << " (at most " << entry.error << " over)";
+      }
+      out << "\n";
+    }
+  }
+  out.flush();
+}
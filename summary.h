@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct trace_record_t;
+
+// Approximate count of distinct values (HyperLogLog), about 3% error in
+// 1 KiB no matter how many values it sees
+class DistinctCounter {
+  static constexpr unsigned index_bits = 10;
+  uint8_t registers[1 << index_bits];
+
+public:
+  DistinctCounter();
+  void add(uint64_t value);
+  uint64_t estimate() const;
+};
+
+// Counts of values by magnitude, one bucket per bit length and sign:
+// bucket n of a sign holds values whose absolute value has n significant
+// bits, [2^(n-1), 2^n)
+class ValueHistogram {
+  uint64_t negative[65];
+  uint64_t positive[65];
+
+public:
+  ValueHistogram();
+  void add(int64_t value);
+  uint64_t get_count() const;
+  // Calls visit(low, high, count) for every non-empty bucket, in order
+  template <typename Visit> void for_each(Visit visit) const;
+};
+
+// The k most frequent keys (Space-Saving). A key that isn't tracked takes
+// over the smallest counter, so counts may be overestimated by `error`.
+class TopK {
+public:
+  struct Entry {
+    uint64_t key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+private:
+  std::vector<Entry> entries;
+  size_t capacity;
+
+public:
+  explicit TopK(size_t k);
+  void add(uint64_t key);
+  // Most frequent first
+  std::vector<Entry> get_top() const;
+};
+
+// Constant-memory statistics of the hits of one watch
+struct WatchSummary {
+  static constexpr size_t top_writers = 8;
+
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  int64_t min = 0;
+  int64_t max = 0;
+  ValueHistogram values;
+  DistinctCounter distinct;
+  TopK writers{top_writers * 2}; // Extra counters make the top ones exact
+
+  void add(const trace_record_t &record);
+};
+
+// What --summary prints instead of one line per hit
+class Summary {
+  std::vector<std::string> names;
+  std::vector<WatchSummary> watches;
+
+public:
+  explicit Summary(std::vector<std::string> names);
+  void add(const trace_record_t &record);
+  const WatchSummary &get(uint32_t watch) const;
+  void report(std::ostream &out) const;
+};
+
+template <typename Visit> void ValueHistogram::for_each(Visit visit) const {
+  for (int bits = 64; bits >= 1; --bits) {
+    if (negative[bits]) {
+      // -2^63 is the only value with 64 significant bits
+      int64_t high = bits == 64 ? INT64_MIN : -(int64_t(1) << (bits - 1));
+      int64_t low = bits == 64
+                        ? INT64_MIN
+                        : -static_cast<int64_t>((uint64_t(1) << bits) - 1);
+      visit(low, high, negative[bits]);
+    }
+  }
+  if (positive[0]) {
+    visit(int64_t(0), int64_t(0), positive[0]);
+  }
+  for (int bits = 1; bits <= 63; ++bits) {
+    if (positive[bits]) {
+      int64_t low = int64_t(1) << (bits - 1);
+      int64_t high = bits == 63 ? INT64_MAX : (int64_t(1) << bits) - 1;
+      visit(low, high, positive[bits]);
+    }
+  }
+}
@@ -0,0 +1,235 @@
+#include "symbol_cache.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = {'G', 'W', 'S', 'Y', 'M', 'I', 'D', 'X'};
+static constexpr uint32_t cache_version = 1;
+
+static uint64_t fnv1a(std::string_view data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static std::string to_hex(uint64_t value) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx",
+           static_cast<unsigned long long>(value));
+  return buffer;
+}
+
+// mkdir -p of the directory holding `path`
+static void make_parent_directories(const std::string &path) {
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    std::string directory = path.substr(0, slash);
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw std::runtime_error("Failed to create directory: " + directory);
+    }
+  }
+}
+
+SymbolCache::SymbolCache()
+    : file(), header(nullptr), slots(nullptr), entries(nullptr),
+      strings(nullptr) {}
+
+std::string SymbolCache::default_directory() {
+  if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+    return std::string(xdg) + "/gwatch";
+  }
+  if (const char *home = getenv("HOME"); home && *home) {
+    return std::string(home) + "/.cache/gwatch";
+  }
+  return "";
+}
+
+std::string SymbolCache::cache_file_name(const std::string &build_id,
+                                         const std::string &binary_path) {
+  if (!build_id.empty()) {
+    return build_id + ".symidx";
+  }
+  // No build-id, so anything that changes with a rebuild goes in the key
+  char real_path[PATH_MAX];
+  struct stat st;
+  if (!realpath(binary_path.c_str(), real_path) ||
+      stat(real_path, &st) != 0) {
+    throw std::runtime_error("Failed to stat binary: " + binary_path);
+  }
+  uint64_t hash = fnv1a(real_path, 0xcbf29ce484222325ull);
+  hash = fnv1a(std::string_view(reinterpret_cast<const char *>(&st.st_size),
+                                sizeof(st.st_size)),
+               hash);
+  hash = fnv1a(std::string_view(reinterpret_cast<const char *>(&st.st_mtim),
+                                sizeof(st.st_mtim)),
+               hash);
+  return "path-" + to_hex(hash) + ".symidx";
+}
+
+std::unique_ptr<SymbolCache> SymbolCache::open(const std::string &path) {
+  std::unique_ptr<const MappedFile> file;
+  try {
+    file = std::make_unique<const MappedFile>(path);
+  } catch (const std::runtime_error &) {
+    return nullptr;
+  }
+
+  // Everything is checked once here, lookups trust the layout
+  size_t size = file->size();
+  if (size < sizeof(symbol_cache_header_t)) {
+    return nullptr;
+  }
+  auto *header = reinterpret_cast<const symbol_cache_header_t *>(file->data());
+  auto fits = [size](uint64_t offset, uint64_t length) {
+    return offset <= size && length <= size - offset;
+  };
+  uint64_t slot_count = header->slot_count;
+  if (std::memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      header->version != cache_version || slot_count == 0 ||
+      (slot_count & (slot_count - 1)) != 0 ||
+      header->entry_count >= slot_count ||
+      !fits(header->slots_offset, slot_count * sizeof(uint32_t)) ||
+      !fits(header->entries_offset,
+            header->entry_count * sizeof(symbol_cache_entry_t)) ||
+      !fits(header->strings_offset, header->strings_size) ||
+      header->strings_size == 0 ||
+      file->data()[header->strings_offset + header->strings_size - 1] != 0 ||
+      header->slots_offset % alignof(uint32_t) != 0 ||
+      header->entries_offset % alignof(symbol_cache_entry_t) != 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<SymbolCache> cache(new SymbolCache());
+  cache->header = header;
+  cache->slots =
+      reinterpret_cast<const uint32_t *>(file->data() + header->slots_offset);
+  cache->entries = reinterpret_cast<const symbol_cache_entry_t *>(
+      file->data() + header->entries_offset);
+  cache->strings =
+      reinterpret_cast<const char *>(file->data() + header->strings_offset);
+  cache->file = std::move(file);
+  return cache;
+}
+
+void SymbolCache::write(const std::string &path,
+                        const std::vector<SymbolTable> &tables) {
+  // The in-memory index already knows how to dedupe, reuse it
+  SymbolIndex index;
+  index.build(tables);
+
+  std::vector<symbol_cache_entry_t> entries;
+  std::string strings(1, '\0');
+  entries.reserve(index.size());
+  for (size_t t = 0; t < tables.size(); ++t) {
+    const SymbolTable &table = tables[t];
+    for (size_t i = 0; i < table.count; ++i) {
+      const elf64_sym_t *symbol = index.entry(t, i);
+      if (symbol->name == 0 || symbol->name >= table.strings_size) {
+        continue;
+      }
+      const char *name = table.strings + symbol->name;
+      if (index.find(name) != symbol) {
+        continue; // Shadowed by an earlier definition
+      }
+      symbol_cache_entry_t entry;
+      entry.hash = gnu_hash(name);
+      entry.name = strings.size();
+      entry.symbol = *symbol;
+      entries.push_back(entry);
+      strings.append(name);
+      strings.push_back('\0');
+    }
+  }
+  if (strings.size() >= UINT32_MAX) {
+    throw std::runtime_error("Symbol names too large to cache");
+  }
+
+  uint32_t slot_count = 16;
+  while (slot_count < entries.size() * 2) {
+    slot_count <<= 1;
+  }
+  std::vector<uint32_t> slots(slot_count, 0);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    uint32_t slot = entries[i].hash & (slot_count - 1);
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    slots[slot] = i + 1;
+  }
+
+  symbol_cache_header_t header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.slot_count = slot_count;
+  header.entry_count = entries.size();
+  header.slots_offset = sizeof(header);
+  header.entries_offset =
+      (header.slots_offset + slot_count * sizeof(uint32_t) + 7) & ~7ull;
+  header.strings_offset =
+      header.entries_offset + entries.size() * sizeof(symbol_cache_entry_t);
+  header.strings_size = strings.size();
+
+  make_parent_directories(path);
+  // Unique per writer, loader threads can index the same binary at once
+  std::string temporary = path + ".tmp.XXXXXX";
+  int fd = mkstemp(temporary.data());
+  if (fd < 0) {
+    throw std::runtime_error("Failed to write symbol cache: " + path);
+  }
+  fchmod(fd, 0644); // mkstemp makes it private, the cache needn't be
+  close(fd);
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(slots.data()),
+              slots.size() * sizeof(uint32_t));
+    static const char padding[8] = {};
+    out.write(padding, header.entries_offset - header.slots_offset -
+                           slots.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(symbol_cache_entry_t));
+    out.write(strings.data(), strings.size());
+    if (!out) {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Failed to write symbol cache: " + path);
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("Failed to write symbol cache: " + path);
+  }
+}
+
+const elf64_sym_t *SymbolCache::find(std::string_view name) const {
+  uint32_t hash = gnu_hash(name);
+  uint32_t mask = header->slot_count - 1;
+  // Bounded, a corrupt file can have every slot taken
+  uint32_t slot = hash & mask;
+  for (uint32_t probes = 0; probes < header->slot_count && slots[slot] != 0;
+       ++probes, slot = (slot + 1) & mask) {
+    uint64_t index = slots[slot] - 1;
+    if (index >= header->entry_count) {
+      return nullptr; // Corrupt, don't trust anything further
+    }
+    const symbol_cache_entry_t &entry = entries[index];
+    if (entry.hash != hash || entry.name >= header->strings_size) {
+      continue;
+    }
+    const char *candidate = strings + entry.name;
+    if (std::strncmp(candidate, name.data(), name.size()) == 0 &&
+        candidate[name.size()] == '\0') {
+      return &entry.symbol;
+    }
+  }
+  return nullptr;
+}
+
+size_t SymbolCache::size() const { return header->entry_count; }
@@ -0,0 +1,57 @@
+#pragma once
+#include "elf.h"
+#include "mapped_file.h"
+#include "symbol_index.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-disk symbol index of one binary, laid out so it can be used straight
+// from a read-only mapping: a header, an open-addressing slot array, the
+// entries and the string pool.
+struct symbol_cache_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t slot_count; // Power of two
+  uint64_t entry_count;
+  uint64_t slots_offset;
+  uint64_t entries_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+};
+
+struct symbol_cache_entry_t {
+  uint32_t hash; // gnu_hash of the name
+  uint32_t name; // Offset in the string pool
+  elf64_sym_t symbol;
+};
+
+class SymbolCache {
+  std::unique_ptr<const MappedFile> file;
+  const symbol_cache_header_t *header;
+  const uint32_t *slots;
+  const symbol_cache_entry_t *entries;
+  const char *strings;
+
+  SymbolCache();
+
+public:
+  // Default location, $XDG_CACHE_HOME/gwatch or ~/.cache/gwatch
+  static std::string default_directory();
+  // File name for a binary: its build-id, or its path, size and mtime
+  static std::string cache_file_name(const std::string &build_id,
+                                     const std::string &binary_path);
+
+  // Returns nullptr if the file is missing or not a valid cache
+  static std::unique_ptr<SymbolCache> open(const std::string &path);
+  // Builds a cache from symbol tables, earlier tables taking precedence
+  // Written to a temporary file first, so readers never see a partial one
+  static void write(const std::string &path,
+                    const std::vector<SymbolTable> &tables);
+
+  // Returned symbols point into the cache, their name field is not an
+  // offset into the binary's string table
+  const elf64_sym_t *find(std::string_view name) const;
+  size_t size() const;
+};
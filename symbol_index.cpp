@@ -0,0 +1,295 @@
+#include "symbol_index.h"
+#include "symbol_cache.h"
+#include <cstring>
+#include <stdexcept>
+
+uint32_t gnu_hash(std::string_view name) {
+  uint32_t h = 5381;
+  for (unsigned char c : name) {
+    h = h * 33 + c;
+  }
+  return h;
+}
+
+uint32_t sysv_hash(std::string_view name) {
+  uint32_t h = 0;
+  for (unsigned char c : name) {
+    h = (h << 4) + c;
+    uint32_t g = h & 0xf0000000;
+    if (g) {
+      h ^= g >> 24;
+    }
+    h &= ~g;
+  }
+  return h;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// The name offset comes first in both classes' layouts
+static const char *symbol_name(const SymbolTable &table, size_t index) {
+  uint32_t name = read_u32(table.symbols + index * table.entsize);
+  if (name == 0 || name >= table.strings_size) {
+    return nullptr;
+  }
+  return table.strings + name;
+}
+
+static bool name_equals(const char *candidate, std::string_view name) {
+  return candidate && std::strncmp(candidate, name.data(), name.size()) == 0 &&
+         candidate[name.size()] == '\0';
+}
+
+SymbolIndex::SymbolIndex()
+    : kind(Kind::Empty), tables(), slots(), count(0), hash_section(nullptr),
+      hash_section_size(0), cache(), widened_mutex(), widened() {}
+
+const elf64_sym_t *SymbolIndex::symbol_entry(const SymbolTable &table,
+                                             size_t index) const {
+  const uint8_t *entry = table.symbols + index * table.entsize;
+  if (table.size == ELFSize::ELF64) {
+    return reinterpret_cast<const elf64_sym_t *>(entry);
+  }
+  // Widened only once looked up, the table itself is never copied
+  std::lock_guard<std::mutex> lock(widened_mutex);
+  auto [it, inserted] = widened.try_emplace(entry);
+  if (inserted) {
+    elf32_sym_t symbol;
+    std::memcpy(&symbol, entry, sizeof(symbol));
+    it->second = elf64_sym_t{symbol.name,  symbol.info,  symbol.other,
+                             symbol.shndx, symbol.value, symbol.size};
+  }
+  return &it->second;
+}
+
+const char *SymbolIndex::name_at(size_t position) const {
+  for (const SymbolTable &table : tables) {
+    if (position < table.count) {
+      return symbol_name(table, position);
+    }
+    position -= table.count;
+  }
+  return nullptr;
+}
+
+const elf64_sym_t *SymbolIndex::symbol_at(size_t position) const {
+  for (const SymbolTable &table : tables) {
+    if (position < table.count) {
+      return symbol_entry(table, position);
+    }
+    position -= table.count;
+  }
+  return nullptr;
+}
+
+void SymbolIndex::build(const std::vector<SymbolTable> &symbol_tables) {
+  tables = symbol_tables;
+  widened.clear();
+  kind = Kind::Built;
+  count = 0;
+
+  size_t total = 0;
+  for (const SymbolTable &table : tables) {
+    if (table.strings_size == 0 || table.strings[table.strings_size - 1]) {
+      throw std::runtime_error("String table is not NUL-terminated");
+    }
+    total += table.count;
+  }
+  if (total >= UINT32_MAX) {
+    throw std::runtime_error("Too many symbols to index");
+  }
+
+  // Keep the load factor at most 1/2 so probe sequences stay short
+  size_t capacity = 16;
+  while (capacity < total * 2) {
+    capacity <<= 1;
+  }
+  slots.assign(capacity, Slot{0, 0});
+  size_t mask = capacity - 1;
+
+  uint32_t position = 0;
+  for (const SymbolTable &table : tables) {
+    for (size_t i = 0; i < table.count; ++i, ++position) {
+      const char *name = symbol_name(table, i);
+      if (!name) {
+        continue;
+      }
+      std::string_view key(name);
+      uint32_t hash = gnu_hash(key);
+      size_t slot = hash & mask;
+      bool duplicate = false;
+      while (slots[slot].symbol != 0) {
+        if (slots[slot].hash == hash &&
+            name_equals(name_at(slots[slot].symbol - 1), key)) {
+          // First definition wins, like the linear scan used to do
+          duplicate = true;
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+      if (!duplicate) {
+        slots[slot] = Slot{hash, position + 1};
+        ++count;
+      }
+    }
+  }
+}
+
+template <typename Class>
+void SymbolIndex::use_gnu_hash(const SymbolTable &dynsym,
+                               const uint8_t *section, uint64_t size) {
+  if (size < 16) {
+    throw std::runtime_error("Truncated .gnu.hash section");
+  }
+  uint64_t nbuckets = read_u32(section);
+  uint64_t bloom_size = read_u32(section + 8);
+  if (nbuckets == 0 ||
+      16 + bloom_size * sizeof(typename Class::Word) + nbuckets * 4 > size) {
+    throw std::runtime_error("Malformed .gnu.hash section");
+  }
+  tables = {dynsym};
+  widened.clear();
+  slots.clear();
+  count = 0;
+  hash_section = section;
+  hash_section_size = size;
+  kind = Class::size == ELFSize::ELF32 ? Kind::GnuHash32 : Kind::GnuHash64;
+}
+
+template void SymbolIndex::use_gnu_hash<ELFClass32>(const SymbolTable &,
+                                                    const uint8_t *, uint64_t);
+template void SymbolIndex::use_gnu_hash<ELFClass64>(const SymbolTable &,
+                                                    const uint8_t *, uint64_t);
+
+void SymbolIndex::use_sysv_hash(const SymbolTable &dynsym,
+                                const uint8_t *section, uint64_t size) {
+  if (size < 8) {
+    throw std::runtime_error("Truncated .hash section");
+  }
+  uint64_t nbucket = read_u32(section);
+  uint64_t nchain = read_u32(section + 4);
+  if (nbucket == 0 || 8 + (nbucket + nchain) * 4 > size) {
+    throw std::runtime_error("Malformed .hash section");
+  }
+  tables = {dynsym};
+  widened.clear();
+  slots.clear();
+  count = 0;
+  hash_section = section;
+  hash_section_size = size;
+  kind = Kind::SysvHash;
+}
+
+void SymbolIndex::use_cache(std::shared_ptr<const SymbolCache> symbol_cache) {
+  tables.clear();
+  widened.clear();
+  slots.clear();
+  cache = std::move(symbol_cache);
+  count = cache->size();
+  kind = Kind::Cached;
+}
+
+const elf64_sym_t *SymbolIndex::find_built(std::string_view name) const {
+  uint32_t hash = gnu_hash(name);
+  size_t mask = slots.size() - 1;
+  for (size_t slot = hash & mask; slots[slot].symbol != 0;
+       slot = (slot + 1) & mask) {
+    if (slots[slot].hash != hash) {
+      continue;
+    }
+    if (name_equals(name_at(slots[slot].symbol - 1), name)) {
+      return symbol_at(slots[slot].symbol - 1);
+    }
+  }
+  return nullptr;
+}
+
+template <typename BloomWord>
+const elf64_sym_t *SymbolIndex::find_gnu(std::string_view name) const {
+  const SymbolTable &dynsym = tables.front();
+  uint32_t nbuckets = read_u32(hash_section);
+  uint32_t symoffset = read_u32(hash_section + 4);
+  uint32_t bloom_size = read_u32(hash_section + 8);
+  uint32_t bloom_shift = read_u32(hash_section + 12);
+  const uint8_t *bloom = hash_section + 16;
+  const uint8_t *buckets = bloom + uint64_t(bloom_size) * sizeof(BloomWord);
+  const uint8_t *chain = buckets + uint64_t(nbuckets) * 4;
+  uint64_t chain_length = (hash_section + hash_section_size - chain) / 4;
+
+  uint32_t hash = gnu_hash(name);
+  if (bloom_size != 0) {
+    constexpr uint32_t word_bits = sizeof(BloomWord) * 8;
+    BloomWord word;
+    std::memcpy(&word,
+                bloom + ((hash / word_bits) % bloom_size) * sizeof(BloomWord),
+                sizeof(word));
+    BloomWord bits = (BloomWord(1) << (hash % word_bits)) |
+                     (BloomWord(1) << ((hash >> bloom_shift) % word_bits));
+    if ((word & bits) != bits) {
+      return nullptr;
+    }
+  }
+
+  uint32_t index = read_u32(buckets + (hash % nbuckets) * 4);
+  if (index < symoffset) {
+    return nullptr;
+  }
+  for (; index < dynsym.count && index - symoffset < chain_length; ++index) {
+    uint32_t chain_hash = read_u32(chain + uint64_t(index - symoffset) * 4);
+    if ((chain_hash | 1) == (hash | 1) &&
+        name_equals(symbol_name(dynsym, index), name)) {
+      return symbol_entry(dynsym, index);
+    }
+    if (chain_hash & 1) {
+      break; // End of this bucket's chain
+    }
+  }
+  return nullptr;
+}
+
+const elf64_sym_t *SymbolIndex::find_sysv(std::string_view name) const {
+  const SymbolTable &dynsym = tables.front();
+  uint32_t nbucket = read_u32(hash_section);
+  uint32_t nchain = read_u32(hash_section + 4);
+  const uint8_t *buckets = hash_section + 8;
+  const uint8_t *chain = buckets + uint64_t(nbucket) * 4;
+
+  uint32_t index = read_u32(buckets + (sysv_hash(name) % nbucket) * 4);
+  // Bounded by nchain so a corrupt cyclic chain cannot hang us
+  for (uint32_t steps = 0; index != 0 && index < nchain && steps < nchain;
+       ++steps) {
+    if (index < dynsym.count && name_equals(symbol_name(dynsym, index), name)) {
+      return symbol_entry(dynsym, index);
+    }
+    index = read_u32(chain + uint64_t(index) * 4);
+  }
+  return nullptr;
+}
+
+const elf64_sym_t *SymbolIndex::find(std::string_view name) const {
+  switch (kind) {
+  case Kind::Built:
+    return find_built(name);
+  case Kind::GnuHash32:
+    return find_gnu<uint32_t>(name);
+  case Kind::GnuHash64:
+    return find_gnu<uint64_t>(name);
+  case Kind::SysvHash:
+    return find_sysv(name);
+  case Kind::Cached:
+    return cache->find(name);
+  case Kind::Empty:
+    break;
+  }
+  return nullptr;
+}
+
+const elf64_sym_t *SymbolIndex::entry(size_t table, size_t index) const {
+  return symbol_entry(tables[table], index);
+}
+
+size_t SymbolIndex::size() const { return count; }
@@ -0,0 +1,77 @@
+#pragma once
+#include "elf.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Symbol table as laid out in the file: entries plus their string table
+struct SymbolTable {
+  const uint8_t *symbols;
+  uint64_t entsize;
+  size_t count;
+  const char *strings;
+  uint64_t strings_size;
+  // ELF32 entries are elf32_sym_t
+  ELFSize size = ELFSize::ELF64;
+};
+
+class SymbolCache;
+
+uint32_t gnu_hash(std::string_view name);
+uint32_t sysv_hash(std::string_view name);
+
+// Name -> symbol index over one or more symbol tables. Either built once in a
+// single pass over the tables, backed directly by the .gnu.hash/.hash
+// section of the binary when that is all the binary has, or by an on-disk
+// cache built on an earlier run.
+class SymbolIndex {
+  enum class Kind { Empty, Built, GnuHash32, GnuHash64, SysvHash, Cached };
+  struct Slot {
+    uint32_t hash;
+    uint32_t symbol; // 1-based position across all tables, 0 means empty
+  };
+
+  Kind kind;
+  std::vector<SymbolTable> tables;
+  std::vector<Slot> slots;
+  size_t count;
+  const uint8_t *hash_section;
+  uint64_t hash_section_size;
+  std::shared_ptr<const SymbolCache> cache;
+  // 32-bit entries widened by a lookup so far, keyed by their address in
+  // the table. Node-based, so returned symbols stay put.
+  mutable std::mutex widened_mutex;
+  mutable std::unordered_map<const uint8_t *, elf64_sym_t> widened;
+
+  const elf64_sym_t *symbol_entry(const SymbolTable &table,
+                                 size_t index) const;
+  // Name of the symbol at a 0-based position across all tables
+  const char *name_at(size_t position) const;
+  const elf64_sym_t *symbol_at(size_t position) const;
+  const elf64_sym_t *find_built(std::string_view name) const;
+  template <typename BloomWord>
+  const elf64_sym_t *find_gnu(std::string_view name) const;
+  const elf64_sym_t *find_sysv(std::string_view name) const;
+
+public:
+  SymbolIndex();
+  // Earlier tables take precedence over later ones for duplicate names
+  void build(const std::vector<SymbolTable> &tables);
+  // Bloom filter words of .gnu.hash are as wide as the class' addresses
+  template <typename Class>
+  void use_gnu_hash(const SymbolTable &dynsym, const uint8_t *section,
+                    uint64_t size);
+  void use_sysv_hash(const SymbolTable &dynsym, const uint8_t *section,
+                     uint64_t size);
+  void use_cache(std::shared_ptr<const SymbolCache> cache);
+
+  const elf64_sym_t *find(std::string_view name) const;
+  // Entry `index` of table `table` as given to build, the same pointer
+  // find returns for it
+  const elf64_sym_t *entry(size_t table, size_t index) const;
+  // Number of indexed names, 0 when backed by a hash section
+  size_t size() const;
+};
@@ -0,0 +1,87 @@
+#include "symbol_loader.h"
+#include <algorithm>
+#include <stdexcept>
+
+SymbolLoader::SymbolLoader(unsigned workers)
+    : worker_count(workers ? workers : std::thread::hardware_concurrency()),
+      tasks(), workers(), mutex(), finished(), next_task(0), done(),
+      returned(0), stopping(false) {
+  if (worker_count == 0) {
+    worker_count = 1; // The CPU count is unknown
+  }
+}
+
+SymbolLoader::~SymbolLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+size_t SymbolLoader::add(const std::string &path) {
+  if (!workers.empty()) {
+    throw std::logic_error("Tasks must be added before the first result");
+  }
+  tasks.push_back({path, nullptr});
+  return tasks.size() - 1;
+}
+
+size_t SymbolLoader::add(const ELF &elf) {
+  if (!workers.empty()) {
+    throw std::logic_error("Tasks must be added before the first result");
+  }
+  tasks.push_back({elf.get_path(), std::make_unique<ELF>(elf)});
+  return tasks.size() - 1;
+}
+
+void SymbolLoader::run() {
+  while (true) {
+    size_t task;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping || next_task == tasks.size()) {
+        return;
+      }
+      task = next_task++;
+    }
+    // Only this worker touches the task from here on
+    Result result{task, std::move(tasks[task].elf), ""};
+    try {
+      if (!result.elf) {
+        result.elf = std::make_unique<ELF>();
+        result.elf->load(tasks[task].path);
+        result.elf->validate();
+      }
+      result.elf->index_symbols();
+    } catch (const std::exception &e) {
+      result.elf.reset();
+      result.error = e.what();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.push_back(std::move(result));
+    }
+    finished.notify_one();
+  }
+}
+
+bool SymbolLoader::next(Result &result) {
+  if (returned == tasks.size()) {
+    return false;
+  }
+  if (workers.empty()) {
+    unsigned count = std::min<size_t>(worker_count, tasks.size());
+    for (unsigned i = 0; i < count; ++i) {
+      workers.emplace_back(&SymbolLoader::run, this);
+    }
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return !done.empty(); });
+  result = std::move(done.front());
+  done.pop_front();
+  ++returned;
+  return true;
+}
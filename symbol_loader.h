@@ -0,0 +1,55 @@
+#pragma once
+#include "elf.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Opens ELF files and builds their symbol indexes on a pool of worker
+// threads. Each worker indexes whole files on its own, results are handed
+// back as they finish so that lookups in one file don't wait for the rest.
+class SymbolLoader {
+public:
+  struct Result {
+    size_t task;              // Returned by add
+    std::unique_ptr<ELF> elf; // Indexed, nullptr on failure
+    std::string error;
+  };
+
+private:
+  struct Task {
+    std::string path;
+    std::unique_ptr<ELF> elf; // Already loaded, only to be indexed
+  };
+
+  unsigned worker_count;
+  std::vector<Task> tasks;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t next_task; // Next one a worker takes
+  std::deque<Result> done;
+  size_t returned;  // Results handed out by next
+  bool stopping;
+
+  void run();
+
+public:
+  // 0 picks one worker per CPU
+  explicit SymbolLoader(unsigned workers = 0);
+  SymbolLoader(const SymbolLoader &) = delete;
+  SymbolLoader &operator=(const SymbolLoader &) = delete;
+  // Waits for the workers, tasks that haven't started are dropped
+  ~SymbolLoader();
+
+  // Tasks are added before the first call to next
+  size_t add(const std::string &path);
+  // Indexes an ELF that is loaded already, the result shares its index
+  size_t add(const ELF &elf);
+  // Blocks for the next finished task, in the order they finish
+  // Returns false once every task was returned
+  bool next(Result &result);
+};
@@ -0,0 +1,71 @@
+#include "../address_space.h"
+#include "../elf.h"
+#include "../process.h"
+#include <gtest/gtest.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static int global_in_test_binary = 1;
+
+TEST(AddressSpaceTest, FindsOwnMappings) {
+  AddressSpace space(getpid());
+  EXPECT_TRUE(space.refresh());
+  ASSERT_FALSE(space.get_mappings().empty());
+
+  const Mapping *code =
+      space.find(reinterpret_cast<uintptr_t>(&global_in_test_binary));
+  ASSERT_NE(code, nullptr);
+  EXPECT_TRUE(code->permissions & MappingWrite);
+  EXPECT_NE(code->path.find("tests"), std::string::npos);
+
+  int on_stack = 0;
+  const Mapping *stack = space.find(reinterpret_cast<uintptr_t>(&on_stack));
+  ASSERT_NE(stack, nullptr);
+  EXPECT_EQ(stack->path, "[stack]");
+  EXPECT_EQ(space.find(0), nullptr);
+}
+
+TEST(AddressSpaceTest, RefreshSeesOnlyChanges) {
+  AddressSpace space(getpid());
+  // Storing the first result allocates, which can grow our own heap
+  space.refresh();
+  space.refresh();
+  uint64_t generation = space.get_generation();
+  EXPECT_FALSE(space.refresh());
+  EXPECT_EQ(space.get_generation(), generation);
+
+  size_t size = 16 * sysconf(_SC_PAGESIZE);
+  void *region = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+  ASSERT_NE(region, MAP_FAILED);
+  uintptr_t address = reinterpret_cast<uintptr_t>(region);
+  EXPECT_TRUE(space.refresh());
+  EXPECT_GT(space.get_generation(), generation);
+  const Mapping *mapping = space.find(address + size - 1);
+  ASSERT_NE(mapping, nullptr);
+  EXPECT_EQ(mapping->permissions, MappingRead);
+  munmap(region, size);
+}
+
+TEST(AddressSpaceTest, AuxvMatchesOwnProcess) {
+  AddressSpace space(getpid());
+  EXPECT_EQ(space.read_auxv(AT_ENTRY), getauxval(AT_ENTRY));
+  EXPECT_EQ(space.read_auxv(AT_BASE), getauxval(AT_BASE));
+}
+
+TEST(AddressSpaceTest, PieBaseMatchesMaps) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  AddressSpace &space = process.get_address_space();
+  space.refresh();
+  const Mapping *mapping = space.find(process.get_symbol_address("a"));
+  ASSERT_NE(mapping, nullptr);
+  EXPECT_NE(mapping->path.find("basic_test"), std::string::npos);
+  EXPECT_EQ(process.read_memory("a"), 5);
+  process.kill();
+}
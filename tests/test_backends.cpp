@@ -0,0 +1,208 @@
+#include "../elf.h"
+#include "../page_backend.h"
+#include "../perf_backend.h"
+#include "../process.h"
+#include "../ptrace_backend.h"
+#include <gtest/gtest.h>
+#include <time.h>
+
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+TEST(BackendTest, PtraceReportsWrites) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PtraceBackend backend(process);
+  Watch a = process.resolve_watch("a");
+  uint32_t index = backend.arm(a, true);
+
+  WatchEvent event;
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.watch, index);
+  EXPECT_EQ(event.tid, process.get_pid());
+  EXPECT_NE(event.ip, 0u);
+  EXPECT_EQ(event.value, 10); // a = b
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.value, 0); // a = b, with b = c = 0
+  process.kill();
+}
+
+TEST(BackendTest, PtraceReportsStructPieces) {
+  ELF elf;
+  elf.load("tested_programs/struct_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PtraceBackend backend(process);
+  uint32_t index = backend.arm(process.resolve_watch("stats"), true);
+
+  // hits, then errors sharing a piece with misses, then bytes
+  WatchEvent event;
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.watch, index);
+  EXPECT_EQ(event.offset, 0);
+  EXPECT_EQ(event.size, 8);
+  EXPECT_EQ(event.value, 1);
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.offset, 8);
+  EXPECT_EQ(event.value, 10l << 32);
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.offset, 16);
+  EXPECT_EQ(event.value, 100);
+  ASSERT_TRUE(backend.next_event(event));
+  EXPECT_EQ(event.offset, 0);
+  EXPECT_EQ(event.value, 2);
+  process.kill();
+}
+
+TEST(BackendTest, PagesWatchMoreThanDebugRegisters) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PageBackend backend(process);
+  const char *names[] = {"a", "b", "c", "large_var", "unused_struct"};
+  for (const char *name : names) {
+    backend.arm(process.resolve_watch(name), true);
+  }
+
+  // Every iteration writes a, b and c in turn, std::cout shares their page
+  // and its writes are filtered out
+  WatchEvent event;
+  size_t hits = 0;
+  while (backend.next_event(event)) {
+    EXPECT_EQ(event.watch, hits % 3);
+    if (hits == 0) {
+      EXPECT_EQ(event.value, 10); // a = b
+    }
+    ++hits;
+  }
+  EXPECT_EQ(hits, 90u);
+  EXPECT_GT(backend.get_faults(), hits);
+  EXPECT_GT(backend.get_filtered(), 0u);
+}
+
+TEST(BackendTest, PtraceThrottlesHotWatch) {
+  ELF elf;
+  elf.load("tested_programs/attach_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PtraceBackend backend(process);
+  // Both threads write about 2000 times a second
+  WatchBudget budget;
+  budget.max_hits_per_second = 200;
+  budget.window_ns = 50000000;
+  budget.backoff_ns = 100000000;
+  budget.max_backoff_ns = 200000000;
+  backend.set_budget(budget);
+  backend.arm(process.resolve_watch("ticks"), true);
+
+  // Runs for a second, a disarmed watch gets no events so the timer has to
+  // re-arm it on its own
+  uint64_t start = monotonic_ns();
+  uint64_t hits = 0;
+  WatchEvent event;
+  while (monotonic_ns() - start < 1000000000) {
+    ASSERT_TRUE(backend.next_event(event));
+    ++hits;
+  }
+  const Throttle &throttle = backend.get_throttle();
+  EXPECT_GE(throttle.get_periods(0).size(), 3u);
+  EXPECT_LT(hits, 1000u);
+  // Disarmed most of the time, so most hits are extrapolated
+  EXPECT_GT(throttle.estimate_hits(0, monotonic_ns()), 2 * hits);
+  process.kill();
+}
+
+TEST(BackendTest, PerfCountsEveryWrite) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PerfBackend backend(process);
+  Watch a = process.resolve_watch("a");
+  try {
+    backend.arm(a, true);
+  } catch (const std::runtime_error &e) {
+    GTEST_SKIP() << e.what();
+  }
+
+  // The loop writes a once per iteration
+  int hits = 0;
+  WatchEvent event;
+  uint64_t last_time = 0;
+  while (backend.next_event(event)) {
+    EXPECT_GE(event.time_ns, last_time);
+    last_time = event.time_ns;
+    ++hits;
+  }
+  EXPECT_EQ(hits, 30);
+  EXPECT_EQ(backend.get_lost(), 0u);
+}
+
+TEST(BackendTest, PerfWatchesShareRingBuffers) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PerfBackend backend(process);
+  uint32_t a_index, c_index;
+  try {
+    a_index = backend.arm(process.resolve_watch("a"), true);
+    c_index = backend.arm(process.resolve_watch("c"), true);
+  } catch (const std::runtime_error &e) {
+    GTEST_SKIP() << e.what();
+  }
+
+  // Both report into the same per-CPU rings, told apart by event id
+  int hits[2] = {0, 0};
+  WatchEvent event;
+  while (backend.next_event(event)) {
+    ASSERT_TRUE(event.watch == a_index || event.watch == c_index);
+    ++hits[event.watch == c_index];
+  }
+  EXPECT_EQ(hits[0], 30);
+  EXPECT_EQ(hits[1], 30);
+  EXPECT_EQ(backend.get_lost(), 0u);
+}
+
+TEST(BackendTest, PerfFollowsNewThreads) {
+  ELF elf;
+  elf.load("tested_programs/threads_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PerfBackend backend(process);
+  try {
+    backend.arm(process.resolve_watch("counter"), true);
+  } catch (const std::runtime_error &e) {
+    GTEST_SKIP() << e.what();
+  }
+
+  // Workers start after arming and inherit the events, rings included
+  int hits = 0;
+  WatchEvent event;
+  while (backend.next_event(event)) {
+    EXPECT_NE(event.tid, process.get_pid());
+    ++hits;
+  }
+  EXPECT_EQ(hits, 40);
+  EXPECT_EQ(backend.get_lost(), 0u);
+}
@@ -0,0 +1,70 @@
+#include "../condition.h"
+#include <gtest/gtest.h>
+
+static bool check(const std::string &expression, int64_t value, int64_t old,
+                  uint64_t ip = 0, int64_t tid = 0) {
+  return Condition(expression).evaluate({value, old, ip, tid, value != old});
+}
+
+TEST(ConditionTest, Comparisons) {
+  EXPECT_TRUE(check("value > 1000", 1001, 0));
+  EXPECT_FALSE(check("value > 1000", 1000, 0));
+  EXPECT_TRUE(check("value - old >= 64", 100, 36));
+  EXPECT_FALSE(check("value - old >= 64", 100, 37));
+  EXPECT_TRUE(check("value & 0x1", 3, 0));
+  EXPECT_FALSE(check("value & 0x1", 2, 0));
+  EXPECT_TRUE(check("value < -5", -6, 0));
+  EXPECT_TRUE(check("value != old", 1, 0));
+  EXPECT_TRUE(check("tid == 42 && ip >= 0x400000", 0, 0, 0x401000, 42));
+}
+
+TEST(ConditionTest, Precedence) {
+  EXPECT_TRUE(check("1 + 2 * 3 == 7", 0, 0));
+  EXPECT_TRUE(check("(1 + 2) * 3 == 9", 0, 0));
+  EXPECT_TRUE(check("1 << 4 >> 2 == 4", 0, 0));
+  EXPECT_TRUE(check("value & 0xf0 == 0x10", 0x1f, 0) == false);
+  EXPECT_TRUE(check("(value & 0xf0) == 0x10", 0x1f, 0));
+  EXPECT_TRUE(check("-value == ~value + 1", 12345, 0));
+  EXPECT_TRUE(check("!0 && !!7", 0, 0));
+  EXPECT_TRUE(check("0 || 1 && 0 || 2", 0, 0));
+  EXPECT_FALSE(check("0 || 1 && 0", 0, 0));
+}
+
+TEST(ConditionTest, ReadsAndWrites) {
+  EXPECT_TRUE(check("write", 2, 1));
+  EXPECT_FALSE(check("write", 1, 1));
+  EXPECT_TRUE(check("read", 1, 1));
+  // A store of the same value, as the decoder labels it
+  ConditionInput same_value = {1, 1, 0x401000, 0, true};
+  EXPECT_TRUE(Condition("write").evaluate(same_value));
+  EXPECT_FALSE(Condition("read").evaluate(same_value));
+  EXPECT_TRUE(Condition("write && value == old").evaluate(same_value));
+}
+
+TEST(ConditionTest, NeverTraps) {
+  EXPECT_FALSE(check("value / 0", 5, 0));
+  EXPECT_FALSE(check("value % 0", 5, 0));
+  EXPECT_TRUE(check("value / -1 == 0", INT64_MIN, 0));
+  EXPECT_TRUE(check("value + 1 < value", INT64_MAX, 0));
+  // Short circuit skips the division entirely
+  EXPECT_FALSE(check("old != 0 && value / old > 2", 5, 0));
+}
+
+TEST(ConditionTest, EmptyIsAlwaysTrue) {
+  Condition condition;
+  EXPECT_TRUE(condition.always_true());
+  EXPECT_TRUE(condition.evaluate({0, 0, 0, 0, false}));
+}
+
+TEST(ConditionTest, RejectsSyntaxErrors) {
+  EXPECT_THROW(Condition("value >"), std::invalid_argument);
+  EXPECT_THROW(Condition("value > 1)"), std::invalid_argument);
+  EXPECT_THROW(Condition("(value"), std::invalid_argument);
+  EXPECT_THROW(Condition("counter > 1"), std::invalid_argument);
+  EXPECT_THROW(Condition("value = 1"), std::invalid_argument);
+  std::string deep = "1";
+  for (int i = 0; i < 40; ++i) {
+    deep = "1 + (" + deep + ")";
+  }
+  EXPECT_THROW(Condition{deep}, std::invalid_argument);
+}
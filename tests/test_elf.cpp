@@ -1,5 +1,11 @@
 #include "../elf.h"
+#include "../symbol_index.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include <vector>
 
 TEST(ELFTest, ValidateCorrectELF) {
   ELF elf;
@@ -22,7 +28,7 @@ TEST(ELFTest, GetExistingSymbol) {
   ELF elf;
   elf.load("tested_programs/basic_test");
   elf.validate();
-  elf64_sym_t *symbol = elf.get_symbol("a");
+  const elf64_sym_t *symbol = elf.get_symbol("a");
   ASSERT_NE(symbol, nullptr);
   EXPECT_EQ(symbol->size, sizeof(int));
 }
@@ -31,7 +37,7 @@ TEST(ELFTest, GetNonExistingSymbol) {
   ELF elf;
   elf.load("tested_programs/basic_test");
   elf.validate();
-  elf64_sym_t *symbol = elf.get_symbol("non_existent_symbol");
+  const elf64_sym_t *symbol = elf.get_symbol("non_existent_symbol");
   EXPECT_EQ(symbol, nullptr);
 }
 
@@ -46,3 +52,154 @@ TEST(ELFTest, CheckPIE) {
   elf2.validate();
   EXPECT_FALSE(elf2.is_pie());
 }
+
+TEST(ELFTest, CopiesShareMapping) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  ELF copy = elf;
+  const elf64_sym_t *symbol = elf.get_symbol("a");
+  ASSERT_NE(symbol, nullptr);
+  // Both copies look into the same mapping instead of their own buffers
+  EXPECT_EQ(copy.get_symbol("a"), symbol);
+}
+
+template <typename T>
+static void append(std::vector<uint8_t> &out, const T &value) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// A 32-bit x86 file with two object symbols, in .symtab or, stripped, in
+// .dynsym with a .gnu.hash of 32-bit bloom words
+static std::string write_elf32(bool stripped, uint16_t machine) {
+  char path[] = "/tmp/gwatch_elf32_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return "";
+  }
+  close(fd);
+
+  const char strings[] = "\0counter\0limit";
+  const char *names[] = {"counter", "limit"};
+  std::vector<uint8_t> symbols;
+  append(symbols, elf32_sym_t{});
+  append(symbols, elf32_sym_t{1, 0x804a010, 4, 0x11, 0, 1});
+  append(symbols, elf32_sym_t{9, 0x804a018, 8, 0x11, 0, 1});
+
+  std::vector<uint8_t> hash;
+  uint32_t hashes[] = {gnu_hash(names[0]), gnu_hash(names[1])};
+  uint32_t bloom = 0;
+  for (uint32_t h : hashes) {
+    bloom |= (1u << (h % 32)) | (1u << ((h >> 5) % 32));
+  }
+  for (uint32_t word : {1u, 1u, 1u, 5u, bloom, 1u, hashes[0] & ~1u,
+                        hashes[1] | 1u}) {
+    append(hash, word); // nbuckets, symoffset, bloom size and shift, ...
+  }
+  const char section_names[] = "\0.symtab\0.strtab\0.shstrtab\0.dynsym\0"
+                               ".dynstr\0.gnu.hash";
+
+  uint32_t symbols_offset = sizeof(elf32_header_t);
+  uint32_t strings_offset = symbols_offset + symbols.size();
+  uint32_t hash_offset = strings_offset + sizeof(strings);
+  uint32_t names_offset = hash_offset + hash.size();
+  uint32_t headers_offset = (names_offset + sizeof(section_names) + 3) & ~3u;
+
+  elf32_header_t header{};
+  std::memcpy(header.magic, "\x7f" "ELF", 4);
+  header.size = static_cast<uint8_t>(ELFSize::ELF32);
+  header.endianness = static_cast<uint8_t>(ELFEndianness::Little);
+  header.version = 1;
+  header.type = static_cast<uint16_t>(ELFType::Executable);
+  header.machine = machine;
+  header.version2 = 1;
+  header.entry = 0x8049000;
+  header.shoff = headers_offset;
+  header.ehsize = sizeof(elf32_header_t);
+  header.shentsize = sizeof(elf32_shdr_t);
+  header.shnum = stripped ? 5 : 4;
+  header.shstrndx = 3;
+
+  std::vector<uint8_t> out;
+  append(out, header);
+  out.insert(out.end(), symbols.begin(), symbols.end());
+  out.insert(out.end(), strings, strings + sizeof(strings));
+  out.insert(out.end(), hash.begin(), hash.end());
+  out.insert(out.end(), section_names,
+             section_names + sizeof(section_names));
+  out.resize(headers_offset, 0);
+  uint32_t symbols_size = symbols.size();
+  append(out, elf32_shdr_t{});
+  append(out, elf32_shdr_t{stripped ? 27u : 1u, stripped ? 11u : 2u, 0, 0,
+                           symbols_offset, symbols_size, 2, 1, 4,
+                           sizeof(elf32_sym_t)}); // SHT_DYNSYM or SHT_SYMTAB
+  append(out, elf32_shdr_t{stripped ? 35u : 9u, 3, 0, 0, strings_offset,
+                           sizeof(strings), 0, 0, 1, 0}); // SHT_STRTAB
+  append(out, elf32_shdr_t{17, 3, 0, 0, names_offset, sizeof(section_names),
+                           0, 0, 1, 0});
+  if (stripped) {
+    append(out, elf32_shdr_t{43, 0x6ffffff6, 0x2, 0x8048200, hash_offset,
+                             uint32_t(hash.size()), 1, 0, 4,
+                             0}); // SHT_GNU_HASH
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(out.data()), out.size());
+  return path;
+}
+
+TEST(ELFTest, ReadsELF32Symbols) {
+  std::string path =
+      write_elf32(false, static_cast<uint16_t>(ELFInstructionSet::x86));
+  ASSERT_FALSE(path.empty());
+  ELF elf;
+  elf.load(path);
+  ASSERT_NO_THROW(elf.validate());
+  EXPECT_EQ(elf.getSize(), ELFSize::ELF32);
+  EXPECT_FALSE(elf.is_pie());
+  EXPECT_EQ(elf.get_entry(), 0x8049000u);
+
+  const elf64_sym_t *counter = elf.get_symbol("counter");
+  ASSERT_NE(counter, nullptr);
+  EXPECT_EQ(counter->value, 0x804a010u);
+  EXPECT_EQ(counter->size, 4u);
+  EXPECT_EQ(counter->info, 0x11);
+  const elf64_sym_t *limit = elf.get_symbol("limit");
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(limit->value, 0x804a018u);
+  EXPECT_EQ(limit->size, 8u);
+  EXPECT_EQ(elf.get_symbol("missing"), nullptr);
+
+  const elf64_shdr_t *strtab = elf.find_section_header(".strtab");
+  ASSERT_NE(strtab, nullptr);
+  EXPECT_EQ(strtab->type, 3u);
+  unlink(path.c_str());
+}
+
+TEST(ELFTest, StrippedELF32UsesGnuHash) {
+  std::string path =
+      write_elf32(true, static_cast<uint16_t>(ELFInstructionSet::x86));
+  ASSERT_FALSE(path.empty());
+  ELF elf;
+  elf.load(path);
+  elf.validate();
+  EXPECT_EQ(elf.find_section_header(".symtab"), nullptr);
+  const elf64_sym_t *limit = elf.get_symbol("limit");
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(limit->value, 0x804a018u);
+  ASSERT_NE(elf.get_symbol("counter"), nullptr);
+  EXPECT_EQ(elf.get_symbol("missing"), nullptr);
+  unlink(path.c_str());
+}
+
+TEST(ELFTest, RejectsNonX86ELF32) {
+  std::string path =
+      write_elf32(false, static_cast<uint16_t>(ELFInstructionSet::ARM));
+  ASSERT_FALSE(path.empty());
+  ELF elf;
+  elf.load(path);
+  EXPECT_THROW(elf.validate(), std::runtime_error);
+  unlink(path.c_str());
+}
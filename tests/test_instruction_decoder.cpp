@@ -0,0 +1,187 @@
+#include "../elf.h"
+#include "../instruction_decoder.h"
+#include "../process.h"
+#include "../ptrace_backend.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+static MemoryAccess classify(std::vector<uint8_t> code) {
+  return classify_preceding(code.data(), code.size());
+}
+
+// IP after the instruction, as the classifier gets it from a stop
+constexpr uintptr_t trap_ip = 0x401200;
+
+// With the watch at what a RIP-relative operand of `displacement` addresses
+static MemoryAccess classify_rip(std::vector<uint8_t> code,
+                                 int32_t displacement) {
+  return classify_preceding(code.data(), code.size(), trap_ip,
+                            trap_ip + displacement, 4);
+}
+
+// Pads an instruction with bytes of the instructions before it, as the
+// classifier always sees max_instruction_length bytes
+static MemoryAccess classify_padded(std::vector<uint8_t> code,
+                                    int32_t displacement = 0) {
+  std::vector<uint8_t> padded = {0x48, 0x89, 0xe5, 0x89, 0x7d, 0xfc,
+                                 0x8b, 0x45, 0xfc};
+  padded.insert(padded.end(), code.begin(), code.end());
+  size_t excess = padded.size() - AccessClassifier::max_instruction_length;
+  return classify_preceding(padded.data() + excess,
+                            AccessClassifier::max_instruction_length, trap_ip,
+                            trap_ip + displacement, displacement ? 4 : 0);
+}
+
+TEST(InstructionDecoderTest, Lengths) {
+  DecodedInstruction instruction;
+  const uint8_t mov_store[] = {0x89, 0x05, 0x96, 0x2e, 0x00, 0x00};
+  ASSERT_TRUE(decode_instruction(mov_store, sizeof(mov_store), instruction));
+  EXPECT_EQ(instruction.length, 6);
+  EXPECT_EQ(instruction.access, MemoryAccess::Write);
+
+  // movq $0x1, 0x10(%rax,%rbx,8)
+  const uint8_t mov_sib[] = {0x48, 0xc7, 0x44, 0xd8, 0x10,
+                             0x01, 0x00, 0x00, 0x00};
+  ASSERT_TRUE(decode_instruction(mov_sib, sizeof(mov_sib), instruction));
+  EXPECT_EQ(instruction.length, 9);
+
+  // movabs $imm64, %rax
+  const uint8_t movabs[] = {0x48, 0xb8, 1, 2, 3, 4, 5, 6, 7, 8};
+  ASSERT_TRUE(decode_instruction(movabs, sizeof(movabs), instruction));
+  EXPECT_EQ(instruction.length, 10);
+  EXPECT_EQ(instruction.access, MemoryAccess::None);
+
+  // Truncated
+  EXPECT_FALSE(decode_instruction(mov_store, 4, instruction));
+}
+
+TEST(InstructionDecoderTest, ClassifiesRipRelativeAccesses) {
+  // mov %eax, x(%rip)
+  EXPECT_EQ(classify_rip({0x89, 0x05, 0x96, 0x2e, 0x00, 0x00}, 0x2e96),
+            MemoryAccess::Write);
+  // mov x(%rip), %eax
+  EXPECT_EQ(classify_rip({0x8b, 0x05, 0xa5, 0x2e, 0x00, 0x00}, 0x2ea5),
+            MemoryAccess::Read);
+  // movq $5, x(%rip)
+  EXPECT_EQ(classify_rip({0x48, 0xc7, 0x05, 0x10, 0x20, 0x00, 0x00, 0x05,
+                          0x00, 0x00, 0x00},
+                         0x2010),
+            MemoryAccess::Write);
+  // addl $1, x(%rip)
+  EXPECT_EQ(classify_rip({0x83, 0x05, 0x10, 0x20, 0x00, 0x00, 0x01}, 0x2010),
+            MemoryAccess::ReadWrite);
+  // cmp %eax, x(%rip)
+  EXPECT_EQ(classify_rip({0x39, 0x05, 0x10, 0x20, 0x00, 0x00}, 0x2010),
+            MemoryAccess::Read);
+  // lock xadd %rax, x(%rip)
+  EXPECT_EQ(classify_rip({0xf0, 0x48, 0x0f, 0xc1, 0x05, 0x10, 0x20, 0x00,
+                          0x00},
+                         0x2010),
+            MemoryAccess::ReadWrite);
+  // mov %ax, x(%rip)
+  EXPECT_EQ(classify_rip({0x66, 0x89, 0x05, 0x10, 0x20, 0x00, 0x00}, 0x2010),
+            MemoryAccess::Write);
+  // movzbl x(%rip), %eax
+  EXPECT_EQ(classify_rip({0x0f, 0xb6, 0x05, 0x10, 0x20, 0x00, 0x00}, 0x2010),
+            MemoryAccess::Read);
+  // movsd %xmm0, x(%rip), ends in adc %eax, x(%rip)
+  EXPECT_EQ(classify_rip({0xf2, 0x0f, 0x11, 0x05, 0x10, 0x20, 0x00, 0x00},
+                         0x2010),
+            MemoryAccess::Write);
+  // vmovdqu %ymm0, x(%rip)
+  EXPECT_EQ(classify_rip({0xc5, 0xfe, 0x7f, 0x05, 0x10, 0x20, 0x00, 0x00},
+                         0x2010),
+            MemoryAccess::Write);
+  // sete x(%rip)
+  EXPECT_EQ(classify_rip({0x0f, 0x94, 0x05, 0x10, 0x20, 0x00, 0x00}, 0x2010),
+            MemoryAccess::Write);
+}
+
+TEST(InstructionDecoderTest, AmbiguousWithoutTheAddress) {
+  // mov %eax, x(%rip), but its last bytes are add %al, (%rax)
+  EXPECT_EQ(classify({0x89, 0x05, 0x96, 0x2e, 0x00, 0x00}),
+            MemoryAccess::Unknown);
+  // A watch elsewhere doesn't confirm it either
+  EXPECT_EQ(classify_rip({0x89, 0x05, 0x96, 0x2e, 0x00, 0x00}, 0x1000),
+            MemoryAccess::Unknown);
+  // mov x(%rip), %eax with a displacement no shorter instruction ends in
+  EXPECT_EQ(classify({0x8b, 0x05, 0x10, 0x32, 0x54, 0x12}), MemoryAccess::Read);
+}
+
+TEST(InstructionDecoderTest, FindsInstructionAfterOtherCode) {
+  EXPECT_EQ(classify_padded({0x89, 0x05, 0x96, 0x2e, 0x00, 0x00}, 0x2e96),
+            MemoryAccess::Write);
+  EXPECT_EQ(classify_padded({0x8b, 0x05, 0xa5, 0x2e, 0x00, 0x00}, 0x2ea5),
+            MemoryAccess::Read);
+  // mov %edx, (%rax)
+  EXPECT_EQ(classify_padded({0x89, 0x10}), MemoryAccess::Write);
+  // add (%rax), %edx
+  EXPECT_EQ(classify_padded({0x03, 0x10}), MemoryAccess::Read);
+}
+
+// Windows taken from /usr/bin/ls, where the longest candidate used to win
+// and was the wrong one
+TEST(InstructionDecoderTest, DoesNotGuessAfterRealCode) {
+  // call, movl $0x5f, (%rax), was a Read
+  EXPECT_EQ(classify({0x06, 0xf9, 0xff, 0xff, 0xe8, 0xf1, 0xa1, 0xff, 0xff,
+                      0xc7, 0x00, 0x5f, 0x00, 0x00, 0x00}),
+            MemoryAccess::Unknown);
+  // call, mov 0xa8(%rdi), %eax, was a Write
+  EXPECT_EQ(classify({0x17, 0xf8, 0xff, 0xff, 0xe8, 0x50, 0xa3, 0xff, 0xff,
+                      0x8b, 0x87, 0xa8, 0x00, 0x00, 0x00}),
+            MemoryAccess::Unknown);
+  // mov (%rsi), %rdx; xor %eax, %eax; cmp %rdx, (%rdi), was a ReadWrite
+  EXPECT_EQ(classify({0x89, 0xd0, 0xc3, 0x0f, 0x1f, 0x40, 0x00, 0x48, 0x8b,
+                      0x16, 0x31, 0xc0, 0x48, 0x39, 0x17}),
+            MemoryAccess::Unknown);
+  // subq $1, 0x18(%r12), was a Read
+  EXPECT_EQ(classify({0x00, 0x00, 0x00, 0x00, 0x00, 0x48, 0x83, 0xc5, 0x10,
+                      0x49, 0x83, 0x6c, 0x24, 0x18, 0x01}),
+            MemoryAccess::Unknown);
+  // xor %esi, %esi; mov %esi, x(%rip), was a Read, the address settles it
+  std::vector<uint8_t> store = {0x02, 0x0f, 0x84, 0x63, 0x10, 0x00, 0x00, 0x31,
+                                0xf6, 0x89, 0x35, 0x3e, 0x09, 0x02, 0x00};
+  EXPECT_EQ(classify(store), MemoryAccess::Unknown);
+  EXPECT_EQ(classify_preceding(store.data(), store.size(), trap_ip,
+                               trap_ip + 0x2093e, 4),
+            MemoryAccess::Write);
+}
+
+TEST(InstructionDecoderTest, UnknownInstructions) {
+  // rep movsb
+  EXPECT_EQ(classify({0xf3, 0xa4}), MemoryAccess::Unknown);
+  // vpbroadcastd x(%rip), %ymm0, VEX map 2
+  EXPECT_EQ(classify({0xc4, 0xe2, 0x7d, 0x58, 0x05, 0x10, 0x20, 0x00, 0x00}),
+            MemoryAccess::Unknown);
+}
+
+TEST(InstructionDecoderTest, ClassifiesTraceeAccesses) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  PtraceBackend backend(process);
+  Watch watch = process.resolve_watch("a");
+  backend.arm(watch, false);
+
+  AccessClassifier classifier;
+  WatchEvent event;
+  // int temp = a; a = b; then a is printed
+  const MemoryAccess expected[] = {MemoryAccess::Read, MemoryAccess::Write,
+                                   MemoryAccess::Read};
+  for (MemoryAccess access : expected) {
+    ASSERT_TRUE(backend.next_event(event));
+    EXPECT_EQ(classifier.classify(process, event.ip, watch.address, 4),
+              access);
+  }
+  // The loop body hits the same instructions again, from the cache
+  for (MemoryAccess access : expected) {
+    ASSERT_TRUE(backend.next_event(event));
+    EXPECT_EQ(classifier.classify(process, event.ip, watch.address, 4),
+              access);
+  }
+  EXPECT_EQ(classifier.get_cache_size(), 3u);
+  process.kill();
+}
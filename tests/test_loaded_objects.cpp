@@ -0,0 +1,139 @@
+#include "../elf.h"
+#include "../loaded_objects.h"
+#include "../process.h"
+#include <gtest/gtest.h>
+
+TEST(LoadedObjectsTest, WatchVariableInSharedLibrary) {
+  ELF elf;
+  elf.load("tested_programs/shared_lib_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  long value;
+  ASSERT_NO_THROW(value = process.read_memory("libcounter.so:plugin_counter"));
+  EXPECT_EQ(value, 7);
+
+  process.set_watchpoint("libcounter.so:plugin_calls", true);
+  // Copy relocated, so really the executable's variable is watched
+  process.set_watchpoint("libcounter.so:plugin_counter", true);
+  int hits = 0;
+  process.continue_execution();
+  while (process.wait()) {
+    hits += process.read_triggered_watchpoints() != 0;
+    process.continue_execution();
+  }
+  EXPECT_EQ(hits, 10);
+}
+
+TEST(LoadedObjectsTest, UnknownObjectOrSymbol) {
+  ELF elf;
+  elf.load("tested_programs/shared_lib_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  EXPECT_THROW(process.read_memory("libmissing.so:plugin_counter"),
+               std::runtime_error);
+  EXPECT_THROW(process.read_memory("libcounter.so:missing"),
+               std::runtime_error);
+  process.kill();
+}
+
+TEST(LoadedObjectsTest, ResidentTablesAreCapped) {
+  ELF elf;
+  elf.load("tested_programs/shared_lib_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  process.read_memory("libcounter.so:plugin_counter"); // Loads the libraries
+
+  AddressSpace &space = process.get_address_space();
+  space.refresh();
+  ObjectTable objects(1);
+  objects.update(space);
+  ASSERT_GE(objects.get_object_count(), 3u);
+  EXPECT_EQ(objects.get_resident_count(), 0u);
+
+  std::optional<size_t> counter = objects.find_object("libcounter.so");
+  std::optional<size_t> libc = objects.find_object("libc.so");
+  ASSERT_TRUE(counter && libc);
+  EXPECT_TRUE(objects.lookup(*counter, "plugin_counter"));
+  EXPECT_TRUE(objects.lookup(*libc, "malloc"));
+  EXPECT_EQ(objects.get_resident_count(), 1u);
+  // Evicted table is loaded again on demand
+  EXPECT_TRUE(objects.lookup(*counter, "plugin_counter"));
+  EXPECT_EQ(objects.get_resident_count(), 1u);
+  process.kill();
+}
+
+TEST(LoadedObjectsTest, UpdateKeepsRecentTables) {
+  ELF elf;
+  elf.load("tested_programs/shared_lib_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  // Stopped at exec, only the executable and the dynamic loader are mapped
+  AddressSpace &space = process.get_address_space();
+  space.refresh();
+  ObjectTable objects(2);
+  objects.update(space);
+  std::optional<size_t> executable =
+      objects.find_object(process.get_executable_path(process.get_pid()));
+  std::optional<size_t> loader = objects.find_object("ld-linux-x86-64.so");
+  ASSERT_TRUE(executable && loader);
+  ASSERT_LT(*executable, *loader);
+  objects.lookup(*executable, "main");
+  objects.lookup(*loader, "_r_debug"); // Used last
+
+  // Libraries get mapped between the two
+  process.read_memory("libcounter.so:plugin_counter");
+  space.refresh();
+  objects.update(space);
+  executable =
+      objects.find_object(process.get_executable_path(process.get_pid()));
+  loader = objects.find_object("ld-linux-x86-64.so");
+  std::optional<size_t> libc = objects.find_object("libc.so");
+  ASSERT_TRUE(executable && loader && libc);
+  EXPECT_EQ(objects.get_resident_count(), 2u);
+  // The least recently used table goes, whatever the load order
+  objects.lookup(*libc, "malloc");
+  EXPECT_FALSE(objects.is_resident(*executable));
+  EXPECT_TRUE(objects.is_resident(*loader));
+  EXPECT_TRUE(objects.is_resident(*libc));
+  process.kill();
+}
+
+TEST(LoadedObjectsTest, ResolveWatchesInParallel) {
+  ELF elf;
+  elf.load("tested_programs/shared_lib_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  std::vector<std::string> names = {"libcounter.so:plugin_calls",
+                                    "libc.so:errno", "plugin_counter",
+                                    "libcounter.so:plugin_counter"};
+  std::vector<bool> resolved(names.size(), false);
+  std::vector<Watch> watches(names.size());
+  process.resolve_watches(
+      names,
+      [&](size_t i, Watch &watch) {
+        EXPECT_FALSE(resolved[i]);
+        resolved[i] = true;
+        watches[i] = watch;
+      },
+      2);
+  for (bool done : resolved) {
+    EXPECT_TRUE(done);
+  }
+  // Copy relocated, both names are the executable's variable
+  EXPECT_EQ(watches[2].address, watches[3].address);
+  EXPECT_EQ(watches[2].last_value, 7);
+  EXPECT_THROW(process.resolve_watches({"libcounter.so:missing"},
+                                       [](size_t, Watch &) {}),
+               std::runtime_error);
+  process.kill();
+}
@@ -0,0 +1,101 @@
+#include "../overhead.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+TEST(OverheadTest, BucketsCoverEveryValue) {
+  // Exact below 64, then every bucket starts where the previous one ended
+  for (uint64_t value = 0; value < 64; ++value) {
+    size_t bucket = LatencyHistogram::bucket_of(value);
+    EXPECT_EQ(LatencyHistogram::bucket_low(bucket), value);
+    EXPECT_EQ(LatencyHistogram::bucket_high(bucket), value);
+  }
+  for (size_t bucket = 1; bucket < LatencyHistogram::bucket_count; ++bucket) {
+    ASSERT_EQ(LatencyHistogram::bucket_low(bucket),
+              LatencyHistogram::bucket_high(bucket - 1) + 1);
+  }
+  EXPECT_EQ(LatencyHistogram::bucket_of(UINT64_MAX),
+            LatencyHistogram::bucket_count - 1);
+  EXPECT_EQ(LatencyHistogram::bucket_high(LatencyHistogram::bucket_count - 1),
+            UINT64_MAX);
+
+  for (uint64_t value : {100ull, 1000ull, 123456ull, 1ull << 40}) {
+    size_t bucket = LatencyHistogram::bucket_of(value);
+    uint64_t low = LatencyHistogram::bucket_low(bucket);
+    uint64_t high = LatencyHistogram::bucket_high(bucket);
+    EXPECT_LE(low, value);
+    EXPECT_GE(high, value);
+    EXPECT_LE(high - low, value / 32);
+  }
+}
+
+TEST(OverheadTest, PercentilesAreWithinABucket) {
+  LatencyHistogram histogram;
+  for (uint64_t value = 1; value <= 10000; ++value) {
+    histogram.add(value);
+  }
+  EXPECT_EQ(histogram.get_count(), 10000u);
+  EXPECT_EQ(histogram.get_min(), 1u);
+  EXPECT_EQ(histogram.get_max(), 10000u);
+  EXPECT_DOUBLE_EQ(histogram.get_mean(), 5000.5);
+  for (double quantile : {0.5, 0.9, 0.99}) {
+    double expected = quantile * 10000;
+    double error = std::abs(double(histogram.percentile(quantile)) - expected);
+    EXPECT_LE(error, expected / 32) << quantile;
+  }
+  EXPECT_EQ(histogram.percentile(1.0), 10000u);
+  EXPECT_EQ(LatencyHistogram().percentile(0.5), 0u);
+}
+
+TEST(OverheadTest, SamplesEveryPeriodthCall) {
+  OverheadStats stats;
+  // Off, nothing is timed
+  EXPECT_EQ(stats.start(OverheadPhase::Resume), 0u);
+
+  stats.enable(4);
+  for (int i = 0; i < 16; ++i) {
+    stats.finish(OverheadPhase::Resume, stats.start(OverheadPhase::Resume));
+  }
+  EXPECT_EQ(stats.get_phase(OverheadPhase::Resume).get_count(), 4u);
+  // Enabling again starts from nothing
+  stats.enable(4);
+  EXPECT_EQ(stats.get_phase(OverheadPhase::Resume).get_count(), 0u);
+  EXPECT_EQ(stats.get_phase(OverheadPhase::Resume).get_max(), 0u);
+  for (int i = 0; i < 4; ++i) {
+    stats.finish(OverheadPhase::Resume, stats.start(OverheadPhase::Resume));
+  }
+  EXPECT_EQ(stats.get_phase(OverheadPhase::Resume).get_count(), 1u);
+  // Phases are sampled on their own
+  stats.finish(OverheadPhase::Emit, stats.start(OverheadPhase::Emit));
+  EXPECT_EQ(stats.get_phase(OverheadPhase::Emit).get_count(), 0u);
+}
+
+TEST(OverheadTest, WritesCountersAsJSON) {
+  OverheadStats stats;
+  uint32_t first = stats.add_watch("counter");
+  uint32_t second = stats.add_watch("lib\"x\".so:value");
+  stats.add_syscalls(100); // Before enable, dropped
+  stats.enable(1);
+  stats.add_hit(first);
+  stats.add_hit(second);
+  stats.add_hit(second);
+  stats.add_syscalls(9);
+  stats.add_bytes_read(24);
+  stats.finish(OverheadPhase::MemoryRead,
+               stats.start(OverheadPhase::MemoryRead));
+
+  EXPECT_EQ(stats.get_hits(), 3u);
+  EXPECT_EQ(stats.get_watch_hits(second), 2u);
+  EXPECT_EQ(stats.get_syscalls(), 9u);
+
+  std::ostringstream out;
+  stats.write_json(out);
+  std::string json = out.str();
+  EXPECT_NE(json.find("\"hits\": 3,"), std::string::npos) << json;
+  EXPECT_NE(json.find("\"syscalls_per_hit\": 3.0,"), std::string::npos);
+  EXPECT_NE(json.find("\"bytes_read\": 24,"), std::string::npos);
+  EXPECT_NE(json.find("{\"name\": \"lib\\\"x\\\".so:value\", \"hits\": 2}"),
+            std::string::npos)
+      << json;
+  EXPECT_NE(json.find("\"memory_read\": {\"samples\": 1,"), std::string::npos);
+  EXPECT_NE(json.find("\"resume\": {\"samples\": 0,"), std::string::npos);
+}
@@ -1,6 +1,36 @@
 #include "../elf.h"
+#include "../instruction_decoder.h"
 #include "../process.h"
+#include <cstddef>
+#include <dirent.h>
 #include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Starts a program we don't trace, once it is running `threads` threads
+static pid_t start_untraced(const char *path, size_t threads) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(path, path, nullptr);
+    _exit(127);
+  }
+  std::string task_path = "/proc/" + std::to_string(pid) + "/task";
+  for (size_t count = 0; count < threads;) {
+    usleep(1000);
+    count = 0;
+    if (DIR *dir = opendir(task_path.c_str())) {
+      while (dirent *entry = readdir(dir)) {
+        count += entry->d_name[0] != '.';
+      }
+      closedir(dir);
+    }
+  }
+  return pid;
+}
 
 TEST(ProcessTest, SpawnProcess) {
   ELF elf;
@@ -16,7 +46,7 @@ TEST(ProcessTest, ReadMemory) {
   elf.load("tested_programs/basic_test");
   elf.validate();
 
-  elf64_sym_t *symbol = elf.get_symbol("b");
+  const elf64_sym_t *symbol = elf.get_symbol("b");
   ASSERT_NE(symbol, nullptr);
   EXPECT_EQ(symbol->size, sizeof(int));
 
@@ -34,7 +64,7 @@ TEST(ProcessTest, ReadMemoryNoPie) {
   elf.load("tested_programs/basic_no_pie_test");
   elf.validate();
 
-  elf64_sym_t *symbol = elf.get_symbol("b");
+  const elf64_sym_t *symbol = elf.get_symbol("b");
   ASSERT_NE(symbol, nullptr);
   EXPECT_EQ(symbol->size, sizeof(int));
 
@@ -104,14 +134,63 @@ TEST(ProcessTest, InvalidSymbolWatchpoint) {
 
 TEST(ProcessTest, InvalidSymbolSize) {
   ELF elf;
-  elf.load("tested_programs/basic_test");
+  elf.load("tested_programs/struct_test");
   elf.validate();
 
   Process process(elf, {});
   process.spawn();
-  EXPECT_THROW(process.set_watchpoint("unused_struct", false),
+  EXPECT_THROW(process.set_watchpoint("history", false),
                std::invalid_argument);
+  EXPECT_THROW(process.resolve_watch("history"), std::invalid_argument);
+  process.kill();
+}
+
+TEST(ProcessTest, SplitsWatchIntoAlignedPieces) {
+  auto sizes = [](uintptr_t address, size_t size) {
+    std::vector<int> sizes;
+    for (const WatchPiece &piece : Process::split_watch(address, size)) {
+      EXPECT_EQ(piece.address % piece.size, 0u);
+      sizes.push_back(piece.size);
+    }
+    return sizes;
+  };
+  EXPECT_EQ(sizes(0x1000, 4), std::vector<int>({4}));
+  EXPECT_EQ(sizes(0x1000, 24), std::vector<int>({8, 8, 8}));
+  EXPECT_EQ(sizes(0x1000, 12), std::vector<int>({8, 4}));
+  EXPECT_EQ(sizes(0x1000, 7), std::vector<int>({4, 2, 1}));
+  // Unaligned int, straddling a 4-byte boundary
+  EXPECT_EQ(sizes(0x1002, 4), std::vector<int>({2, 2}));
+  EXPECT_EQ(sizes(0x1003, 8), std::vector<int>({1, 4, 2, 1}));
+}
+
+TEST(ProcessTest, WatchesStructOverSeveralRegisters) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  // 24 bytes, three 8-byte pieces
+  EXPECT_EQ(process.set_watchpoint("unused_struct", false), 0);
+  uintptr_t address = process.get_symbol_address("unused_struct");
+  for (int slot = 0; slot < 3; ++slot) {
+    WatchPiece piece = process.get_watchpoint_piece(slot);
+    EXPECT_EQ(piece.address, address + slot * 8);
+    EXPECT_EQ(piece.size, 8);
+  }
+  EXPECT_EQ(process.set_watchpoint("a", false), 3);
+  EXPECT_THROW(process.set_watchpoint("b", false), std::runtime_error);
   process.kill();
+
+  Process other(elf, {});
+  other.spawn();
+  other.set_watchpoint("a", false);
+  other.set_watchpoint("b", false);
+  // Needs three, only two are left
+  EXPECT_THROW(other.set_watchpoint("unused_struct", false),
+               std::runtime_error);
+  EXPECT_EQ(other.set_watchpoint("c", false), 2);
+  other.kill();
 }
 
 TEST(ProcessTest, Read64BitValue) {
@@ -119,7 +198,7 @@ TEST(ProcessTest, Read64BitValue) {
   elf.load("tested_programs/basic_test");
   elf.validate();
 
-  elf64_sym_t *symbol = elf.get_symbol("large_var");
+  const elf64_sym_t *symbol = elf.get_symbol("large_var");
   ASSERT_NE(symbol, nullptr);
   EXPECT_EQ(symbol->size, sizeof(int64_t));
 
@@ -131,3 +210,255 @@ TEST(ProcessTest, Read64BitValue) {
   EXPECT_EQ(long_value, 0x1234567890ABCDEF);
   process.kill();
 }
+
+TEST(ProcessTest, AllocatesAllDebugRegisters) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  EXPECT_EQ(process.set_watchpoint("a", false), 0);
+  EXPECT_EQ(process.set_watchpoint("b", false), 1);
+  EXPECT_EQ(process.set_watchpoint("c", false), 2);
+  EXPECT_EQ(process.set_watchpoint("large_var", false), 3);
+  EXPECT_THROW(process.set_watchpoint("a", true), std::runtime_error);
+
+  process.remove_watchpoint(1);
+  EXPECT_EQ(process.set_watchpoint("b", true), 1);
+  process.kill();
+}
+
+TEST(ProcessTest, ReportsWhichWatchpointFired) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  int a_slot = process.set_watchpoint("a", true);
+  int c_slot = process.set_watchpoint("c", true);
+
+  // The loop writes a, b, c in turn, so write hits alternate between a and c
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  EXPECT_EQ(process.read_triggered_watchpoints(), 1u << a_slot);
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  EXPECT_EQ(process.read_triggered_watchpoints(), 1u << c_slot);
+  process.kill();
+}
+
+TEST(ProcessTest, ResolveWatch) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  Watch watch = process.resolve_watch("b");
+  EXPECT_EQ(watch.address, process.get_symbol_address("b"));
+  EXPECT_EQ(watch.word % sizeof(long), 0u);
+  EXPECT_EQ(watch.size, sizeof(int));
+  EXPECT_EQ(watch.mask, 0xffffffffu);
+  EXPECT_EQ(watch.slots, 0u);
+  EXPECT_EQ(watch.last_value, 10);
+  EXPECT_EQ(process.read_watch(watch), 10);
+
+  EXPECT_EQ(process.set_watchpoint(watch, false), 0);
+  EXPECT_EQ(watch.slots, 1u);
+  Watch large = process.resolve_watch("unused_struct");
+  EXPECT_EQ(large.size, 24u);
+  EXPECT_EQ(process.set_watchpoint(large, false), 1);
+  EXPECT_EQ(large.slots, 0b1110u);
+  process.kill();
+}
+
+TEST(ProcessTest, GuardsPagesWithInjectedMprotect) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  uintptr_t a = process.get_symbol_address("a");
+  process.guard_page(a, PROT_READ);
+  const GuardedPage *page = process.find_guarded_page(a);
+  ASSERT_NE(page, nullptr);
+  EXPECT_EQ(page->original, PROT_READ | PROT_WRITE);
+  AddressSpace &space = process.get_address_space();
+  space.refresh();
+  EXPECT_EQ(space.find(a)->permissions, MappingRead);
+
+  // Startup code writes other variables on the page first, temp = a only
+  // reads, a = b is the first write to a
+  int faults = 0;
+  do {
+    if (faults++) {
+      process.step_over_fault();
+    }
+    process.continue_execution();
+    ASSERT_TRUE(process.wait());
+    ASSERT_NE(process.get_fault_address(), 0u);
+  } while (process.get_fault_address() != a && faults < 100);
+  EXPECT_EQ(process.read_memory("a"), 5);
+  process.step_over_fault();
+  EXPECT_EQ(process.get_fault_address(), 0u);
+  EXPECT_EQ(process.read_memory("a"), 10);
+  space.refresh();
+  EXPECT_EQ(space.find(a)->permissions, MappingRead);
+
+  // b = c is next, on the same page
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  EXPECT_EQ(process.get_fault_address(), process.get_symbol_address("b"));
+  process.kill();
+}
+
+TEST(ProcessTest, Watches32BitProgram) {
+#ifndef GWATCH_HAVE_M32
+  GTEST_SKIP() << "The toolchain can't build -m32 programs";
+#endif
+  ELF elf;
+  elf.load("tested_programs/basic_test_32");
+  elf.validate();
+  EXPECT_EQ(elf.getSize(), ELFSize::ELF32);
+  const elf64_sym_t *symbol = elf.get_symbol("a");
+  ASSERT_NE(symbol, nullptr);
+  EXPECT_EQ(symbol->size, 4u);
+
+  Process process(elf, {});
+  process.spawn();
+  EXPECT_EQ(process.read_memory("a"), 5);
+  process.set_watchpoint("a", true);
+  // a = b is the first write to a
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  EXPECT_TRUE(process.read_triggered_watchpoints());
+  EXPECT_EQ(process.read_memory("a"), 10);
+  // 32-bit code isn't decoded, the value comparison decides
+  AccessClassifier classifier;
+  EXPECT_EQ(classifier.classify(process, process.get_instruction_pointer(),
+                                process.get_symbol_address("a"), 4),
+            MemoryAccess::Unknown);
+  process.kill();
+}
+
+TEST(ProcessTest, DetachRestoresPagesAfterThreadExit) {
+  ELF elf;
+  elf.load("tested_programs/thread_exit_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  int slot = process.set_watchpoint("done", true);
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  ASSERT_TRUE(process.read_triggered_watchpoints());
+  pid_t worker = process.get_current_thread();
+  ASSERT_NE(worker, process.get_pid());
+  process.remove_watchpoint(slot);
+  uintptr_t untouched = process.get_symbol_address("untouched");
+  process.guard_page(untouched, PROT_NONE);
+
+  // The thread that made the last stop exits, another one has to restore
+  process.continue_execution();
+  usleep(100000);
+  process.detach();
+  EXPECT_EQ(process.find_guarded_page(untouched), nullptr);
+  AddressSpace &space = process.get_address_space();
+  space.refresh();
+  EXPECT_EQ(space.find(untouched)->permissions, MappingRead | MappingWrite);
+  process.kill();
+}
+
+TEST(ProcessTest, WatchpointsFollowNewThreads) {
+  ELF elf;
+  elf.load("tested_programs/threads_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  process.set_watchpoint("counter", true);
+
+  int hits = 0;
+  std::unordered_set<pid_t> writers;
+  process.continue_execution();
+  while (process.wait()) {
+    if (process.read_triggered_watchpoints()) {
+      ++hits;
+      writers.insert(process.get_current_thread());
+    }
+    process.continue_execution();
+  }
+  EXPECT_EQ(hits, 40);
+  EXPECT_EQ(writers.count(process.get_pid()), 0u);
+  EXPECT_EQ(writers.size(), 4u);
+}
+
+TEST(ProcessTest, RemovingAWatchpointDisarmsEveryThread) {
+  ELF elf;
+  elf.load("tested_programs/threads_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  int slot = process.set_watchpoint("counter", true);
+  process.continue_execution();
+  ASSERT_TRUE(process.wait());
+  ASSERT_TRUE(process.read_triggered_watchpoints());
+
+  // The other workers were still running when the hit came in
+  process.remove_watchpoint(slot);
+  ASSERT_GT(process.get_threads().size(), 1u);
+  for (pid_t tid : process.get_threads()) {
+    errno = 0;
+    long dr7 = ptrace(PTRACE_PEEKUSER, tid,
+                      offsetof(user, u_debugreg) + 7 * sizeof(long), nullptr);
+    EXPECT_EQ(errno, 0) << "thread " << tid;
+    EXPECT_EQ(dr7, 0) << "thread " << tid;
+  }
+
+  int hits = 0;
+  process.continue_execution();
+  while (process.wait()) {
+    hits += process.read_triggered_watchpoints() != 0;
+    process.continue_execution();
+  }
+  EXPECT_EQ(hits, 0);
+}
+
+TEST(ProcessTest, AttachToRunningProcess) {
+  pid_t pid = start_untraced("tested_programs/attach_test", 2);
+
+  ELF elf;
+  elf.load(Process::get_executable_path(pid));
+  elf.validate();
+  {
+    Process process(elf, {});
+    ASSERT_NO_THROW(process.attach(pid));
+    EXPECT_TRUE(process.is_attached());
+    EXPECT_EQ(process.get_thread_count(), 2u);
+    process.set_watchpoint("ticks", true);
+
+    // Both threads tick at the same rate, both must get their turn
+    std::unordered_set<pid_t> writers;
+    for (int i = 0; i < 20; ++i) {
+      process.continue_execution();
+      ASSERT_TRUE(process.wait());
+      if (process.read_triggered_watchpoints()) {
+        writers.insert(process.get_current_thread());
+      }
+    }
+    EXPECT_EQ(writers.size(), 2u);
+    process.continue_execution();
+    process.detach();
+  }
+
+  // Detaching must leave the target running
+  usleep(10000);
+  int status;
+  EXPECT_EQ(waitpid(pid, &status, WNOHANG), 0);
+  kill(pid, SIGKILL);
+  waitpid(pid, &status, 0);
+}
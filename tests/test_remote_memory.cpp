@@ -0,0 +1,66 @@
+#include "../elf.h"
+#include "../process.h"
+#include "../remote_memory.h"
+#include <gtest/gtest.h>
+
+TEST(RemoteMemoryTest, ReadScatteredRanges) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+
+  int a = 0, b = 0;
+  int64_t large = 0;
+  MemoryRange ranges[] = {
+      {process.get_symbol_address("large_var"), &large, sizeof(large)},
+      {process.get_symbol_address("a"), &a, sizeof(a)},
+      {process.get_symbol_address("b"), &b, sizeof(b)},
+  };
+  ASSERT_NO_THROW(process.read_memory(ranges, 3));
+  EXPECT_EQ(a, 5);
+  EXPECT_EQ(b, 10);
+  EXPECT_EQ(large, 0x1234567890ABCDEF);
+  process.kill();
+}
+
+TEST(RemoteMemoryTest, WriteKeepsNeighbours) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  ASSERT_NO_THROW(process.write_memory("a", 42));
+  EXPECT_EQ(process.read_memory("a"), 42);
+  EXPECT_EQ(process.read_memory("b"), 10);
+  process.kill();
+}
+
+TEST(RemoteMemoryTest, WriteReadOnlyPageFallsBackToPtrace) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  // process_vm_writev refuses .text, ptrace can still patch it
+  long code = process.read_memory("main");
+  ASSERT_NO_THROW(process.write_memory("main", code ^ 0xff));
+  EXPECT_EQ(process.read_memory("main"), code ^ 0xff);
+  process.kill();
+}
+
+TEST(RemoteMemoryTest, ReadUnmappedAddressThrows) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  long value;
+  EXPECT_THROW(process.read_memory(0, &value, sizeof(value)),
+               std::runtime_error);
+  process.kill();
+}
@@ -0,0 +1,66 @@
+#include "../elf.h"
+#include "../process.h"
+#include "../session.h"
+#include <gtest/gtest.h>
+#include <memory>
+
+static std::unique_ptr<Process> spawn(const ELF &elf) {
+  auto process = std::make_unique<Process>(elf, std::vector<std::string>());
+  process->spawn();
+  return process;
+}
+
+TEST(SessionTest, MultiplexesTracees) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+
+  Session session;
+  for (int i = 0; i < 3; ++i) {
+    size_t index = session.add(spawn(elf));
+    Process &process = session.get_process(index);
+    session.get_backend(index).arm(process.resolve_watch("a"), true);
+  }
+
+  // Each run writes a 30 times, the first time with 10
+  size_t hits[3] = {};
+  size_t tracee;
+  WatchEvent event;
+  while (session.next_event(tracee, event)) {
+    ASSERT_LT(tracee, 3u);
+    EXPECT_EQ(event.watch, 0u);
+    EXPECT_EQ(event.tid, session.get_process(tracee).get_pid());
+    if (hits[tracee] == 0) {
+      EXPECT_EQ(event.value, 10);
+    }
+    ++hits[tracee];
+  }
+  EXPECT_TRUE(session.has_finished());
+  for (size_t count : hits) {
+    EXPECT_EQ(count, 30u);
+  }
+}
+
+TEST(SessionTest, RoutesStopsOfNewThreads) {
+  ELF elf;
+  elf.load("tested_programs/threads_test");
+  elf.validate();
+
+  Session session;
+  for (int i = 0; i < 2; ++i) {
+    size_t index = session.add(spawn(elf));
+    Process &process = session.get_process(index);
+    session.get_backend(index).arm(process.resolve_watch("counter"), true);
+  }
+
+  size_t hits[2] = {};
+  size_t tracee;
+  WatchEvent event;
+  while (session.next_event(tracee, event)) {
+    ++hits[tracee];
+  }
+  EXPECT_TRUE(session.has_finished());
+  // Only the four workers write, 10 times each
+  EXPECT_EQ(hits[0], 40u);
+  EXPECT_EQ(hits[1], 40u);
+}
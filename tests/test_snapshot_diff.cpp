@@ -0,0 +1,142 @@
+#include "../elf.h"
+#include "../process.h"
+#include "../snapshot_diff.h"
+#include "../snapshot_poller.h"
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+
+static const DiffKernel kernels[] = {DiffKernel::Scalar, DiffKernel::SSE2,
+                                     DiffKernel::AVX2};
+
+TEST(SnapshotDiffTest, KernelsFindEveryChangedWord) {
+  // Odd size, so that the last word is short and follows a partial block
+  std::vector<uint8_t> old(4096 + 131);
+  std::mt19937 rng(7);
+  for (uint8_t &byte : old) {
+    byte = rng();
+  }
+  std::vector<uint8_t> current = old;
+  std::vector<size_t> expected = {0, 120, 128, 2048, 4096 + 128};
+  current[3] ^= 0x80;
+  current[127] ^= 1; // Last byte of the first block
+  current[128] ^= 1;
+  current[2049] ^= 1;
+  current[2050] ^= 1; // Same word
+  current[4096 + 130] ^= 1;
+
+  for (DiffKernel kernel : kernels) {
+    if (!diff_kernel_supported(kernel)) {
+      continue;
+    }
+    std::vector<size_t> changed;
+    diff_snapshots(kernel, old.data(), current.data(), current.size(),
+                   changed);
+    EXPECT_EQ(changed, expected) << diff_kernel_name(kernel);
+    changed.clear();
+    diff_snapshots(kernel, old.data(), old.data(), old.size(), changed);
+    EXPECT_TRUE(changed.empty()) << diff_kernel_name(kernel);
+  }
+}
+
+TEST(SnapshotDiffTest, KernelsAgreeOnRandomChanges) {
+  std::mt19937 rng(42);
+  for (size_t size : {size_t(0), size_t(7), size_t(200), size_t(65543)}) {
+    std::vector<uint8_t> old(size);
+    for (uint8_t &byte : old) {
+      byte = rng();
+    }
+    std::vector<uint8_t> current = old;
+    for (size_t i = 0; size && i < size / 50 + 1; ++i) {
+      current[rng() % size] ^= 1 << (rng() % 8);
+    }
+    std::vector<size_t> expected;
+    diff_snapshots(DiffKernel::Scalar, old.data(), current.data(), size,
+                   expected);
+    for (DiffKernel kernel : kernels) {
+      if (!diff_kernel_supported(kernel)) {
+        continue;
+      }
+      std::vector<size_t> changed;
+      diff_snapshots(kernel, old.data(), current.data(), size, changed);
+      EXPECT_EQ(changed, expected) << diff_kernel_name(kernel) << " " << size;
+    }
+  }
+}
+
+TEST(SnapshotPollerTest, ResolvesSectionsAndArrays) {
+  ELF elf;
+  elf.load("tested_programs/struct_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  ResolvedSymbol history = process.resolve_region("history");
+  EXPECT_EQ(history.size, 40u);
+  ResolvedSymbol bss = process.resolve_region(".bss");
+  EXPECT_LE(bss.address, history.address);
+  EXPECT_GE(bss.address + bss.size, history.address + history.size);
+  EXPECT_THROW(process.resolve_region(".no_such_section"),
+               std::runtime_error);
+  process.kill();
+}
+
+TEST(SnapshotPollerTest, ReportsChangesWhileRunning) {
+  ELF elf;
+  elf.load("tested_programs/attach_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  SnapshotPoller poller(process, 20000000);
+  ResolvedSymbol ticks = process.resolve_region("ticks");
+  poller.add(ticks.address, ticks.size);
+
+  // Written about 2000 times a second, every snapshot sees a new value
+  std::vector<RegionChange> changes;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(poller.poll(changes));
+  }
+  ASSERT_GE(changes.size(), 4u);
+  for (size_t i = 1; i < changes.size(); ++i) {
+    EXPECT_EQ(changes[i].region, 0u);
+    EXPECT_EQ(changes[i].offset, 0u);
+    EXPECT_EQ(changes[i].old_value, changes[i - 1].value);
+    EXPECT_GT(changes[i].value, changes[i].old_value);
+  }
+  EXPECT_EQ(poller.get_snapshots(), 6u);
+  process.kill();
+}
+
+TEST(SnapshotPollerTest, ConsistentPollsUntilExit) {
+  ELF elf;
+  elf.load("tested_programs/struct_test");
+  elf.validate();
+
+  Process process(elf, {});
+  process.spawn();
+  SnapshotPoller poller(process, 1000000, 4, true);
+  ResolvedSymbol stats = process.resolve_region("stats");
+  ResolvedSymbol history = process.resolve_region("history");
+  poller.add(stats.address, stats.size);
+  poller.add(history.address, history.size);
+
+  std::vector<RegionChange> changes;
+  while (poller.poll(changes)) {
+  }
+  EXPECT_TRUE(poller.has_finished());
+  // Whatever snapshots saw, each 4 byte piece ends at its final value
+  std::map<std::pair<uint32_t, uint64_t>, int64_t> last;
+  for (const RegionChange &change : changes) {
+    EXPECT_EQ(change.size, 4);
+    last[{change.region, change.offset}] = change.value;
+  }
+  for (const auto &[piece, value] : last) {
+    if (piece == std::make_pair(0u, uint64_t(0))) {
+      EXPECT_EQ(value, 3); // hits
+    }
+    if (piece == std::make_pair(1u, uint64_t(24))) {
+      EXPECT_EQ(value, 300); // history[3]
+    }
+  }
+}
@@ -0,0 +1,88 @@
+#include "../summary.h"
+#include "../trace_writer.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+static trace_record_t write_record(int64_t value, uint64_t ip) {
+  trace_record_t record = {};
+  record.value = value;
+  record.ip = ip;
+  record.access = static_cast<uint8_t>(TraceAccess::Write);
+  return record;
+}
+
+TEST(SummaryTest, DistinctCountIsClose) {
+  for (uint64_t count : {10u, 1000u, 100000u}) {
+    DistinctCounter counter;
+    for (uint64_t i = 0; i < count; ++i) {
+      counter.add(i);
+      counter.add(i); // Repeats don't count
+    }
+    double error = std::abs(double(counter.estimate()) - count) / count;
+    EXPECT_LT(error, 0.06) << count << " values, got " << counter.estimate();
+  }
+}
+
+TEST(SummaryTest, HistogramBucketsByMagnitude) {
+  ValueHistogram histogram;
+  for (int64_t value : {0l, 1l, 2l, 3l, 4l, -1l, -5l, INT64_MIN, INT64_MAX}) {
+    histogram.add(value);
+  }
+  EXPECT_EQ(histogram.get_count(), 9u);
+
+  std::vector<std::tuple<int64_t, int64_t, uint64_t>> buckets;
+  histogram.for_each([&](int64_t low, int64_t high, uint64_t count) {
+    buckets.emplace_back(low, high, count);
+  });
+  std::vector<std::tuple<int64_t, int64_t, uint64_t>> expected = {
+      {INT64_MIN, INT64_MIN, 1},
+      {-7, -4, 1},
+      {-1, -1, 1},
+      {0, 0, 1},
+      {1, 1, 1},
+      {2, 3, 2},
+      {4, 7, 1},
+      {int64_t(1) << 62, INT64_MAX, 1},
+  };
+  EXPECT_EQ(buckets, expected);
+}
+
+TEST(SummaryTest, TopKFindsHeavyHitters) {
+  TopK top(4);
+  // Two hot keys among a long tail of keys seen once
+  for (uint64_t i = 0; i < 1000; ++i) {
+    top.add(0x401000);
+    if (i % 2 == 0) {
+      top.add(0x402000);
+    }
+    top.add(0x500000 + i);
+  }
+  std::vector<TopK::Entry> entries = top.get_top();
+  ASSERT_GE(entries.size(), 2u);
+  EXPECT_EQ(entries[0].key, 0x401000u);
+  EXPECT_EQ(entries[0].count - entries[0].error, 1000u);
+  EXPECT_EQ(entries[1].key, 0x402000u);
+}
+
+TEST(SummaryTest, CountsReadsAndWrites) {
+  Summary summary({"counter"});
+  trace_record_t read = write_record(5, 0x401000);
+  read.access = static_cast<uint8_t>(TraceAccess::Read);
+  summary.add(read);
+  summary.add(write_record(-3, 0x401000));
+  summary.add(write_record(9, 0x401004));
+  summary.add(write_record(9, 0x401004));
+
+  const WatchSummary &watch = summary.get(0);
+  EXPECT_EQ(watch.reads, 1u);
+  EXPECT_EQ(watch.writes, 3u);
+  EXPECT_EQ(watch.min, -3);
+  EXPECT_EQ(watch.max, 9);
+  EXPECT_EQ(watch.distinct.estimate(), 2u);
+
+  std::ostringstream out;
+  summary.report(out);
+  EXPECT_NE(out.str().find("counter: 1 reads, 3 writes, min -3, max 9"),
+            std::string::npos);
+  EXPECT_NE(out.str().find("0x401004 2"), std::string::npos);
+}
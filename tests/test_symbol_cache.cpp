@@ -0,0 +1,170 @@
+#include "../elf.h"
+#include "../symbol_cache.h"
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+class SymbolCacheTest : public ::testing::Test {
+protected:
+  std::string directory;
+
+  void SetUp() override {
+    char pattern[] = "/tmp/gwatch_cache_XXXXXX";
+    ASSERT_NE(mkdtemp(pattern), nullptr);
+    directory = pattern;
+    ELF::set_symbol_cache_directory(directory + "/nested");
+  }
+
+  void TearDown() override {
+    ELF::set_symbol_cache_directory("");
+    std::system(("rm -rf " + directory).c_str());
+  }
+
+  std::string cache_path(const ELF &elf) {
+    return directory + "/nested/" +
+           SymbolCache::cache_file_name(elf.get_build_id(), elf.get_path());
+  }
+};
+
+TEST_F(SymbolCacheTest, ReadsBuildId) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  // Linkers emit a 160-bit SHA-1 build-id by default
+  EXPECT_EQ(elf.get_build_id().size(), 40u);
+}
+
+TEST_F(SymbolCacheTest, BuildsOnFirstUseAndReusesIt) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+  const elf64_sym_t *symbol = elf.get_symbol("large_var");
+  ASSERT_NE(symbol, nullptr);
+  EXPECT_EQ(symbol->size, sizeof(int64_t));
+  EXPECT_EQ(elf.get_symbol("non_existent_symbol"), nullptr);
+
+  struct stat st;
+  ASSERT_EQ(stat(cache_path(elf).c_str(), &st), 0);
+
+  // A fresh load is served from the file written above
+  ELF reloaded;
+  reloaded.load("tested_programs/basic_test");
+  const elf64_sym_t *cached = reloaded.get_symbol("large_var");
+  ASSERT_NE(cached, nullptr);
+  EXPECT_EQ(cached->value, symbol->value);
+  EXPECT_EQ(cached->size, symbol->size);
+
+  std::unique_ptr<SymbolCache> cache = SymbolCache::open(cache_path(elf));
+  ASSERT_NE(cache, nullptr);
+  EXPECT_NE(cache->find("large_var"), nullptr);
+}
+
+TEST_F(SymbolCacheTest, RebuildsCorruptCache) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  std::string path = cache_path(elf);
+  ASSERT_EQ(mkdir((directory + "/nested").c_str(), 0755), 0);
+  std::ofstream(path) << "not a symbol cache";
+  EXPECT_EQ(SymbolCache::open(path), nullptr);
+
+  const elf64_sym_t *symbol = elf.get_symbol("large_var");
+  ASSERT_NE(symbol, nullptr);
+  EXPECT_EQ(symbol->size, sizeof(int64_t));
+  EXPECT_NE(SymbolCache::open(path), nullptr);
+}
+
+TEST_F(SymbolCacheTest, CachesELF32Tables) {
+  const char strings[] = "\0counter\0limit";
+  elf32_sym_t symbols[] = {
+      {0, 0, 0, 0, 0, 0},
+      {1, 0x804a010, 4, 0x11, 0, 1},
+      {9, 0x804a018, 8, 0x11, 0, 1},
+  };
+  SymbolTable table{reinterpret_cast<const uint8_t *>(symbols),
+                    sizeof(elf32_sym_t), 3, strings, sizeof(strings),
+                    ELFSize::ELF32};
+  std::string path = directory + "/nested/elf32.symidx";
+  SymbolCache::write(path, {table});
+
+  std::unique_ptr<SymbolCache> cache = SymbolCache::open(path);
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(cache->size(), 2u);
+  const elf64_sym_t *limit = cache->find("limit");
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(limit->value, 0x804a018u);
+  EXPECT_EQ(limit->size, 8u);
+  EXPECT_EQ(cache->find("missing"), nullptr);
+}
+
+TEST_F(SymbolCacheTest, ConcurrentWritersDontShareATemporaryFile) {
+  ELF elf;
+  elf.load("tested_programs/basic_test");
+  elf.validate();
+  const elf64_shdr_t *symtab = elf.find_section_header(".symtab");
+  const elf64_shdr_t *strtab = elf.find_section_header(".strtab");
+  ASSERT_NE(symtab, nullptr);
+  ASSERT_NE(strtab, nullptr);
+  std::ifstream in("tested_programs/basic_test", std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+  SymbolTable table{
+      reinterpret_cast<const uint8_t *>(contents.data() + symtab->offset),
+      symtab->entsize, symtab->size / symtab->entsize,
+      contents.data() + strtab->offset, strtab->size};
+
+  // Like loader threads indexing the same binary at once
+  std::string path = directory + "/nested/shared.symidx";
+  std::vector<std::thread> writers;
+  for (int i = 0; i < 8; ++i) {
+    writers.emplace_back([&] {
+      for (int j = 0; j < 8; ++j) {
+        SymbolCache::write(path, {table});
+      }
+    });
+  }
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+
+  std::unique_ptr<SymbolCache> cache = SymbolCache::open(path);
+  ASSERT_NE(cache, nullptr);
+  EXPECT_NE(cache->find("large_var"), nullptr);
+  // Every temporary file was renamed over the cache
+  DIR *dir = opendir((directory + "/nested").c_str());
+  ASSERT_NE(dir, nullptr);
+  size_t files = 0;
+  while (dirent *entry = readdir(dir)) {
+    files += entry->d_name[0] != '.';
+  }
+  closedir(dir);
+  EXPECT_EQ(files, 1u);
+}
+
+TEST_F(SymbolCacheTest, LookupsEndOnAFullSlotArray) {
+  const char strings[] = "\0counter";
+  elf64_sym_t symbols[] = {{0, 0, 0, 0, 0, 0}, {1, 0x11, 0, 1, 0x1000, 4}};
+  SymbolTable table{reinterpret_cast<const uint8_t *>(symbols),
+                    sizeof(elf64_sym_t), 2, strings, sizeof(strings)};
+  std::string path = directory + "/nested/full.symidx";
+  SymbolCache::write(path, {table});
+
+  // Point every slot at the one entry, so no probe meets an empty slot
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  symbol_cache_header_t header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  std::vector<uint32_t> slots(header.slot_count, 1);
+  file.seekp(header.slots_offset);
+  file.write(reinterpret_cast<const char *>(slots.data()),
+             slots.size() * sizeof(uint32_t));
+  file.close();
+
+  std::unique_ptr<SymbolCache> cache = SymbolCache::open(path);
+  ASSERT_NE(cache, nullptr);
+  EXPECT_NE(cache->find("counter"), nullptr);
+  EXPECT_EQ(cache->find("missing"), nullptr);
+}
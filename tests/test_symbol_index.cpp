@@ -0,0 +1,81 @@
+#include "../elf.h"
+#include "../symbol_index.h"
+#include <gtest/gtest.h>
+
+TEST(SymbolIndexTest, HashFunctions) {
+  EXPECT_EQ(gnu_hash(""), 5381u);
+  EXPECT_EQ(gnu_hash("printf"), 0x156b2bb8u);
+  EXPECT_EQ(sysv_hash("printf"), 0x077905a6u);
+}
+
+TEST(SymbolIndexTest, FirstDefinitionWins) {
+  const char strings[] = "\0dup\0other";
+  elf64_sym_t first[] = {{0, 0, 0, 0, 0, 0}, {1, 0, 0, 0, 0x10, 4}};
+  elf64_sym_t second[] = {{1, 0, 0, 0, 0x20, 4}, {5, 0, 0, 0, 0x30, 8}};
+  SymbolTable tables[] = {
+      {reinterpret_cast<const uint8_t *>(first), sizeof(elf64_sym_t), 2,
+       strings, sizeof(strings)},
+      {reinterpret_cast<const uint8_t *>(second), sizeof(elf64_sym_t), 2,
+       strings, sizeof(strings)},
+  };
+
+  SymbolIndex index;
+  index.build({tables[0], tables[1]});
+  EXPECT_EQ(index.size(), 2u);
+  ASSERT_NE(index.find("dup"), nullptr);
+  EXPECT_EQ(index.find("dup")->value, 0x10u);
+  ASSERT_NE(index.find("other"), nullptr);
+  EXPECT_EQ(index.find("other")->value, 0x30u);
+  EXPECT_EQ(index.find("du"), nullptr);
+  EXPECT_EQ(index.find(""), nullptr);
+}
+
+TEST(SymbolIndexTest, IndexesELF32TablesInPlace) {
+  const char strings[] = "\0counter\0limit";
+  elf32_sym_t symbols[] = {
+      {0, 0, 0, 0, 0, 0},
+      {1, 0x804a010, 4, 0x11, 0, 1},
+      {9, 0x804a018, 8, 0x11, 0, 1},
+  };
+  SymbolTable table{reinterpret_cast<const uint8_t *>(symbols),
+                    sizeof(elf32_sym_t), 3, strings, sizeof(strings),
+                    ELFSize::ELF32};
+
+  SymbolIndex index;
+  index.build({table});
+  EXPECT_EQ(index.size(), 2u);
+  const elf64_sym_t *counter = index.find("counter");
+  ASSERT_NE(counter, nullptr);
+  EXPECT_EQ(counter->value, 0x804a010u);
+  EXPECT_EQ(counter->size, 4u);
+  EXPECT_EQ(counter->info, 0x11);
+  EXPECT_EQ(counter->shndx, 1);
+  // Widened once, later lookups and entry() hand out the same copy
+  EXPECT_EQ(index.find("counter"), counter);
+  EXPECT_EQ(index.entry(0, 1), counter);
+  const elf64_sym_t *limit = index.find("limit");
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(limit->value, 0x804a018u);
+  EXPECT_EQ(limit->size, 8u);
+  EXPECT_EQ(index.find("missing"), nullptr);
+}
+
+TEST(SymbolIndexTest, StrippedBinaryUsesGnuHash) {
+  ELF elf;
+  elf.load("tested_programs/basic_stripped_test");
+  elf.validate();
+  const elf64_sym_t *symbol = elf.get_symbol("large_var");
+  ASSERT_NE(symbol, nullptr);
+  EXPECT_EQ(symbol->size, sizeof(int64_t));
+  EXPECT_EQ(elf.get_symbol("non_existent_symbol"), nullptr);
+}
+
+TEST(SymbolIndexTest, StrippedBinaryUsesSysvHash) {
+  ELF elf;
+  elf.load("tested_programs/basic_sysv_hash_test");
+  elf.validate();
+  const elf64_sym_t *symbol = elf.get_symbol("a");
+  ASSERT_NE(symbol, nullptr);
+  EXPECT_EQ(symbol->size, sizeof(int));
+  EXPECT_EQ(elf.get_symbol("non_existent_symbol"), nullptr);
+}
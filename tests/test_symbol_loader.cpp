@@ -0,0 +1,50 @@
+#include "../symbol_loader.h"
+#include <gtest/gtest.h>
+
+TEST(SymbolLoaderTest, ReturnsEveryTask) {
+  SymbolLoader loader(3);
+  const char *paths[] = {"tested_programs/basic_test",
+                         "tested_programs/struct_test",
+                         "tested_programs/threads_test",
+                         "tested_programs/basic_no_pie_test"};
+  for (const char *path : paths) {
+    loader.add(path);
+  }
+  ELF loaded;
+  loaded.load("tested_programs/attach_test");
+  loaded.validate();
+  size_t shared = loader.add(loaded);
+
+  std::vector<bool> seen(5, false);
+  SymbolLoader::Result result;
+  while (loader.next(result)) {
+    ASSERT_LT(result.task, seen.size());
+    EXPECT_FALSE(seen[result.task]);
+    seen[result.task] = true;
+    ASSERT_TRUE(result.elf) << result.error;
+    EXPECT_EQ(result.elf->get_path(),
+              result.task == shared ? loaded.get_path() : paths[result.task]);
+  }
+  for (bool task : seen) {
+    EXPECT_TRUE(task);
+  }
+  // The index was built on a worker, copies see it
+  EXPECT_NE(loaded.get_symbol("ticks"), nullptr);
+}
+
+TEST(SymbolLoaderTest, ReportsFailures) {
+  SymbolLoader loader(2);
+  loader.add("tested_programs/invalid_file");
+  loader.add("tested_programs/no_such_file");
+  loader.add("tested_programs/basic_test");
+
+  size_t failed = 0;
+  SymbolLoader::Result result;
+  while (loader.next(result)) {
+    if (!result.elf) {
+      EXPECT_FALSE(result.error.empty());
+      ++failed;
+    }
+  }
+  EXPECT_EQ(failed, 2u);
+}
@@ -0,0 +1,95 @@
+#include "../throttle.h"
+#include <gtest/gtest.h>
+
+static constexpr uint64_t ms = 1000000;
+
+static WatchBudget rate_budget(double hits_per_second) {
+  WatchBudget budget;
+  budget.max_hits_per_second = hits_per_second;
+  budget.window_ns = 100 * ms;
+  budget.backoff_ns = 50 * ms;
+  budget.max_backoff_ns = 200 * ms;
+  return budget;
+}
+
+TEST(ThrottleTest, DisabledWithoutLimits) {
+  Throttle throttle;
+  EXPECT_FALSE(throttle.is_enabled());
+  uint32_t watch = throttle.add_watch(0);
+  for (uint64_t i = 0; i < 100000; ++i) {
+    ASSERT_FALSE(throttle.record_hit(watch, i, 1000));
+  }
+  EXPECT_EQ(throttle.get_hits(watch), 100000u);
+  EXPECT_EQ(throttle.next_rearm(), 0u);
+}
+
+TEST(ThrottleTest, DisarmsOverRateAndRearmsAfterBackoff) {
+  Throttle throttle(rate_budget(100)); // 10 hits per 100 ms window
+  uint32_t quiet = throttle.add_watch(0);
+  uint32_t hot = throttle.add_watch(0);
+
+  for (uint64_t i = 0; i < 10; ++i) {
+    EXPECT_FALSE(throttle.record_hit(hot, i * ms, 0));
+  }
+  EXPECT_FALSE(throttle.record_hit(quiet, 10 * ms, 0));
+  EXPECT_TRUE(throttle.record_hit(hot, 10 * ms, 0));
+  EXPECT_TRUE(throttle.is_throttled(hot));
+  EXPECT_FALSE(throttle.is_throttled(quiet));
+  EXPECT_EQ(throttle.next_rearm(), 60 * ms);
+
+  uint32_t due;
+  EXPECT_FALSE(throttle.take_due(59 * ms, due));
+  ASSERT_TRUE(throttle.take_due(60 * ms, due));
+  EXPECT_EQ(due, hot);
+  EXPECT_FALSE(throttle.is_throttled(hot));
+  ASSERT_EQ(throttle.get_periods(hot).size(), 1u);
+  EXPECT_EQ(throttle.get_periods(hot)[0].start_ns, 10 * ms);
+  EXPECT_EQ(throttle.get_periods(hot)[0].end_ns, 60 * ms);
+  EXPECT_EQ(throttle.get_throttled_ns(hot, 100 * ms), 50 * ms);
+}
+
+TEST(ThrottleTest, BacksOffLongerWhileStillHot) {
+  Throttle throttle(rate_budget(100));
+  uint32_t watch = throttle.add_watch(0);
+  uint64_t now = 0;
+  uint32_t due;
+  uint64_t expected_backoff[] = {50 * ms, 100 * ms, 200 * ms, 200 * ms};
+  for (uint64_t backoff : expected_backoff) {
+    while (!throttle.record_hit(watch, now, 0)) {
+      now += ms;
+    }
+    EXPECT_EQ(throttle.next_rearm() - now, backoff);
+    now = throttle.next_rearm();
+    ASSERT_TRUE(throttle.take_due(now, due));
+  }
+
+  // Calm for a while, the next throttling starts from scratch
+  now += 500 * ms;
+  while (!throttle.record_hit(watch, now, 0)) {
+    now += ms;
+  }
+  EXPECT_EQ(throttle.next_rearm() - now, 50 * ms);
+}
+
+TEST(ThrottleTest, DisarmsOverStoppedFraction) {
+  WatchBudget budget;
+  budget.max_stopped_fraction = 0.1;
+  budget.window_ns = 100 * ms;
+  Throttle throttle(budget);
+  uint32_t watch = throttle.add_watch(0);
+  EXPECT_FALSE(throttle.record_hit(watch, 0, 6 * ms));
+  EXPECT_TRUE(throttle.record_hit(watch, ms, 6 * ms));
+}
+
+TEST(ThrottleTest, EstimatesHiddenHits) {
+  Throttle throttle(rate_budget(100));
+  uint32_t watch = throttle.add_watch(0);
+  uint64_t now = 0;
+  while (!throttle.record_hit(watch, now, 0)) {
+    now += ms;
+  }
+  // 11 hits in 10 ms armed, then disarmed for the 50 ms backoff
+  uint32_t due;
+  ASSERT_TRUE(throttle.take_due(60 * ms, due));
+  EXPECT_EQ(throttle.estimate_hits(watch, 60 * ms), 11u + 55u);
+}
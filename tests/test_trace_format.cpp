@@ -0,0 +1,198 @@
+#include "../trace_format.h"
+#include "../trace_writer.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <unistd.h>
+
+TEST(TraceFormatTest, VarintRoundTrip) {
+  const uint64_t values[] = {0, 1, 127, 128, 300, 1ull << 35,
+                             std::numeric_limits<uint64_t>::max()};
+  std::string encoded;
+  for (uint64_t value : values) {
+    put_varint(encoded, value);
+  }
+  EXPECT_EQ(encoded.size(), 1u + 1 + 1 + 2 + 2 + 6 + 10);
+  const uint8_t *position = reinterpret_cast<const uint8_t *>(encoded.data());
+  const uint8_t *end = position + encoded.size();
+  for (uint64_t value : values) {
+    EXPECT_EQ(get_varint(position, end), value);
+  }
+  EXPECT_EQ(position, end);
+  EXPECT_THROW(get_varint(position, end), std::runtime_error);
+
+  for (int64_t value : {int64_t(0), int64_t(-1), int64_t(1), INT64_MIN,
+                        INT64_MAX}) {
+    EXPECT_EQ(zigzag_decode(zigzag_encode(value)), value);
+  }
+  EXPECT_EQ(zigzag_encode(-1), 1u);
+  EXPECT_EQ(zigzag_encode(1), 2u);
+}
+
+TEST(TraceFormatTest, ColumnarRoundTrip) {
+  char pattern[] = "/tmp/gwatch_columnar_XXXXXX";
+  close(mkstemp(pattern));
+  std::string path = pattern;
+
+  TraceMetadata metadata = {"0123abcd", 0x555555554000,
+                            {{"a", 0x555555558010, 4, 5},
+                             {"b", 0x555555558018, 8, -1}}};
+  // Enough records for several blocks
+  constexpr uint32_t count = TraceEncoder::block_records * 2 + 10;
+  std::vector<trace_record_t> written;
+  int64_t values[2] = {5, -1};
+  for (uint32_t i = 0; i < count; ++i) {
+    trace_record_t record = {};
+    record.time_ns = 1000000 + i * 250;
+    record.ip = 0x401000 + (i % 3) * 7;
+    record.tid = 100 + i % 4;
+    record.watch = i % 2;
+    bool write = i % 5 == 0;
+    record.access = static_cast<uint8_t>(write ? TraceAccess::Write
+                                               : TraceAccess::Read);
+    record.old_value = values[record.watch];
+    if (write) {
+      values[record.watch] += record.watch ? -1000000007 : 3;
+    }
+    record.value = values[record.watch];
+    written.push_back(record);
+  }
+  {
+    TraceWriter writer(path, TraceFormat::Columnar, metadata);
+    for (const trace_record_t &record : written) {
+      writer.push(record);
+    }
+  }
+
+  TraceReader reader(path);
+  EXPECT_EQ(reader.get_metadata().build_id, "0123abcd");
+  EXPECT_EQ(reader.get_metadata().base_address, 0x555555554000u);
+  ASSERT_EQ(reader.get_metadata().watches.size(), 2u);
+  EXPECT_EQ(reader.get_metadata().watches[1].name, "b");
+  EXPECT_EQ(reader.get_metadata().watches[1].initial_value, -1);
+
+  std::vector<trace_record_t> records;
+  size_t index = 0;
+  size_t blocks = 0;
+  while (const trace_block_header_t *block = reader.next_block()) {
+    ++blocks;
+    EXPECT_EQ(block->watch_mask, 3u);
+    reader.decode(block, records);
+    for (const trace_record_t &record : records) {
+      ASSERT_LT(index, written.size());
+      const trace_record_t &expected = written[index++];
+      EXPECT_EQ(record.time_ns, expected.time_ns);
+      EXPECT_EQ(record.ip, expected.ip);
+      EXPECT_EQ(record.tid, expected.tid);
+      EXPECT_EQ(record.watch, expected.watch);
+      EXPECT_EQ(record.access, expected.access);
+      EXPECT_EQ(record.old_value, expected.old_value);
+      EXPECT_EQ(record.value, expected.value);
+    }
+  }
+  EXPECT_EQ(index, written.size());
+  EXPECT_EQ(blocks, 3u);
+
+  // Far smaller than the fixed-size records
+  FILE *file = fopen(path.c_str(), "rb");
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  EXPECT_LT(size, static_cast<long>(count * sizeof(trace_record_t) / 4));
+  unlink(path.c_str());
+}
+
+TEST(TraceFormatTest, PiecesKeepTheirOwnValues) {
+  char pattern[] = "/tmp/gwatch_pieces_XXXXXX";
+  close(mkstemp(pattern));
+  std::string path = pattern;
+
+  // A 24 byte struct reported as three 8 byte pieces, and a plain int
+  TraceMetadata metadata = {"", 0x555555554000,
+                            {{"s", 0x555555558020, 24, 1},
+                             {"a", 0x555555558010, 4, 5}}};
+  constexpr uint32_t count = TraceEncoder::block_records + 100;
+  std::vector<trace_record_t> written;
+  int64_t pieces[3] = {1, 200, -3000};
+  int64_t a = 5;
+  for (uint32_t i = 0; i < count; ++i) {
+    trace_record_t record = {};
+    record.time_ns = 1000 + i;
+    record.tid = 100;
+    record.watch = i % 4 == 3;
+    bool write = i % 3 != 0;
+    record.access = static_cast<uint8_t>(write ? TraceAccess::Write
+                                               : TraceAccess::Read);
+    int64_t &value = record.watch ? a : pieces[(i * 7 / 4) % 3];
+    record.offset = record.watch ? 0 : (&value - pieces) * 8;
+    record.old_value = value;
+    if (write) {
+      value += 1 + i % 5;
+    }
+    record.value = value;
+    written.push_back(record);
+  }
+  {
+    TraceWriter writer(path, TraceFormat::Columnar, metadata);
+    for (const trace_record_t &record : written) {
+      writer.push(record);
+    }
+  }
+
+  TraceReader reader(path);
+  std::vector<trace_record_t> records;
+  size_t index = 0;
+  while (const trace_block_header_t *block = reader.next_block()) {
+    reader.decode(block, records);
+    for (const trace_record_t &record : records) {
+      ASSERT_LT(index, written.size());
+      const trace_record_t &expected = written[index++];
+      EXPECT_EQ(record.watch, expected.watch);
+      EXPECT_EQ(record.offset, expected.offset);
+      EXPECT_EQ(record.old_value, expected.old_value) << index;
+      EXPECT_EQ(record.value, expected.value) << index;
+    }
+  }
+  EXPECT_EQ(index, written.size());
+  unlink(path.c_str());
+}
+
+TEST(TraceFormatTest, WritesAfterFilteredRecordsKeepTheirOldValue) {
+  char pattern[] = "/tmp/gwatch_filtered_XXXXXX";
+  close(mkstemp(pattern));
+  std::string path = pattern;
+
+  TraceMetadata metadata = {"", 0x555555554000,
+                            {{"a", 0x555555558010, 4, 0}}};
+  auto hit = [](uint64_t time, TraceAccess access, int64_t old_value,
+                int64_t value) {
+    trace_record_t record = {};
+    record.time_ns = time;
+    record.access = static_cast<uint8_t>(access);
+    record.old_value = old_value;
+    record.value = value;
+    return record;
+  };
+  // 5 -> 7 was dropped by --cond
+  std::vector<trace_record_t> written = {
+      hit(1, TraceAccess::Write, 0, 5), hit(3, TraceAccess::Write, 7, 9),
+      hit(4, TraceAccess::Read, 9, 9), hit(5, TraceAccess::Write, 9, 9)};
+  {
+    TraceWriter writer(path, TraceFormat::Columnar, metadata);
+    for (const trace_record_t &record : written) {
+      writer.push(record);
+    }
+  }
+
+  TraceReader reader(path);
+  std::vector<trace_record_t> records;
+  const trace_block_header_t *block = reader.next_block();
+  ASSERT_NE(block, nullptr);
+  reader.decode(block, records);
+  ASSERT_EQ(records.size(), written.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(records[i].old_value, written[i].old_value) << i;
+    EXPECT_EQ(records[i].value, written[i].value) << i;
+    EXPECT_EQ(records[i].access, written[i].access) << i;
+  }
+  unlink(path.c_str());
+}
@@ -0,0 +1,115 @@
+#include "../spsc_ring.h"
+#include "../trace_writer.h"
+#include <cstdlib>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+static std::string temporary_path() {
+  char pattern[] = "/tmp/gwatch_trace_XXXXXX";
+  int fd = mkstemp(pattern);
+  close(fd);
+  return pattern;
+}
+
+static TraceMetadata make_metadata(std::vector<std::string> names) {
+  TraceMetadata metadata = {"", 0, {}};
+  for (const std::string &name : names) {
+    metadata.watches.push_back({name, 0, 4, 0});
+  }
+  return metadata;
+}
+
+static trace_record_t make_record(uint16_t watch, TraceAccess access,
+                                  int64_t old_value, int64_t value) {
+  trace_record_t record = {};
+  record.watch = watch;
+  record.access = static_cast<uint8_t>(access);
+  record.old_value = old_value;
+  record.value = value;
+  return record;
+}
+
+TEST(SpscRingTest, KeepsOrderAcrossThreads) {
+  SpscRing<uint64_t> ring(8);
+  EXPECT_EQ(ring.capacity(), 8u);
+  constexpr uint64_t count = 100000;
+
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < count; ++i) {
+      while (!ring.try_push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint64_t expected = 0;
+  uint64_t batch[5];
+  while (expected < count) {
+    size_t popped = ring.pop(batch, 5);
+    if (popped == 0) {
+      // Lets the producer run on a single CPU
+      std::this_thread::yield();
+    }
+    for (size_t i = 0; i < popped; ++i) {
+      ASSERT_EQ(batch[i], expected++);
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(SpscRingTest, RejectsPushWhenFull) {
+  SpscRing<int> ring(2);
+  EXPECT_TRUE(ring.try_push(1));
+  EXPECT_TRUE(ring.try_push(2));
+  EXPECT_FALSE(ring.try_push(3));
+  int item;
+  EXPECT_EQ(ring.pop(&item, 1), 1u);
+  EXPECT_EQ(item, 1);
+  EXPECT_TRUE(ring.try_push(3));
+}
+
+TEST(TraceWriterTest, WritesText) {
+  std::string path = temporary_path();
+  {
+    TraceWriter writer(path, TraceFormat::Text, make_metadata({"a", "b"}), 4);
+    writer.push(make_record(0, TraceAccess::Read, 0, 0));
+    for (int i = 0; i < 10; ++i) { // More than fit in the ring at once
+      writer.push(make_record(1, TraceAccess::Write, i, i + 1));
+    }
+  }
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  std::string expected = "a read 0\n";
+  for (int i = 0; i < 10; ++i) {
+    expected += "b write " + std::to_string(i) + " -> " +
+                std::to_string(i + 1) + "\n";
+  }
+  EXPECT_EQ(contents.str(), expected);
+  unlink(path.c_str());
+}
+
+TEST(TraceWriterTest, WritesBinaryRecords) {
+  std::string path = temporary_path();
+  TraceWriter writer(path, TraceFormat::Binary, make_metadata({"a"}));
+  trace_record_t record = make_record(0, TraceAccess::Write, 3, -4);
+  record.tid = 1234;
+  record.ip = 0x401000;
+  record.time_ns = 42;
+  writer.push(record);
+  writer.close();
+
+  std::ifstream file(path, std::ios::binary);
+  trace_record_t read = {};
+  ASSERT_TRUE(file.read(reinterpret_cast<char *>(&read), sizeof(read)));
+  EXPECT_EQ(read.tid, 1234);
+  EXPECT_EQ(read.ip, 0x401000u);
+  EXPECT_EQ(read.time_ns, 42u);
+  EXPECT_EQ(read.old_value, 3);
+  EXPECT_EQ(read.value, -4);
+  EXPECT_EQ(file.peek(), EOF);
+  unlink(path.c_str());
+}
@@ -0,0 +1,19 @@
+#include <chrono>
+#include <thread>
+
+volatile long ticks = 0;
+
+// Runs for about a minute, long enough for tests to attach to it
+int main() {
+  std::thread worker([] {
+    for (int i = 0; i < 60000; ++i) {
+      ticks = ticks + 1;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  for (int i = 0; i < 60000; ++i) {
+    ticks = ticks + 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  worker.join();
+}
@@ -0,0 +1,9 @@
+// Also referenced by the executable, which gets it by copy relocation
+int plugin_counter = 7;
+// Only ever touched from inside the library
+int plugin_calls = 0;
+
+void bump_plugin_counter() {
+  plugin_counter = plugin_counter + 1;
+  plugin_calls = plugin_calls + 1;
+}
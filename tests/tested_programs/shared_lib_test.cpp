@@ -0,0 +1,11 @@
+#include <iostream>
+
+void bump_plugin_counter();
+extern int plugin_counter;
+
+int main() {
+  for (int i = 0; i < 5; ++i) {
+    bump_plugin_counter();
+  }
+  std::cout << "Plugin counter: " << plugin_counter << std::endl;
+}
@@ -0,0 +1,24 @@
+#include <cstdint>
+#include <iostream>
+
+// Written a field at a time, watched as a whole
+struct Stats {
+  int64_t hits;
+  int32_t misses;
+  int32_t errors;
+  int64_t bytes;
+} stats;
+
+// Too large to watch
+int64_t history[5];
+
+int main() {
+  for (int i = 1; i <= 3; ++i) {
+    stats.hits = i;
+    stats.errors = i * 10;
+    stats.bytes = i * 100;
+    history[i] = stats.bytes;
+  }
+  std::cout << "hits=" << stats.hits << ", errors=" << stats.errors
+            << ", bytes=" << stats.bytes << std::endl;
+}
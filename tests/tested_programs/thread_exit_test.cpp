@@ -0,0 +1,17 @@
+#include <chrono>
+#include <thread>
+
+volatile int done = 0;
+volatile long ticks = 0;
+// Alone on its page, nothing in the program touches it
+alignas(4096) volatile char untouched[4096];
+
+// A worker that exits early, the main thread runs for about ten seconds
+int main() {
+  std::thread worker([] { done = 1; });
+  worker.join();
+  for (int i = 0; i < 10000; ++i) {
+    ticks = ticks + 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
@@ -0,0 +1,24 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int counter = 0;
+std::mutex counter_mutex;
+
+int main() {
+  // Only worker threads ever write the counter
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; ++t) {
+    workers.emplace_back([] {
+      for (int i = 0; i < 10; ++i) {
+        std::lock_guard<std::mutex> lock(counter_mutex);
+        counter = counter + 1;
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  std::cout << "Counter: " << counter << std::endl;
+}
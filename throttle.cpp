@@ -0,0 +1,115 @@
+#include "throttle.h"
+#include <algorithm>
+
+Throttle::Throttle(const WatchBudget &budget) : budget(budget), states() {}
+
+bool Throttle::is_enabled() const {
+  return budget.max_hits_per_second > 0 || budget.max_stopped_fraction > 0;
+}
+
+uint32_t Throttle::add_watch(uint64_t now_ns) {
+  State state = {};
+  state.start_ns = now_ns;
+  state.window_start_ns = now_ns;
+  state.backoff_ns = budget.backoff_ns;
+  states.push_back(state);
+  return states.size() - 1;
+}
+
+bool Throttle::record_hit(uint32_t watch, uint64_t now_ns,
+                          uint64_t stopped_ns) {
+  State &state = states[watch];
+  ++state.hits;
+  if (!is_enabled() || state.rearm_ns) {
+    return false;
+  }
+  if (now_ns - state.window_start_ns >= budget.window_ns) {
+    state.window_start_ns = now_ns;
+    state.window_hits = 0;
+    state.window_stopped_ns = 0;
+  }
+  ++state.window_hits;
+  state.window_stopped_ns += stopped_ns;
+
+  double window = budget.window_ns;
+  bool over = (budget.max_hits_per_second > 0 &&
+               state.window_hits >
+                   budget.max_hits_per_second * window / 1e9) ||
+              (budget.max_stopped_fraction > 0 &&
+               state.window_stopped_ns > budget.max_stopped_fraction * window);
+  if (!over) {
+    return false;
+  }
+
+  // Still hot within a window of the last re-arm, so back off for longer
+  if (!state.periods.empty() &&
+      now_ns - state.rearmed_ns < budget.window_ns) {
+    state.backoff_ns = std::min(state.backoff_ns * 2, budget.max_backoff_ns);
+  } else {
+    state.backoff_ns = budget.backoff_ns;
+  }
+  state.rearm_ns = now_ns + state.backoff_ns;
+  state.periods.push_back({now_ns, 0});
+  return true;
+}
+
+bool Throttle::is_throttled(uint32_t watch) const {
+  return states[watch].rearm_ns != 0;
+}
+
+uint64_t Throttle::next_rearm() const {
+  uint64_t next = 0;
+  for (const State &state : states) {
+    if (state.rearm_ns && (!next || state.rearm_ns < next)) {
+      next = state.rearm_ns;
+    }
+  }
+  return next;
+}
+
+bool Throttle::take_due(uint64_t now_ns, uint32_t &watch) {
+  for (size_t i = 0; i < states.size(); ++i) {
+    State &state = states[i];
+    if (state.rearm_ns && state.rearm_ns <= now_ns) {
+      state.rearm_ns = 0;
+      state.rearmed_ns = now_ns;
+      state.window_start_ns = now_ns;
+      state.window_hits = 0;
+      state.window_stopped_ns = 0;
+      state.periods.back().end_ns = now_ns;
+      watch = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t Throttle::get_watch_count() const { return states.size(); }
+
+uint64_t Throttle::get_hits(uint32_t watch) const {
+  return states[watch].hits;
+}
+
+const std::vector<ThrottledPeriod> &
+Throttle::get_periods(uint32_t watch) const {
+  return states[watch].periods;
+}
+
+uint64_t Throttle::get_throttled_ns(uint32_t watch, uint64_t now_ns) const {
+  uint64_t total = 0;
+  for (const ThrottledPeriod &period : states[watch].periods) {
+    total += (period.end_ns ? period.end_ns : now_ns) - period.start_ns;
+  }
+  return total;
+}
+
+uint64_t Throttle::estimate_hits(uint32_t watch, uint64_t now_ns) const {
+  const State &state = states[watch];
+  uint64_t throttled = get_throttled_ns(watch, now_ns);
+  uint64_t armed = now_ns - state.start_ns - throttled;
+  if (armed == 0) {
+    return state.hits;
+  }
+  return state.hits + static_cast<uint64_t>(static_cast<double>(state.hits) *
+                                            throttled / armed);
+}
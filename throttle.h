@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Overhead a single watch may cost the tracee, measured over a window
+struct WatchBudget {
+  double max_hits_per_second = 0;  // 0 for no limit
+  double max_stopped_fraction = 0; // Of wall time, 0 for no limit
+  uint64_t window_ns = 100000000;
+  // Time a watch stays disarmed, doubled each time it is still hot right
+  // after being re-armed
+  uint64_t backoff_ns = 100000000;
+  uint64_t max_backoff_ns = 10000000000;
+};
+
+// Time a watch spent disarmed, end_ns is 0 while it still is
+struct ThrottledPeriod {
+  uint64_t start_ns;
+  uint64_t end_ns;
+};
+
+// Decides when a watch goes over its budget and when it may be re-armed.
+// Pure bookkeeping on timestamps, the backend does the actual disarming.
+class Throttle {
+  struct State {
+    uint64_t start_ns;
+    uint64_t window_start_ns;
+    uint64_t window_hits;
+    uint64_t window_stopped_ns;
+    uint64_t hits;
+    uint64_t backoff_ns;
+    uint64_t rearm_ns; // 0 while armed
+    uint64_t rearmed_ns;
+    std::vector<ThrottledPeriod> periods;
+  };
+
+  WatchBudget budget;
+  std::vector<State> states;
+
+public:
+  explicit Throttle(const WatchBudget &budget = WatchBudget());
+  // Whether any limit is set at all
+  bool is_enabled() const;
+  uint32_t add_watch(uint64_t now_ns);
+
+  // Accounts one hit of an armed watch that kept the tracee stopped for
+  // `stopped_ns`. Returns true if the watch has to be disarmed now.
+  bool record_hit(uint32_t watch, uint64_t now_ns, uint64_t stopped_ns);
+  bool is_throttled(uint32_t watch) const;
+  // Earliest re-arm time of a throttled watch, 0 if none is throttled
+  uint64_t next_rearm() const;
+  // Marks one watch due by `now_ns` as armed again, false if none is due
+  bool take_due(uint64_t now_ns, uint32_t &watch);
+
+  size_t get_watch_count() const;
+  uint64_t get_hits(uint32_t watch) const;
+  const std::vector<ThrottledPeriod> &get_periods(uint32_t watch) const;
+  uint64_t get_throttled_ns(uint32_t watch, uint64_t now_ns) const;
+  // Hits seen plus the ones the throttled periods likely hid, assuming the
+  // rate seen while armed
+  uint64_t estimate_hits(uint32_t watch, uint64_t now_ns) const;
+};
@@ -0,0 +1,289 @@
+#include "trace_format.h"
+#include "trace_writer.h"
+#include <cstring>
+#include <stdexcept>
+
+static const char trace_magic[8] = {'G', 'W', 'T', 'R', 'A', 'C', 'E', 0};
+static constexpr uint32_t trace_version = 4;
+
+void put_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+uint64_t get_varint(const uint8_t *&position, const uint8_t *end) {
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (position == end) {
+      break;
+    }
+    uint8_t byte = *position++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Malformed varint in trace");
+}
+
+uint64_t zigzag_encode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t zigzag_decode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint64_t trace_watch_bit(uint32_t watch) {
+  return 1ull << (watch < 63 ? watch : 63);
+}
+
+// Differences wrap around, so they are exact for any pair of values
+static int64_t difference(uint64_t a, uint64_t b) {
+  return static_cast<int64_t>(a - b);
+}
+
+static void put_string(std::string &out, const std::string &value) {
+  put_varint(out, value.size());
+  out += value;
+}
+
+static std::string get_string(const uint8_t *&position, const uint8_t *end) {
+  uint64_t size = get_varint(position, end);
+  if (size > static_cast<uint64_t>(end - position)) {
+    throw std::runtime_error("Truncated trace header");
+  }
+  std::string value(reinterpret_cast<const char *>(position), size);
+  position += size;
+  return value;
+}
+
+TracePieceValues::TracePieceValues(const TraceWatchInfo &watch)
+    : known(watch.size <= 8 ? 1 : 0), values() {
+  values[0] = watch.initial_value;
+}
+
+static void put_piece_values(std::string &out,
+                             const TracePieceValues &pieces) {
+  put_varint(out, pieces.known);
+  for (uint32_t offset = 0; offset < 32; ++offset) {
+    if (pieces.known & (1u << offset)) {
+      put_varint(out, zigzag_encode(pieces.values[offset]));
+    }
+  }
+}
+
+static void get_piece_values(const uint8_t *&position, const uint8_t *end,
+                             TracePieceValues &pieces) {
+  uint64_t known = get_varint(position, end);
+  if (known >> 32) {
+    throw std::runtime_error("Malformed piece values in trace");
+  }
+  pieces.known = known;
+  for (uint32_t offset = 0; offset < 32; ++offset) {
+    if (pieces.known & (1u << offset)) {
+      pieces.values[offset] = zigzag_decode(get_varint(position, end));
+    }
+  }
+}
+
+TraceEncoder::TraceEncoder(TraceMetadata trace_metadata)
+    : metadata(std::move(trace_metadata)), values(), block_values(),
+      columns(), block(), last_time(0), last_tid(0), last_ip(0) {
+  for (const TraceWatchInfo &watch : metadata.watches) {
+    values.emplace_back(watch);
+  }
+}
+
+void TraceEncoder::write_header(std::string &out) const {
+  out.append(trace_magic, sizeof(trace_magic));
+  out.append(reinterpret_cast<const char *>(&trace_version),
+             sizeof(trace_version));
+  put_string(out, metadata.build_id);
+  put_varint(out, metadata.base_address);
+  put_varint(out, metadata.watches.size());
+  for (const TraceWatchInfo &watch : metadata.watches) {
+    put_string(out, watch.name);
+    put_varint(out, watch.address);
+    put_varint(out, watch.size);
+    put_varint(out, zigzag_encode(watch.initial_value));
+  }
+}
+
+void TraceEncoder::add(const trace_record_t &record) {
+  if (record.watch >= values.size()) {
+    throw std::out_of_range("Trace record for an unknown watch");
+  }
+  if (block.record_count == 0) {
+    block_values = values;
+    block.first_time_ns = record.time_ns;
+    last_time = record.time_ns;
+    last_tid = 0;
+    last_ip = 0;
+  }
+  block.last_time_ns = record.time_ns;
+  block.watch_mask |= trace_watch_bit(record.watch);
+  ++block.record_count;
+
+  put_varint(columns[0],
+             zigzag_encode(difference(record.time_ns, last_time)));
+  put_varint(columns[1], zigzag_encode(record.tid - last_tid));
+  put_varint(columns[2], zigzag_encode(difference(record.ip, last_ip)));
+  TracePieceValues &pieces = values[record.watch];
+  uint8_t offset = record.offset & 31;
+  bool known = pieces.known & (1u << offset);
+  // Reads have no old value of their own. Writes can follow records that
+  // were filtered out, their old value is then not the last one written.
+  bool has_old =
+      !known || (record.access != static_cast<uint8_t>(TraceAccess::Read) &&
+                 record.old_value != pieces.values[offset]);
+  put_varint(columns[3], static_cast<uint64_t>(record.watch) << 7 |
+                             uint64_t(has_old) << 6 | offset << 1 |
+                             (record.access & 1));
+  if (has_old) {
+    put_varint(columns[4], zigzag_encode(difference(record.old_value,
+                                                    pieces.values[offset])));
+    pieces.known |= 1u << offset;
+    pieces.values[offset] = record.old_value;
+  }
+  put_varint(columns[4], zigzag_encode(difference(
+                             record.value, pieces.values[offset])));
+  last_time = record.time_ns;
+  last_tid = record.tid;
+  last_ip = record.ip;
+  pieces.values[offset] = record.value;
+}
+
+bool TraceEncoder::block_full() const {
+  return block.record_count >= block_records;
+}
+
+void TraceEncoder::finish_block(std::string &out) {
+  if (block.record_count == 0) {
+    return;
+  }
+  std::string body;
+  for (const TracePieceValues &pieces : block_values) {
+    put_piece_values(body, pieces);
+  }
+  for (std::string &column : columns) {
+    put_varint(body, column.size());
+    body += column;
+    column.clear();
+  }
+  block.size = body.size();
+  out.append(reinterpret_cast<const char *>(&block), sizeof(block));
+  out += body;
+  block = trace_block_header_t();
+}
+
+TraceReader::TraceReader(const std::string &path)
+    : file(std::make_unique<const MappedFile>(path)), metadata(),
+      blocks(nullptr), position(nullptr) {
+  const uint8_t *cursor = file->data();
+  const uint8_t *end = cursor + file->size();
+  uint32_t version;
+  if (file->size() < sizeof(trace_magic) + sizeof(version) ||
+      std::memcmp(cursor, trace_magic, sizeof(trace_magic)) != 0) {
+    throw std::runtime_error("Not a gwatch trace: " + path);
+  }
+  std::memcpy(&version, cursor + sizeof(trace_magic), sizeof(version));
+  if (version != trace_version) {
+    throw std::runtime_error("Unsupported trace version: " + path);
+  }
+  cursor += sizeof(trace_magic) + sizeof(version);
+
+  metadata.build_id = get_string(cursor, end);
+  metadata.base_address = get_varint(cursor, end);
+  uint64_t watch_count = get_varint(cursor, end);
+  for (uint64_t i = 0; i < watch_count; ++i) {
+    TraceWatchInfo watch;
+    watch.name = get_string(cursor, end);
+    watch.address = get_varint(cursor, end);
+    watch.size = get_varint(cursor, end);
+    watch.initial_value = zigzag_decode(get_varint(cursor, end));
+    metadata.watches.push_back(std::move(watch));
+  }
+  blocks = cursor;
+  position = cursor;
+}
+
+const TraceMetadata &TraceReader::get_metadata() const { return metadata; }
+
+const trace_block_header_t *TraceReader::next_block() {
+  const uint8_t *end = file->data() + file->size();
+  if (static_cast<size_t>(end - position) < sizeof(trace_block_header_t)) {
+    return nullptr; // A block cut short by a crash is dropped as well
+  }
+  auto *block = reinterpret_cast<const trace_block_header_t *>(position);
+  if (block->size > static_cast<size_t>(end - position) - sizeof(*block)) {
+    return nullptr;
+  }
+  position += sizeof(*block) + block->size;
+  return block;
+}
+
+void TraceReader::decode(const trace_block_header_t *block,
+                         std::vector<trace_record_t> &records) const {
+  const uint8_t *cursor = reinterpret_cast<const uint8_t *>(block + 1);
+  const uint8_t *end = cursor + block->size;
+  std::vector<TracePieceValues> values;
+  for (const TraceWatchInfo &watch : metadata.watches) {
+    values.emplace_back(watch);
+    get_piece_values(cursor, end, values.back());
+  }
+  const uint8_t *columns[5];
+  const uint8_t *column_ends[5];
+  for (int i = 0; i < 5; ++i) {
+    uint64_t size = get_varint(cursor, end);
+    if (size > static_cast<uint64_t>(end - cursor)) {
+      throw std::runtime_error("Truncated trace block");
+    }
+    columns[i] = cursor;
+    column_ends[i] = cursor + size;
+    cursor += size;
+  }
+
+  records.resize(block->record_count);
+  uint64_t time = block->first_time_ns;
+  int64_t tid = 0;
+  uint64_t ip = 0;
+  for (trace_record_t &record : records) {
+    time += zigzag_decode(get_varint(columns[0], column_ends[0]));
+    tid += zigzag_decode(get_varint(columns[1], column_ends[1]));
+    ip += zigzag_decode(get_varint(columns[2], column_ends[2]));
+    uint64_t watch = get_varint(columns[3], column_ends[3]);
+    if ((watch >> 7) >= values.size()) {
+      throw std::runtime_error("Trace record for an unknown watch");
+    }
+    record.time_ns = time;
+    record.tid = tid;
+    record.ip = ip;
+    record.watch = watch >> 7;
+    record.access = watch & 1;
+    record.offset = (watch >> 1) & 31;
+    TracePieceValues &pieces = values[record.watch];
+    if (watch & (1u << 6)) {
+      pieces.known |= 1u << record.offset;
+      pieces.values[record.offset] = static_cast<int64_t>(
+          static_cast<uint64_t>(pieces.values[record.offset]) +
+          zigzag_decode(get_varint(columns[4], column_ends[4])));
+    } else if (!(pieces.known & (1u << record.offset))) {
+      throw std::runtime_error("Trace record without a previous value");
+    }
+    int64_t delta = zigzag_decode(get_varint(columns[4], column_ends[4]));
+    record.old_value = pieces.values[record.offset];
+    record.value = static_cast<int64_t>(
+        static_cast<uint64_t>(record.old_value) + delta);
+    if (record.access == static_cast<uint8_t>(TraceAccess::Read)) {
+      record.old_value = record.value;
+    }
+    pieces.values[record.offset] = record.value;
+  }
+}
+
+void TraceReader::rewind() { position = blocks; }
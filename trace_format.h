@@ -0,0 +1,107 @@
+#pragma once
+#include "mapped_file.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct trace_record_t;
+
+// Columnar trace files
+//
+// A file is a header followed by independent blocks. The header holds the
+// magic, the version and the metadata below, varint encoded. Each block
+// starts with a trace_block_header_t, then holds the values of every watch
+// at the start of the block and one column per field:
+//   time   zigzag delta from the previous record (first_time_ns for the first)
+//   tid    zigzag delta from the previous record
+//   ip     zigzag delta from the previous record
+//   watch  watch index << 7 | has_old << 6 | offset << 1 | access
+//   value  zigzag delta from the old value
+// Offsets are only non-zero for watches over 8 bytes, which are reported per
+// piece, each piece with its own previous value. Values of a watch are a
+// bit mask of the offsets that have one, followed by those values. The old
+// value of a record is the previous value of its piece, unless has_old is
+// set: then the value column first holds the zigzag delta from that to the
+// old value. That is the case for the first record of a piece without a
+// previous value, and for writes after records --cond dropped. Each column
+// is prefixed with its length in bytes. Blocks can be skipped by time range
+// and watch without decoding them.
+
+struct TraceWatchInfo {
+  std::string name;
+  uint64_t address;
+  uint8_t size;
+  int64_t initial_value;
+};
+
+struct TraceMetadata {
+  std::string build_id; // Hex, empty if the binary has none
+  uint64_t base_address;
+  std::vector<TraceWatchInfo> watches;
+};
+
+struct trace_block_header_t {
+  uint32_t record_count;
+  uint32_t size; // Bytes following this header
+  uint64_t first_time_ns;
+  uint64_t last_time_ns;
+  uint64_t watch_mask; // Bit per watch with records, watches >= 63 share bit 63
+};
+
+// Last value of every piece of a watch, by offset
+struct TracePieceValues {
+  uint32_t known; // Bit per offset with a value
+  int64_t values[32];
+
+  // Only the whole of a watch up to 8 bytes is known from the start
+  explicit TracePieceValues(const TraceWatchInfo &watch);
+};
+
+void put_varint(std::string &out, uint64_t value);
+// Advances `position`, throws if the varint runs past `end`
+uint64_t get_varint(const uint8_t *&position, const uint8_t *end);
+uint64_t zigzag_encode(int64_t value);
+int64_t zigzag_decode(uint64_t value);
+uint64_t trace_watch_bit(uint32_t watch);
+
+// Accumulates records and turns them into blocks
+class TraceEncoder {
+  TraceMetadata metadata;
+  std::vector<TracePieceValues> values;
+  std::vector<TracePieceValues> block_values;
+  std::string columns[5];
+  trace_block_header_t block;
+  uint64_t last_time;
+  int64_t last_tid;
+  int64_t last_ip;
+
+public:
+  static constexpr uint32_t block_records = 4096;
+
+  explicit TraceEncoder(TraceMetadata metadata);
+  void write_header(std::string &out) const;
+  void add(const trace_record_t &record);
+  bool block_full() const;
+  // Appends the pending block, if any, and starts a new one
+  void finish_block(std::string &out);
+};
+
+// Streams through a mapped trace file one block at a time
+class TraceReader {
+  std::unique_ptr<const MappedFile> file;
+  TraceMetadata metadata;
+  const uint8_t *blocks;
+  const uint8_t *position;
+
+public:
+  explicit TraceReader(const std::string &path);
+  const TraceMetadata &get_metadata() const;
+
+  // Next block header, nullptr after the last block
+  const trace_block_header_t *next_block();
+  // Decodes the block last returned by next_block
+  void decode(const trace_block_header_t *block,
+              std::vector<trace_record_t> &records) const;
+  void rewind();
+};
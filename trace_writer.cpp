@@ -0,0 +1,124 @@
+#include "trace_writer.h"
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+// Records popped and bytes buffered before a write
+static constexpr size_t batch_records = 1024;
+static constexpr size_t batch_bytes = 64 * 1024;
+
+TraceWriter::TraceWriter(const std::string &path, TraceFormat format,
+                         TraceMetadata trace_metadata, size_t capacity)
+    : ring(capacity), metadata(std::move(trace_metadata)), encoder(metadata),
+      format(format), fd(-1),
+      owns_fd(false), stopping(false), thread(), stalls(0) {
+  if (path == "-") {
+    fd = STDOUT_FILENO;
+  } else {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open trace output: " + path);
+    }
+    owns_fd = true;
+  }
+  thread = std::thread(&TraceWriter::run, this);
+}
+
+TraceWriter::~TraceWriter() { close(); }
+
+void TraceWriter::push(const trace_record_t &record) {
+  while (!ring.try_push(record)) {
+    ++stalls;
+    std::this_thread::yield();
+  }
+}
+
+void TraceWriter::close() {
+  if (!thread.joinable()) {
+    return;
+  }
+  stopping.store(true, std::memory_order_release);
+  thread.join();
+  if (owns_fd) {
+    ::close(fd);
+    owns_fd = false;
+  }
+}
+
+uint64_t TraceWriter::get_stalls() const { return stalls; }
+
+void TraceWriter::run() {
+  std::vector<trace_record_t> batch(batch_records);
+  std::string buffer;
+  buffer.reserve(batch_bytes * 2);
+  if (format == TraceFormat::Columnar) {
+    encoder.write_header(buffer);
+  }
+  while (true) {
+    // Read the flag first, so that nothing pushed before close is missed
+    bool last = stopping.load(std::memory_order_acquire);
+    size_t count = ring.pop(batch.data(), batch.size());
+    for (size_t i = 0; i < count; ++i) {
+      format_record(batch[i], buffer);
+    }
+    if (buffer.size() >= batch_bytes || (count == 0 && !buffer.empty())) {
+      write_all(buffer);
+      buffer.clear();
+    }
+    if (count == 0) {
+      if (last) {
+        // Columnar blocks go out when full, the last one only here
+        encoder.finish_block(buffer);
+        write_all(buffer);
+        break;
+      }
+      // Idle: poll instead of being woken, so push never makes a syscall
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+void TraceWriter::format_record(const trace_record_t &record,
+                                std::string &out) {
+  if (format == TraceFormat::Binary) {
+    out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    return;
+  }
+  if (format == TraceFormat::Columnar) {
+    encoder.add(record);
+    if (encoder.block_full()) {
+      encoder.finish_block(out);
+    }
+    return;
+  }
+  out += metadata.watches[record.watch].name;
+  if (record.offset) {
+    out += '+';
+    out += std::to_string(record.offset);
+  }
+  if (record.access == static_cast<uint8_t>(TraceAccess::Write)) {
+    out += " write ";
+    out += std::to_string(record.old_value);
+    out += " -> ";
+  } else {
+    out += " read ";
+  }
+  out += std::to_string(record.value);
+  out += '\n';
+}
+
+void TraceWriter::write_all(const std::string &data) const {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return; // Output gone (e.g. closed pipe), nothing sensible to do
+    }
+    written += result;
+  }
+}
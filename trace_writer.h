@@ -0,0 +1,64 @@
+#pragma once
+#include "spsc_ring.h"
+#include "trace_format.h"
+#include "watch.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class TraceAccess : uint8_t { Read = 0, Write = 1 };
+
+// Fixed-size record of one hit, as it crosses from the event loop to the
+// writer thread and as it is stored in binary traces
+struct trace_record_t {
+  uint64_t time_ns;
+  uint64_t ip;
+  int64_t value;
+  int64_t old_value; // Equal to value for reads
+  int32_t tid;
+  uint16_t watch;
+  uint8_t access; // TraceAccess
+  uint8_t offset; // Into the variable, of the piece that was touched
+};
+
+// Binary is trace_record_t as is, Columnar is described in trace_format.h
+enum class TraceFormat { Text, Binary, Columnar };
+
+// Writes hits from a background thread, so that the event loop only copies
+// a record into a ring buffer and never formats or does I/O while the tracee
+// is stopped. Records are batched into large writes.
+class TraceWriter {
+  SpscRing<trace_record_t> ring;
+  TraceMetadata metadata;
+  TraceEncoder encoder;
+  TraceFormat format;
+  int fd;
+  bool owns_fd;
+  std::atomic<bool> stopping;
+  std::thread thread;
+  uint64_t stalls;
+
+  void run();
+  void format_record(const trace_record_t &record, std::string &out);
+  void write_all(const std::string &data) const;
+
+public:
+  static constexpr size_t default_capacity = 1 << 16;
+
+  // `path` "-" means stdout. Watches in `metadata` are in index order.
+  TraceWriter(const std::string &path, TraceFormat format,
+              TraceMetadata metadata, size_t capacity = default_capacity);
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+  // Writes out everything still queued
+  ~TraceWriter();
+
+  // Never drops a record: when the ring is full it waits for the writer
+  void push(const trace_record_t &record);
+  // Drains the ring and stops the writer thread, called by the destructor
+  void close();
+  // Times push found the ring full
+  uint64_t get_stalls() const;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+// A watched variable, resolved once before the tracee runs so that the stop
+// loop only deals with plain numbers
+struct Watch {
+  uintptr_t address; // Absolute address of the variable
+  uintptr_t word;    // Aligned word containing the variable
+  uint8_t size;      // In bytes, up to max_watch_size
+  uint8_t shift;     // Bit offset of the variable within the word
+  uint8_t slots;     // Debug registers covering it, bit n for DRn, 0 unarmed
+  uint64_t mask;     // Applied after the shift
+  long last_value;   // Of the first 8 bytes for larger variables
+};
+
+// Largest variable that can be watched, split over all debug registers
+constexpr uint8_t max_watch_size = 32;
+
+// Aligned part of a watch covered by a single debug register
+struct WatchPiece {
+  uintptr_t address;
+  uint8_t size; // 1, 2, 4 or 8
+};
+
+// One hit of a watch, as reported by a backend
+struct WatchEvent {
+  uint32_t watch;   // Index returned by WatchBackend::arm
+  int32_t tid;      // Thread that touched the variable
+  uintptr_t ip;     // Instruction pointer after the access
+  uint64_t time_ns; // CLOCK_MONOTONIC
+  long value;       // Value of the variable when the hit was observed
+  // Part of the variable that was touched. Variables of up to 8 bytes are
+  // reported whole, larger ones per piece with the value of that piece.
+  uint8_t offset;
+  uint8_t size;
+};
+
+// Source of watch hits. The ptrace backend stops the tracee on every hit,
+// other backends may observe hits without stopping it.
+class WatchBackend {
+public:
+  virtual ~WatchBackend() = default;
+  // Arms a watch, events for it carry the returned index
+  virtual uint32_t arm(const Watch &watch, bool write_only) = 0;
+  // Lets the tracee run until the next hit
+  // Returns false once the tracee has exited or a signal interrupted us
+  virtual bool next_event(WatchEvent &event) = 0;
+  // Whether next_event returned false because the tracee is gone, rather
+  // than because of a signal
+  virtual bool has_finished() const = 0;
+};